@@ -50,10 +50,13 @@ void GradBernTet(int N,  VectorXd r, VectorXd s, VectorXd t,
 		 MatrixXd &V1, MatrixXd &V2, MatrixXd &V3, MatrixXd &V4);
 
 // geofacs
-MatrixXd vgeofacs3d(VectorXd x,VectorXd y,VectorXd z,
-		    MatrixXd Dr,MatrixXd Ds,MatrixXd Dt);
-MatrixXd sgeofacs3d(VectorXd x,VectorXd y,VectorXd z,
-		    MatrixXd Drf,MatrixXd Dsf,MatrixXd Dtf);
+#define GEO_BLOCK 64 // elements per vgeofacs3d/sgeofacs3d call
+void vgeofacs3d(const MatrixXd &x, const MatrixXd &y, const MatrixXd &z, int e0, int Kb,
+		const MatrixXd &Dr, const MatrixXd &Ds, const MatrixXd &Dt,
+		MatrixXd &w, MatrixXd *vgeo[10], int o0);
+void sgeofacs3d(const MatrixXd &x, const MatrixXd &y, const MatrixXd &z, int e0, int Kb,
+		const MatrixXd &Drf, const MatrixXd &Dsf, const MatrixXd &Dtf,
+		MatrixXd &w, MatrixXd *sgeo[4], int o0);
 
 // extract tabulated nodes
 void Nodes3D(int N, VectorXd &r, VectorXd &s, VectorXd &t);
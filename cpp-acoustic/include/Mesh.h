@@ -5,10 +5,12 @@
 
 #include "Basis.h"
 
-// default order
-#ifndef p_N
-#define p_N 6
+// polynomial order, chosen at run time (setting "N", default from make N=...).
+// Kernels are still JIT-specialized on it through the kernel defines.
+#ifndef p_N_DEFAULT
+#define p_N_DEFAULT 6
 #endif
+extern int p_N;
 
 #define NODETOL   1e-6
 //#define NODETOL   1e-5
@@ -41,7 +43,13 @@ typedef struct foo {
   int **EToE; /* element to neighbor element (elements numbered by their proc) */
   int **EToF; /* element to neighbor face    (element local number 0,1,2) */
 
+  int NfacesUnique;   /* number of unique faces */
+  int *faceOwners;    /* k*Nfaces + f of each unique face, owned by the lower numbered element */
+  int NfacesBoundary; /* number of boundary faces */
+  int *boundaryFaces; /* k*Nfaces + f of each boundary face */
+
   VectorXi EToGmshE;
+  VectorXi ETag; /* physical tag of each element (0 if none) */
 
   int *bcflag; /* vector. entry n is 1 if vertex n is on a boundary */
 
@@ -56,6 +64,7 @@ typedef struct foo {
   //MatrixXi Fmask;
   int   **FmaskC; /* face node numbers in element volume data */
   MatrixXi Fmask;
+  MatrixXi FPerm; // face node permutations between neighboring faces (BuildFacePermutations)
   MatrixXi faceVolPerm  ; // permutation of f=0 lift matrix rows for f = 1,2,3
   VectorXd r,s,t;
 
@@ -76,7 +85,7 @@ typedef struct foo {
   // sparse bernstein arrays
   MatrixXi D_ids1,D_ids2,D_ids3,D_ids4;
   int **D1_ids, **D2_ids, **D3_ids, **D4_ids;
-  dfloat **D_vals;
+  MatrixXd D_vals;
 
   // decomposition of BB lift operator
   MatrixXd EEL_vals;
@@ -124,11 +133,11 @@ typedef struct foo {
 
   
   // DG connectivity maps
-  int *mapM,  *mapP; // face node id of +/- nodes (used in mesh connectivity)
-  int *vmapM, *vmapP; // volume id of -/+ ve trace of face node
+  dlong *mapM, *mapP; // face node id of +/- nodes (used in mesh connectivity)
+  dlong *vmapM, *vmapP; // volume id of -/+ ve trace of face node
 
   // time stepping constants
-  dfloat *rk4a, *rk4b, *rk4c;
+  double *rk4a, *rk4b, *rk4c;
 
   double hMax; // mesh size - computed
 }Mesh;
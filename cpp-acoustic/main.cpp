@@ -9,9 +9,16 @@ int main(int argc, char **argv){
   Mesh *mesh;
   int k, n, sk=0;
 
-  // read GMSH file
-  mesh = ReadGmsh3d(argv[1]);
-  int KblkV = 1, KblkS = 1, KblkU = 1;
+  // OpenMP threads and binding, before any parallel loop
+  SetupOpenMP(argv);
+
+  // polynomial order
+  p_N = GetIntSetting("N", p_N);
+  printf("N = %d\n", p_N);
+
+  // read GMSH file and find element-element connectivity (or load both from the mesh cache)
+  mesh = ReadMeshCached(argv[1]);
+  int KblkV = 0, KblkS = 0, KblkU = 0; // 0 = tuned value (or default)
   if(argc > 5){
     KblkV = atoi(argv[3]);
     KblkS = atoi(argv[4]);
@@ -20,9 +27,6 @@ int main(int argc, char **argv){
 
   printf("Kblk (V,S,U) = %d,%d,%d\n",KblkV,KblkS,KblkU);
   
-  // find element-element connectivity
-  FacePair3d(mesh);
-  
   // initialize arrays
   StartUp3d(mesh);
   printf("%d elements in mesh\n", mesh->K);
@@ -33,15 +37,18 @@ int main(int argc, char **argv){
 
   dfloat dt = WaveInitOCCA3d(mesh,KblkV,KblkS,KblkU);
   printf("dt = %17.15f\n", dt);
+  MeshCacheClose(mesh);
+  ReleaseHostArrays(mesh);
+  ReportHostMemory("setup");
 
   // default to cavity solution
   double (*uexptr)(double,double,double,double) = NULL;
   uexptr = &CavitySolution; // if domain = [-1,1]^3
 
-  //  =========== field storage (dfloat) ===========
+  //  =========== field storage (double, converted to the device precision) ===========
 
-  dfloat *Q = (dfloat*) calloc(p_Nfields*mesh->K*p_Np, sizeof(dfloat));   // 4 fields
-  dfloat *P = (dfloat*) calloc(p_Nfields*mesh->K*p_Np, sizeof(dfloat));
+  double *Q = (double*) calloc((dlong) p_Nfields*mesh->K*p_Np, sizeof(double));   // 4 fields
+  double *P = (double*) calloc((dlong) p_Nfields*mesh->K*p_Np, sizeof(double));
 
   // set u0
   WaveSetU0(mesh, Q, P, 0.0, uexptr); // interpolate
@@ -61,18 +68,24 @@ int main(int argc, char **argv){
   }
   
   printf("Running until time = %f\n",FinalTime);
-  
 
-  time_kernels(mesh); return 0;
+  // kernel benchmarks instead of a solve
+  if (GetIntSetting("time_kernels", 0)){
+    time_kernels(mesh);
+    return 0;
+  }
   
-  Wave_RK(mesh,FinalTime,dt); //run bb_WADG with M=1 and full-quadrature WADG  kernels
+  Wave_RK(mesh,FinalTime,dt); //run bb_WADG with M=1 and/or full-quadrature WADG kernels
   
   //unload data from GPU
   WaveGetData3d(mesh, Q, P);
-  compute_difference_Bern(mesh, Q, P, L2err, relL2err);
+  StorageReport(mesh, Q, FinalTime, uexptr);
+  if (waveScheme==SCHEME_COMPARE){
+    compute_difference_Bern(mesh, Q, P, L2err, relL2err);
   
-  printf("N = %d, Mesh size = %f, ndofs = %d, L2 difference at time %f = %6.6e\n",
-	 p_N,mesh->hMax,mesh->K*p_Np,FinalTime,L2err);
+    printf("N = %d, Mesh size = %f, ndofs = %d, L2 difference at time %f = %6.6e\n",
+	   p_N,mesh->hMax,mesh->K*p_Np,FinalTime,L2err);
+  }
   
   return 0;
   
@@ -0,0 +1,609 @@
+#include <unistd.h>
+#include "fem.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Native CPU versions of the nodal rk_volume/rk_surface kernels.
+
+   Elements are processed in blocks of HBLK (setting "host_block"). Each
+   block is packed node-major/element-minor (X[n*ldx + e]) so that the
+   per-element matrix products become small GEMMs against the constant
+   operators
+       [Dr;Ds;Dt] * p        (3Np x Np)      * (Np x B)
+       [Dr Ds Dt] * [Ur;Us;Ut] (Np x 3Np)   * (3Np x B)
+       LIFT * flux           (Np x NfpNfaces) * (NfpNfaces x 4B)
+   The operators are packed once into p_MR-row panels; the microkernel
+   keeps a p_MR x p_NR block of C in registers and vectorizes over
+   elements. Blocks are distributed over OpenMP threads, each with its own
+   preallocated workspace.
+
+   The Bernstein volume kernel (USE_BERN=1) instead packs p_W elements
+   element-interleaved (X[n*p_W + e], one SIMD vector per node) so that
+   the 4-nonzero derivative stencils D1_ids..D4_ids, which are the same
+   for every element, become contiguous vector FMAs with no gathers.
+
+   host_rk_stage_fused runs a whole nodal LSRK stage block by block
+   (setting "host_fused = 1"; the default block then fits in L2).
+
+   Selected with the setting "host_kernels = 1" in RK_step. Works on the
+   OCCA buffers directly, so it needs a host backend (occa_mode = Serial
+   or OpenMP). */
+
+#define p_MR 4   // operator rows per microkernel
+#define p_NR 16  // elements per microkernel (SIMD lanes)
+
+// elements per SIMD vector in the Bernstein kernel (AVX2: 8, AVX-512: 16)
+#ifndef p_W
+#if defined(__AVX512F__)
+#define p_W 16
+#else
+#define p_W 8
+#endif
+#endif
+
+extern int nvgeo, nfgeo; // geometric factors per element/face (WaveOKL3d.cpp)
+
+static int HBLK;                // elements per block, multiple of p_NR
+static dfloat *DrstPack = NULL; // [Dr;Ds;Dt] in p_MR-row panels
+static dfloat *DcatPack = NULL; // [Dr Ds Dt]
+static dfloat *LIFTPack = NULL;
+static int *hFmask = NULL;
+static int Nthreads = 1;
+static dfloat **workspace = NULL; // per thread
+static int wsKernels;             // workspace used by the kernels; fused stage rhs follows
+
+static int *hDids = NULL;     // Bernstein stencil: node n, direction d, nonzero j at [(n*4 + d)*4 + j]
+static dfloat *hDvals = NULL; // stencil weights [n*4 + j], shared by all directions
+
+// pack row-major M x Kd operator into panels of p_MR rows, zero padded
+static dfloat *packOperator(MatrixXd A){
+  int M = A.rows(), Kd = A.cols();
+  int Mpad = p_MR*((M + p_MR - 1)/p_MR);
+  dfloat *Apack = (dfloat*) calloc(Mpad*Kd, sizeof(dfloat));
+  for (int i = 0; i < M; ++i){
+    for (int k = 0; k < Kd; ++k){
+      int panel = i/p_MR, r = i%p_MR;
+      Apack[panel*p_MR*Kd + k*p_MR + r] = (dfloat) A(i,k);
+    }
+  }
+  return Apack;
+}
+
+// C(rows x p_NR) = A panel (p_MR x Kd) * X(Kd x p_NR); C, X have leading dim ld
+static inline void microKernel(int Kd, int rows, const dfloat *Apanel,
+			       const dfloat *X, int ldx, dfloat *C, int ldc){
+
+  dfloat acc[p_MR][p_NR];
+  for (int r = 0; r < p_MR; ++r){
+    for (int j = 0; j < p_NR; ++j){
+      acc[r][j] = 0.f;
+    }
+  }
+
+  for (int k = 0; k < Kd; ++k){
+    const dfloat *x = X + k*ldx;
+    const dfloat *a = Apanel + k*p_MR;
+    for (int r = 0; r < p_MR; ++r){
+      const dfloat ar = a[r];
+#pragma omp simd
+      for (int j = 0; j < p_NR; ++j){
+	acc[r][j] += ar*x[j];
+      }
+    }
+  }
+
+  for (int r = 0; r < rows; ++r){
+#pragma omp simd
+    for (int j = 0; j < p_NR; ++j){
+      C[r*ldc + j] = acc[r][j];
+    }
+  }
+}
+
+// C (M x Ncols) = A (M x Kd) * X (Kd x Ncols), Ncols a multiple of p_NR
+static void blockGemm(int M, int Kd, int Ncols, const dfloat *Apack,
+		      const dfloat *X, int ldx, dfloat *C, int ldc){
+  for (int i = 0; i < M; i += p_MR){
+    const dfloat *Apanel = Apack + i*Kd;
+    int rows = min(p_MR, M - i);
+    for (int j = 0; j < Ncols; j += p_NR){
+      microKernel(Kd, rows, Apanel, X + j, ldx, C + i*ldc + j, ldc);
+    }
+  }
+}
+
+void HostKernelsInit(Mesh *mesh){
+
+  // fused stage: Q, resQ and rhs of a block should fit in half of L2
+  int defaultBlock = 32;
+  if (GetIntSetting("host_fused", 0)){
+    long L2 = 256*1024;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    if (sysconf(_SC_LEVEL2_CACHE_SIZE) > 0){
+      L2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    }
+#endif
+    defaultBlock = (int) (L2/(2*3*p_Nfields*p_Np*sizeof(dfloat)));
+  }
+  HBLK = p_NR*max(1, GetIntSetting("host_block", defaultBlock)/p_NR);
+
+  MatrixXd Drst(3*p_Np, p_Np);
+  Drst << mesh->Dr, mesh->Ds, mesh->Dt;
+  MatrixXd Dcat(p_Np, 3*p_Np);
+  Dcat << mesh->Dr, mesh->Ds, mesh->Dt;
+
+  DrstPack = packOperator(Drst);
+  DcatPack = packOperator(Dcat);
+  LIFTPack = packOperator(mesh->LIFT);
+
+  hFmask = (int*) malloc(p_Nfp*p_Nfaces*sizeof(int));
+  for (int f = 0; f < p_Nfaces; ++f){
+    for (int i = 0; i < p_Nfp; ++i){
+      hFmask[i + f*p_Nfp] = mesh->Fmask(i,f);
+    }
+  }
+
+#ifdef _OPENMP
+  Nthreads = omp_get_max_threads();
+#endif
+
+  // volume: P (Np), U (3Np), grad (3Np), div (Np); surface: flux (4 NfpNfaces), lift (4 Np)
+  int Mpad = p_MR*((3*p_Np + p_MR - 1)/p_MR);
+  int volSize = (p_Np + 3*p_Np + Mpad + Mpad)*HBLK;
+  int surfSize = (4*p_Nfp*p_Nfaces + 4*Mpad)*HBLK;
+  int bernSize = 2*p_Nfields*p_Np*p_W; // packed Q, packed rhs
+  wsKernels = max(max(volSize, surfSize), bernSize);
+  int wsize = wsKernels + p_Nfields*p_Np*HBLK; // block rhs for the fused stage
+  workspace = (dfloat**) calloc(Nthreads, sizeof(dfloat*));
+  for (int t = 0; t < Nthreads; ++t){
+    workspace[t] = (dfloat*) calloc(wsize, sizeof(dfloat));
+  }
+
+  hDids = (int*) malloc(16*p_Np*sizeof(int));
+  hDvals = (dfloat*) malloc(4*p_Np*sizeof(dfloat));
+  for (int n = 0; n < p_Np; ++n){
+    for (int j = 0; j < 4; ++j){
+      hDids[(n*4 + 0)*4 + j] = mesh->D1_ids[n][j];
+      hDids[(n*4 + 1)*4 + j] = mesh->D2_ids[n][j];
+      hDids[(n*4 + 2)*4 + j] = mesh->D3_ids[n][j];
+      hDids[(n*4 + 3)*4 + j] = mesh->D4_ids[n][j];
+      hDvals[n*4 + j] = mesh->D_vals(n,j);
+    }
+  }
+
+#if USE_BERN
+  printf("host Bernstein kernels: %d elements per SIMD vector, %d threads\n", p_W, Nthreads);
+#else
+  printf("host nodal kernels: %d elements per block, %d threads\n", HBLK, Nthreads);
+#endif
+}
+
+// volume terms of elements k0..k0+Kb-1 into rhs (rhs points at element k0)
+static void volumeBlock(int k0, int Kb, const dfloat *vgeo, const dfloat *Q,
+			dfloat *rhsBlk, dfloat *ws){
+
+  const int B = HBLK;
+  const int Mpad = p_MR*((3*p_Np + p_MR - 1)/p_MR);
+
+  dfloat *P    = ws;                // Np x B
+  dfloat *U    = P + p_Np*B;        // 3Np x B
+  dfloat *grad = U + 3*p_Np*B;      // 3Np x B
+  dfloat *div  = grad + Mpad*B;     // Np x B
+
+  // pack p and contravariant velocity (zero padded past the last element)
+  for (int e = 0; e < B; ++e){
+    const int k = k0 + e;
+    if (e < Kb){
+      const dfloat *G = vgeo + k*nvgeo;
+      const dfloat *Qk = Q + (dlong) k*p_Np*p_Nfields;
+      for (int n = 0; n < p_Np; ++n){
+	const dfloat un = Qk[n + p_Np], vn = Qk[n + 2*p_Np], wn = Qk[n + 3*p_Np];
+	P[n*B + e] = Qk[n];
+	U[n*B + e]          = un*G[0] + vn*G[1] + wn*G[2];
+	U[(n+p_Np)*B + e]   = un*G[3] + vn*G[4] + wn*G[5];
+	U[(n+2*p_Np)*B + e] = un*G[6] + vn*G[7] + wn*G[8];
+      }
+    }else{
+      for (int n = 0; n < p_Np; ++n){
+	P[n*B + e] = 0.f;
+	U[n*B + e] = U[(n+p_Np)*B + e] = U[(n+2*p_Np)*B + e] = 0.f;
+      }
+    }
+  }
+
+  blockGemm(3*p_Np, p_Np, B, DrstPack, P, B, grad, B);
+  blockGemm(p_Np, 3*p_Np, B, DcatPack, U, B, div, B);
+
+  // unpack
+  for (int e = 0; e < Kb; ++e){
+    const int k = k0 + e;
+    const dfloat *G = vgeo + k*nvgeo;
+    dfloat *rhs = rhsBlk + e*p_Np*p_Nfields;
+    for (int n = 0; n < p_Np; ++n){
+      const dfloat dpdr = grad[n*B + e];
+      const dfloat dpds = grad[(n+p_Np)*B + e];
+      const dfloat dpdt = grad[(n+2*p_Np)*B + e];
+      rhs[n]          = -div[n*B + e];
+      rhs[n + p_Np]   = -(G[0]*dpdr + G[3]*dpds + G[6]*dpdt);
+      rhs[n + 2*p_Np] = -(G[1]*dpdr + G[4]*dpds + G[7]*dpdt);
+      rhs[n + 3*p_Np] = -(G[2]*dpdr + G[5]*dpds + G[8]*dpdt);
+    }
+  }
+}
+
+/* adds surface terms of elements k0..k0+Kb-1 to rhs (rhs points at element
+   k0); interior = 1 for blocks without boundary faces (split_boundary) */
+template <int interior>
+static void surfaceBlock(int k0, int Kb, const dfloat *fgeo, const dlong *vmapP,
+			 const dfloat *Q, dfloat *rhsBlk, dfloat *ws){
+
+  const int B = HBLK;
+  const int NfpNfaces = p_Nfp*p_Nfaces;
+
+  dfloat *flux = ws;                     // NfpNfaces x 4B (field-major columns)
+  dfloat *lift = flux + NfpNfaces*4*B;   // Np x 4B
+
+  for (int e = 0; e < B; ++e){
+    const int k = k0 + e;
+    if (e >= Kb){
+      for (int n = 0; n < NfpNfaces; ++n){
+	for (int fld = 0; fld < 4; ++fld){
+	  flux[n*4*B + fld*B + e] = 0.f;
+	}
+      }
+      continue;
+    }
+    for (int n = 0; n < NfpNfaces; ++n){
+      const int f = n/p_Nfp;
+      dlong idM = hFmask[n] + (dlong) k*p_Np*p_Nfields;
+      dlong idP = vmapP[n + (dlong) k*NfpNfaces];
+      const int isBoundary = !interior && idM==idP;
+
+      const dfloat *fg = fgeo + f*nfgeo + nfgeo*p_Nfaces*k;
+      const dfloat Fscale = fg[0], nx = fg[1], ny = fg[2], nz = fg[3];
+
+      const dfloat pM = Q[idM], uM = Q[idM + p_Np], vM = Q[idM + 2*p_Np], wM = Q[idM + 3*p_Np];
+      const dfloat pP = Q[idP], uP = Q[idP + p_Np], vP = Q[idP + 2*p_Np], wP = Q[idP + 3*p_Np];
+
+      dfloat pjump = pP - pM;
+      dfloat Unjump = (uP-uM)*nx + (vP-vM)*ny + (wP-wM)*nz;
+      if (isBoundary){
+	pjump = -2.f*pM;
+	Unjump = 0.f;
+      }
+      const dfloat pflux = .5f*(pjump - Unjump)*Fscale;
+      const dfloat Uflux = .5f*(Unjump - pjump)*Fscale;
+
+      dfloat *fl = flux + n*4*B + e;
+      fl[0]   = pflux;
+      fl[B]   = Uflux*nx;
+      fl[2*B] = Uflux*ny;
+      fl[3*B] = Uflux*nz;
+    }
+  }
+
+  blockGemm(p_Np, NfpNfaces, 4*B, LIFTPack, flux, 4*B, lift, 4*B);
+
+  for (int e = 0; e < Kb; ++e){
+    dfloat *rhs = rhsBlk + e*p_Np*p_Nfields;
+    for (int fld = 0; fld < 4; ++fld){
+      for (int n = 0; n < p_Np; ++n){
+	rhs[n + fld*p_Np] += lift[n*4*B + fld*B + e];
+      }
+    }
+  }
+}
+
+static int threadNum(){
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+void host_rk_volume(int K, const dfloat *vgeo, const dfloat *Q, dfloat *rhsQ){
+
+  const int Nblocks = (K + HBLK - 1)/HBLK;
+
+#pragma omp parallel for schedule(static)
+  for (int blk = 0; blk < Nblocks; ++blk){
+    const int k0 = blk*HBLK;
+    volumeBlock(k0, min(HBLK, K - k0), vgeo, Q, rhsQ + (dlong) k0*p_Np*p_Nfields, workspace[threadNum()]);
+  }
+}
+
+// surface terms of elements K0 <= k < K, none of which has a boundary face if interior
+void host_rk_surface(int K0, int K, int interior, const dfloat *fgeo, const dlong *vmapP,
+		     const dfloat *Q, dfloat *rhsQ){
+
+  const int Nblocks = (K - K0 + HBLK - 1)/HBLK;
+
+#pragma omp parallel for schedule(static)
+  for (int blk = 0; blk < Nblocks; ++blk){
+    const int k0 = K0 + blk*HBLK;
+    dfloat *rhs = rhsQ + (dlong) k0*p_Np*p_Nfields;
+    if (interior){
+      surfaceBlock<1>(k0, min(HBLK, K - k0), fgeo, vmapP, Q, rhs, workspace[threadNum()]);
+    }else{
+      surfaceBlock<0>(k0, min(HBLK, K - k0), fgeo, vmapP, Q, rhs, workspace[threadNum()]);
+    }
+  }
+}
+
+/* One fused LSRK stage: each block of HBLK elements goes through volume,
+   surface and update while its Q and rhs are still in cache, and rhsQ is
+   never written to memory. Surface terms read neighbor traces from other
+   blocks, so the updated solution is written to Qnew instead of Q; the
+   caller swaps Q and Qnew after the stage. */
+void host_rk_stage_fused(int K, const dfloat *vgeo, const dfloat *fgeo, const dlong *vmapP,
+			 dfloat fa, dfloat fb, dfloat fdt,
+			 const dfloat *Q, dfloat *resQ, dfloat *Qnew){
+
+  const int Nblocks = (K + HBLK - 1)/HBLK;
+
+#pragma omp parallel for schedule(static)
+  for (int blk = 0; blk < Nblocks; ++blk){
+
+    dfloat *ws = workspace[threadNum()];
+    dfloat *rhs = ws + wsKernels; // Nfields*Np*HBLK
+
+    const int k0 = blk*HBLK;
+    const int Kb = min(HBLK, K - k0);
+    volumeBlock(k0, Kb, vgeo, Q, rhs, ws);
+    surfaceBlock<0>(k0, Kb, fgeo, vmapP, Q, rhs, ws);
+
+    const dlong offset = (dlong) k0*p_Np*p_Nfields;
+    const int Nblk = Kb*p_Np*p_Nfields;
+#pragma omp simd
+    for (int n = 0; n < Nblk; ++n){
+      const dfloat res = fa*resQ[offset + n] + fdt*rhs[n];
+      resQ[offset + n] = res;
+      Qnew[offset + n] = Q[offset + n] + fb*res;
+    }
+  }
+}
+
+/* Temporal blocking: several LSRK stages per sweep over the mesh.
+
+   Elements are split into patches of host_patch consecutive elements. A
+   patch is grown by NSTAGE layers of face neighbors (EToE), stored core
+   first and then layer by layer. Stage j of a sweep of ns stages updates
+   layers 0..ns-1-j, whose neighbors lie in layers 0..ns-j and were
+   updated by stage j-1, so the core ends up exactly as after ns global
+   stages. The halo layers are recomputed by every patch that needs them.
+   Each patch reads Q/resQ of its elements once and writes its core once
+   per sweep instead of streaming the whole mesh once per stage. */
+
+static int NSTAGE = 0;            // stages per sweep (halo depth)
+static int Npatches = 0;
+static int **patchElems = NULL;   // global ids, core first then layer by layer
+static int **patchLayers = NULL;  // patchLayers[p][l] = #elements in layers < l
+static dlong **patchVmapP = NULL; // vmapP in patch-local ids
+static dfloat **patchWork = NULL; // per thread: Q, resQ, rhs, vgeo, fgeo
+
+void HostTemporalInit(Mesh *mesh, const dlong *vmapP, int Nstages){
+
+  const int K = mesh->K;
+  const int NfpNfaces = p_Nfp*p_Nfaces;
+  const int Npatch = max(1, GetIntSetting("host_patch", 2048));
+
+  NSTAGE = Nstages;
+  Npatches = (K + Npatch - 1)/Npatch;
+  patchElems  = (int**) calloc(Npatches, sizeof(int*));
+  patchLayers = (int**) calloc(Npatches, sizeof(int*));
+  patchVmapP  = (dlong**) calloc(Npatches, sizeof(dlong*));
+
+  int *localId = (int*) malloc(K*sizeof(int));
+  int *stamp = (int*) malloc(K*sizeof(int));
+  for (int k = 0; k < K; ++k){
+    stamp[k] = -1;
+  }
+
+  long long Nlocal = 0;
+  int maxLocal = 0;
+  vector<int> elems;
+  for (int p = 0; p < Npatches; ++p){
+
+    elems.clear();
+    patchLayers[p] = (int*) calloc(NSTAGE + 2, sizeof(int));
+    for (int k = p*Npatch; k < min(K, (p+1)*Npatch); ++k){
+      stamp[k] = p;
+      localId[k] = elems.size();
+      elems.push_back(k);
+    }
+    patchLayers[p][1] = elems.size();
+
+    // add one layer of face neighbors at a time
+    int start = 0;
+    for (int l = 1; l <= NSTAGE; ++l){
+      int end = elems.size();
+      for (int i = start; i < end; ++i){
+	for (int f = 0; f < p_Nfaces; ++f){
+	  int kP = mesh->EToE[elems[i]][f];
+	  if (stamp[kP]!=p){
+	    stamp[kP] = p;
+	    localId[kP] = elems.size();
+	    elems.push_back(kP);
+	  }
+	}
+      }
+      start = end;
+      patchLayers[p][l+1] = elems.size();
+    }
+
+    const int Nloc = elems.size();
+    patchElems[p] = (int*) malloc(Nloc*sizeof(int));
+    patchVmapP[p] = (dlong*) malloc(Nloc*NfpNfaces*sizeof(dlong));
+    for (int i = 0; i < Nloc; ++i){
+      const int k = elems[i];
+      patchElems[p][i] = k;
+      for (int n = 0; n < NfpNfaces; ++n){
+	dlong idP = vmapP[n + (dlong) k*NfpNfaces];
+	int kP = (int) (idP/(p_Np*p_Nfields));
+	int lid = i*p_Np*p_Nfields + hFmask[n]; // outer layer: never used
+	if (stamp[kP]==p){
+	  lid = localId[kP]*p_Np*p_Nfields + (int) (idP%(p_Np*p_Nfields));
+	}
+	patchVmapP[p][n + i*NfpNfaces] = lid;
+      }
+    }
+    Nlocal += Nloc;
+    maxLocal = max(maxLocal, Nloc);
+  }
+  free(localId);
+  free(stamp);
+
+  const int Nblocked = HBLK*((maxLocal + HBLK - 1)/HBLK);
+  patchWork = (dfloat**) calloc(Nthreads, sizeof(dfloat*));
+  for (int t = 0; t < Nthreads; ++t){
+    patchWork[t] = (dfloat*) calloc(Nblocked*(3*p_Nfields*p_Np + nvgeo + nfgeo*p_Nfaces), sizeof(dfloat));
+  }
+
+  printf("temporal blocking: %d stages per sweep, %d patches, %.2f elements computed per element\n",
+	 NSTAGE, Npatches, (double) Nlocal/K);
+}
+
+// ns <= NSTAGE stages starting at stage s0; reads Q/resQ, writes Qnew/resNew
+void host_rk_stages_temporal(int K, const dfloat *vgeo, const dfloat *fgeo,
+			     const double *rk4a, const double *rk4b, int s0, int ns, dfloat fdt,
+			     const dfloat *Q, const dfloat *resQ, dfloat *Qnew, dfloat *resNew){
+
+  const int NpNfields = p_Np*p_Nfields;
+
+#pragma omp parallel for schedule(dynamic)
+  for (int p = 0; p < Npatches; ++p){
+
+    const int t = threadNum();
+    const int *elems = patchElems[p];
+    const int Nloc = patchLayers[p][ns+1];
+    const int Nblocked = HBLK*((patchLayers[p][NSTAGE+1] + HBLK - 1)/HBLK);
+
+    dfloat *lQ    = patchWork[t];
+    dfloat *lres  = lQ + Nblocked*NpNfields;
+    dfloat *lrhs  = lres + Nblocked*NpNfields;
+    dfloat *lvgeo = lrhs + Nblocked*NpNfields;
+    dfloat *lfgeo = lvgeo + Nblocked*nvgeo;
+
+    for (int i = 0; i < Nloc; ++i){
+      const int k = elems[i];
+      for (int n = 0; n < NpNfields; ++n){
+	lQ[i*NpNfields + n]   = Q[(dlong) k*NpNfields + n];
+	lres[i*NpNfields + n] = resQ[(dlong) k*NpNfields + n];
+      }
+      for (int g = 0; g < nvgeo; ++g){
+	lvgeo[i*nvgeo + g] = vgeo[k*nvgeo + g];
+      }
+      for (int g = 0; g < nfgeo*p_Nfaces; ++g){
+	lfgeo[i*nfgeo*p_Nfaces + g] = fgeo[k*nfgeo*p_Nfaces + g];
+      }
+    }
+
+    for (int j = 0; j < ns; ++j){
+      const int Nstage = patchLayers[p][ns-j]; // layers 0..ns-1-j
+      for (int k0 = 0; k0 < Nstage; k0 += HBLK){
+	const int Kb = min(HBLK, Nstage - k0);
+	volumeBlock(k0, Kb, lvgeo, lQ, lrhs + k0*NpNfields, workspace[t]);
+	surfaceBlock<0>(k0, Kb, lfgeo, patchVmapP[p], lQ, lrhs + k0*NpNfields, workspace[t]);
+      }
+
+      const dfloat fa = rk4a[s0+j], fb = rk4b[s0+j];
+#pragma omp simd
+      for (int n = 0; n < Nstage*NpNfields; ++n){
+	const dfloat res = fa*lres[n] + fdt*lrhs[n];
+	lres[n] = res;
+	lQ[n] += fb*res;
+      }
+    }
+
+    for (int i = 0; i < patchLayers[p][1]; ++i){
+      const int k = elems[i];
+      for (int n = 0; n < NpNfields; ++n){
+	Qnew[(dlong) k*NpNfields + n]   = lQ[i*NpNfields + n];
+	resNew[(dlong) k*NpNfields + n] = lres[i*NpNfields + n];
+      }
+    }
+  }
+}
+
+void host_rk_volume_bern(int K, const dfloat *vgeo, const dfloat *Q, dfloat *rhsQ){
+
+  const int Nblocks = (K + p_W - 1)/p_W;
+
+#pragma omp parallel for schedule(static)
+  for (int blk = 0; blk < Nblocks; ++blk){
+
+    // element-interleaved p, Ur, Us, Ut and output
+    dfloat *sp  = workspace[threadNum()];
+    dfloat *sUr = sp  + p_Np*p_W;
+    dfloat *sUs = sUr + p_Np*p_W;
+    dfloat *sUt = sUs + p_Np*p_W;
+    dfloat *R   = sUt + p_Np*p_W;
+
+    const int k0 = blk*p_W;
+    const int Kb = min(p_W, K - k0);
+
+    dfloat G[9][p_W];
+    for (int e = 0; e < p_W; ++e){
+      const int k = k0 + min(e, Kb-1); // pad with the last element
+      for (int g = 0; g < 9; ++g){
+	G[g][e] = vgeo[k*nvgeo + g];
+      }
+    }
+
+    for (int e = 0; e < p_W; ++e){
+      const dfloat *Qk = Q + (dlong) (k0 + min(e, Kb-1))*p_Np*p_Nfields;
+      for (int n = 0; n < p_Np; ++n){
+	const dfloat un = Qk[n + p_Np], vn = Qk[n + 2*p_Np], wn = Qk[n + 3*p_Np];
+	sp[n*p_W + e]  = Qk[n];
+	sUr[n*p_W + e] = un*G[0][e] + vn*G[1][e] + wn*G[2][e];
+	sUs[n*p_W + e] = un*G[3][e] + vn*G[4][e] + wn*G[5][e];
+	sUt[n*p_W + e] = un*G[6][e] + vn*G[7][e] + wn*G[8][e];
+      }
+    }
+
+    for (int n = 0; n < p_Np; ++n){
+      dfloat p1[p_W], p2[p_W], p3[p_W], p4[p_W], dU1[p_W], dU2[p_W];
+#pragma omp simd
+      for (int e = 0; e < p_W; ++e){
+	p1[e] = p2[e] = p3[e] = p4[e] = dU1[e] = dU2[e] = 0.f;
+      }
+
+      for (int j = 0; j < 4; ++j){
+	const dfloat Dval = hDvals[n*4 + j];
+	const int i1 = hDids[(n*4 + 0)*4 + j]*p_W;
+	const int i2 = hDids[(n*4 + 1)*4 + j]*p_W;
+	const int i3 = hDids[(n*4 + 2)*4 + j]*p_W;
+	const int i4 = hDids[(n*4 + 3)*4 + j]*p_W;
+#pragma omp simd
+	for (int e = 0; e < p_W; ++e){
+	  p1[e]  += Dval*sp[i1 + e];
+	  p2[e]  += Dval*sp[i2 + e];
+	  p3[e]  += Dval*sp[i3 + e];
+	  p4[e]  += Dval*sp[i4 + e];
+	  dU1[e] += Dval*(sUr[i2 + e] + sUs[i3 + e] + sUt[i4 + e]);
+	  dU2[e] += Dval*(sUr[i1 + e] + sUs[i1 + e] + sUt[i1 + e]);
+	}
+      }
+
+#pragma omp simd
+      for (int e = 0; e < p_W; ++e){
+	const dfloat dpdr = .5f*(p2[e] - p1[e]);
+	const dfloat dpds = .5f*(p3[e] - p1[e]);
+	const dfloat dpdt = .5f*(p4[e] - p1[e]);
+	R[n*p_W + e]              = -.5f*(dU1[e] - dU2[e]);
+	R[(n + p_Np)*p_W + e]     = -(G[0][e]*dpdr + G[3][e]*dpds + G[6][e]*dpdt);
+	R[(n + 2*p_Np)*p_W + e]   = -(G[1][e]*dpdr + G[4][e]*dpds + G[7][e]*dpdt);
+	R[(n + 3*p_Np)*p_W + e]   = -(G[2][e]*dpdr + G[5][e]*dpds + G[8][e]*dpdt);
+      }
+    }
+
+    for (int e = 0; e < Kb; ++e){
+      dfloat *rhs = rhsQ + (dlong) (k0 + e)*p_Np*p_Nfields;
+      for (int n = 0; n < p_Nfields*p_Np; ++n){
+	rhs[n] = R[n*p_W + e];
+      }
+    }
+  }
+}
@@ -0,0 +1,423 @@
+#include <algorithm>
+#include <fstream>
+#include "fem.h"
+
+/* Code generator for the Bernstein kernels (setting bern_codegen = 1).
+
+   rk_volume_bern, rk_surface_bern and rk_update_BB_WADG read their sparse
+   structure (D1_ids..D4_ids and Dvals; Fmask, L0 and EEL; col_id, L_id,
+   col_val and the ENMT/ENM projections) from device buffers, one load per
+   index. These tables depend only on N, so BernKernelGen writes OKL
+   versions of the three kernels with every index and value baked in as a
+   literal: one thread per element (p_KblkG elements per block, setting
+   bern_codegen_block), all node loops unrolled, zero entries dropped.
+
+   The generated file is the macro prologue of WaveKernels.okl (dfloat,
+   qid, storage formats) followed by the three kernels. It is registered
+   with addKernelSource as okl/WaveKernelsBernN<N>.okl and written to the
+   bern_codegen_dir directory if set. This replaces the MATLAB
+   buildsource3d.m headers, whose tables StartUp3d now builds. The table
+   kernels stay the default and the fallback, and time_bern_codegen
+   compares the two. */
+
+// literal in the device float type
+static string lit(double a){
+  char s[48];
+  sprintf(s, "(dfloat) %.17g", a);
+  return string(s);
+}
+
+static string itos(int a){
+  char s[16];
+  sprintf(s, "%d", a);
+  return string(s);
+}
+
+// " + " separated terms, 0 if empty
+static string sum(const vector<string> &terms){
+  if (terms.empty()){
+    return "0.f";
+  }
+  string s = terms[0];
+  for (size_t i = 1; i < terms.size(); ++i){
+    s += " + " + terms[i];
+  }
+  return s;
+}
+
+// opens the thread-per-element loops over k < K (K0 <= k < K if range)
+static void elementLoops(std::ostream &os, int range = 0){
+  os << "  for(int k1=0; k1<(" << (range ? "K-K0" : "K") << "+p_KblkG-1)/p_KblkG; ++k1; outer0){\n"
+     << "    for(int k2=0; k2<p_KblkG; ++k2; inner0){\n"
+     << "      const int k = " << (range ? "K0 + " : "") << "k1*p_KblkG + k2;\n"
+     << "      if (k < K){\n\n";
+}
+
+static void closeLoops(std::ostream &os){
+  os << "      }\n    }\n  }\n}\n\n";
+}
+
+static void volumeKernel(Mesh *mesh, std::ostream &os){
+
+  os << "kernel void rk_volume_bern_gen(const int K,\n"
+     << "\t\t\t       const dfloat * restrict vgeo,\n"
+     << "\t\t\t       const dfloat * restrict Q,\n"
+     << "\t\t\t       drhs * restrict rhsQ){\n\n";
+  elementLoops(os);
+  os << "\tconst dfloat rx = vgeo[0+p_Nvgeo*k], ry = vgeo[1+p_Nvgeo*k], rz = vgeo[2+p_Nvgeo*k];\n"
+     << "\tconst dfloat sx = vgeo[3+p_Nvgeo*k], sy = vgeo[4+p_Nvgeo*k], sz = vgeo[5+p_Nvgeo*k];\n"
+     << "\tconst dfloat tx = vgeo[6+p_Nvgeo*k], ty = vgeo[7+p_Nvgeo*k], tz = vgeo[8+p_Nvgeo*k];\n\n"
+     << "\tdfloat sp[p_Np], sUr[p_Np], sUs[p_Np], sUt[p_Np];\n"
+     << "\tfor(int n=0;n<p_Np;++n){\n"
+     << "\t  const dlong id = qid(k, n);\n"
+     << "\t  sp[n] = Q[id];\n"
+     << "\t  const dfloat un = Q[id +   p_FieldStride];\n"
+     << "\t  const dfloat vn = Q[id + 2*p_FieldStride];\n"
+     << "\t  const dfloat wn = Q[id + 3*p_FieldStride];\n"
+     << "\t  sUr[n] = un*rx + vn*ry + wn*rz;\n"
+     << "\t  sUs[n] = un*sx + vn*sy + wn*sz;\n"
+     << "\t  sUt[n] = un*tx + vn*ty + wn*tz;\n"
+     << "\t}\n\n";
+
+  int **D[4] = {mesh->D1_ids, mesh->D2_ids, mesh->D3_ids, mesh->D4_ids};
+  for (int n = 0; n < p_Np; ++n){
+    vector<string> p[4], dU1, dU2;
+    for (int j = 0; j < 4; ++j){
+      const double v = mesh->D_vals(n,j);
+      if (v==0.0){
+	continue;
+      }
+      for (int d = 0; d < 4; ++d){
+	p[d].push_back(lit(v) + "*sp[" + itos(D[d][n][j]) + "]");
+      }
+      dU1.push_back(lit(v) + "*(sUr[" + itos(D[1][n][j]) + "] + sUs[" + itos(D[2][n][j]) +
+		    "] + sUt[" + itos(D[3][n][j]) + "])");
+      const string i1 = itos(D[0][n][j]);
+      dU2.push_back(lit(v) + "*(sUr[" + i1 + "] + sUs[" + i1 + "] + sUt[" + i1 + "])");
+    }
+    os << "\t{ // node " << n << "\n";
+    for (int d = 0; d < 4; ++d){
+      os << "\t  const dfloat p" << d+1 << " = " << sum(p[d]) << ";\n";
+    }
+    os << "\t  const dfloat dU1 = " << sum(dU1) << ";\n"
+       << "\t  const dfloat dU2 = " << sum(dU2) << ";\n"
+       << "\t  const dfloat dpdr = .5f*(p2-p1), dpds = .5f*(p3-p1), dpdt = .5f*(p4-p1);\n"
+       << "\t  const dfloat divU = .5f*(dU1-dU2);\n"
+       << "\t  const dlong id = qid(k, " << n << ");\n"
+       << "\t  storeRhs(rhsQ, id, -divU);\n"
+       << "\t  storeRhs(rhsQ, id +   p_FieldStride, -(rx*dpdr + sx*dpds + tx*dpdt));\n"
+       << "\t  storeRhs(rhsQ, id + 2*p_FieldStride, -(ry*dpdr + sy*dpds + ty*dpdt));\n"
+       << "\t  storeRhs(rhsQ, id + 3*p_FieldStride, -(rz*dpdr + sz*dpds + tz*dpdt));\n"
+       << "\t}\n";
+  }
+  closeLoops(os);
+}
+
+static void surfaceKernel(Mesh *mesh, std::ostream &os){
+
+  os << "kernel void rk_surface_bern_gen(const int K0,\n"
+     << "\t\t\t\tconst int K,\n"
+     << "\t\t\t\tconst dfloat * restrict fgeo,\n"
+     << "\t\t\t\tconst    int * restrict Fmask,\n"
+     << "\t\t\t\tconst  dlong * restrict vmapP,\n"
+     << "\t\t\t\tconst dfloat * restrict Q,\n"
+     << "\t\t\t\tdrhs * restrict rhsQ){\n\n";
+  elementLoops(os, 1);
+  for (int f = 0; f < p_Nfaces; ++f){
+    os << "\tconst dfloat sJ" << f << " = fgeo[" << f << "*p_Nfgeo + p_Nfgeo*p_Nfaces*k];\n"
+       << "\tconst dfloat nx" << f << " = fgeo[" << f << "*p_Nfgeo + p_Nfgeo*p_Nfaces*k + 1];\n"
+       << "\tconst dfloat ny" << f << " = fgeo[" << f << "*p_Nfgeo + p_Nfgeo*p_Nfaces*k + 2];\n"
+       << "\tconst dfloat nz" << f << " = fgeo[" << f << "*p_Nfgeo + p_Nfgeo*p_Nfaces*k + 3];\n";
+  }
+  os << "\n\t// fluxes\n";
+  for (int n = 0; n < p_Nfp*p_Nfaces; ++n){
+    const string f = itos(n/p_Nfp), ns = itos(n);
+    os << "\tdfloat pf" << ns << ", Uf" << ns << ";\n"
+       << "\t{\n"
+       << "\t  const dlong idM = qid(k, " << mesh->Fmask.data()[n] << "), idP = vmapPid(" << ns << ",k);\n"
+       << "\t  const dfloat pM = Q[idM], pP = Q[idP];\n"
+       << "\t  dfloat pjump = pP-pM;\n"
+       << "\t  dfloat Unjump = (Q[idP+p_FieldStride]-Q[idM+p_FieldStride])*nx" << f << " +\n"
+       << "\t    (Q[idP+2*p_FieldStride]-Q[idM+2*p_FieldStride])*ny" << f << " +\n"
+       << "\t    (Q[idP+3*p_FieldStride]-Q[idM+3*p_FieldStride])*nz" << f << ";\n"
+       << "\t  if (boundaryNode(idM,idP)){\n"
+       << "\t    pjump = -2.f*pM;\n"
+       << "\t    Unjump = 0.f;\n"
+       << "\t  }\n"
+       << "\t  pf" << ns << " = .5f*(pjump - Unjump)*sJ" << f << ";\n"
+       << "\t  Uf" << ns << " = .5f*(Unjump - pjump)*sJ" << f << ";\n"
+       << "\t}\n";
+  }
+
+  // L0 on each face
+  os << "\n\t// L0 on each face\n";
+  const int L0nnz = min((int) mesh->L0_ids.cols(), min(p_Nfp,7));
+  for (int n = 0; n < p_Nfp*p_Nfaces; ++n){
+    const int f = n/p_Nfp, nt = n%p_Nfp;
+    vector<string> pt, Ut;
+    for (int j = 0; j < L0nnz; ++j){
+      const double v = mesh->L0_vals(nt,j);
+      if (v==0.0){
+	continue;
+      }
+      const string id = itos(mesh->L0_ids(nt,j) + f*p_Nfp);
+      pt.push_back(lit(v) + "*pf" + id);
+      Ut.push_back(lit(v) + "*Uf" + id);
+    }
+    os << "\tconst dfloat pt" << n << " = " << sum(pt) << ";\n"
+       << "\tconst dfloat Ut" << n << " = " << sum(Ut) << ";\n";
+  }
+
+  // EEL; the Utmp terms are summed per face before the normals are applied
+  os << "\n\t// EEL\n";
+  const int EELnnz = min((int) mesh->EEL_ids.cols(), mesh->EEL_nnz);
+  for (int n = 0; n < p_Np; ++n){
+    vector<string> pterms, Uterms[p_Nfaces];
+    for (int j = 0; j < EELnnz; ++j){
+      const double v = mesh->EEL_vals(n,j);
+      if (v==0.0){
+	continue;
+      }
+      const int col = mesh->EEL_ids(n,j);
+      pterms.push_back(lit(v) + "*pt" + itos(col));
+      Uterms[col/p_Nfp].push_back(lit(v) + "*Ut" + itos(col));
+    }
+    vector<string> ux, uy, uz;
+    os << "\t{ // node " << n << "\n";
+    for (int f = 0; f < p_Nfaces; ++f){
+      if (Uterms[f].empty()){
+	continue;
+      }
+      const string fs = itos(f);
+      os << "\t  const dacc U" << f << " = " << sum(Uterms[f]) << ";\n";
+      ux.push_back("U" + fs + "*nx" + fs);
+      uy.push_back("U" + fs + "*ny" + fs);
+      uz.push_back("U" + fs + "*nz" + fs);
+    }
+    os << "\t  const dlong id = qid(k, " << n << ");\n"
+       << "\t  storeRhs(rhsQ, id, loadRhs(rhsQ, id) + " << sum(pterms) << ");\n"
+       << "\t  storeRhs(rhsQ, id +   p_FieldStride, loadRhs(rhsQ, id +   p_FieldStride) + " << sum(ux) << ");\n"
+       << "\t  storeRhs(rhsQ, id + 2*p_FieldStride, loadRhs(rhsQ, id + 2*p_FieldStride) + " << sum(uy) << ");\n"
+       << "\t  storeRhs(rhsQ, id + 3*p_FieldStride, loadRhs(rhsQ, id + 3*p_FieldStride) + " << sum(uz) << ");\n"
+       << "\t}\n";
+  }
+  closeLoops(os);
+}
+
+// terms vals[4*i+c]*src[ids[4*i+c]], c < 4; 0 if src has no value there
+static int sparse4(const double *vals, const int *ids, int nvals, int i,
+		   const vector<string> &src, vector<string> &terms){
+  int ok = 1;
+  for (int c = 0; c < 4; ++c){
+    const int jc = 4*i + c;
+    if (jc >= nvals || vals[jc]==0.0){
+      continue;
+    }
+    const int col = ids[jc];
+    if (col < 0 || col >= (int) src.size() || src[col].empty()){
+      ok = 0;
+      continue;
+    }
+    terms.push_back(lit(vals[jc]) + "*" + src[col]);
+  }
+  return ok;
+}
+
+/* rk_update_BB_WADG with its shared arrays s_p, s_q and the per-thread
+   r_q turned into named scalars. sp/sq hold the name of the value each
+   entry of s_p/s_q has at the current step (empty: never written), so
+   reads see exactly what the table kernel reads. Returns 0 if the tables
+   reference a value the table kernel never writes. */
+static int updateKernel(Mesh *mesh, std::ostream &os){
+
+  const int N = p_N;
+  const double *colVal = mesh->col_val.data(), *ENMTval = mesh->ENMT_val.data();
+  const double *ENMval = mesh->ENM_val.data(), *E = mesh->E.data(), *co = mesh->co.data();
+  const int *colId = mesh->col_id.data(), *Lid = mesh->L_id.data();
+  const int *ENMTid = mesh->ENMT_id.data(), *ENMid = mesh->ENM_id.data();
+  const int *ENMTindex = mesh->ENMT_index.data();
+  if (mesh->col_val.size() < 4*p_NMp || mesh->col_id.size() < 4*p_NMp ||
+      mesh->L_id.size() < 4*p_NMp || mesh->E.size() < 4*10 ||
+      mesh->co.size() < N-1 || mesh->ENMT_index.size() < N){
+    return 0;
+  }
+
+  vector<string> sp(p_NMp), sq(p_NMp);
+  vector<vector<string> > rq(N, vector<string>(p_NMp));
+  std::ostringstream body;
+  int ok = 1;
+
+  for (int i = 0; i < p_Np; ++i){
+    sp[i] = "p[" + itos(i) + "]";
+  }
+
+  // BB multiplication by the wave speed
+  body << "\t// BB multiplication\n";
+  for (int i = 0; i < p_NMp; ++i){
+    vector<string> terms;
+    for (int c = 0; c < 4; ++c){
+      const int jc = 4*i + c;
+      if (colVal[jc]==0.0){
+	continue;
+      }
+      if (colId[jc] < 0 || colId[jc] >= p_NMp || sp[colId[jc]].empty() || Lid[jc] < 0 || Lid[jc] > 3){
+	ok = 0;
+	continue;
+      }
+      terms.push_back("CB" + itos(Lid[jc]) + "*" + lit(colVal[jc]) + "*" + sp[colId[jc]]);
+    }
+    sq[i] = "a" + itos(i);
+    body << "\tconst dfloat " << sq[i] << " = " << sum(terms) << ";\n";
+  }
+
+  // projection down to degree 1, saving scaled copies in r_q
+  for (int h = 0; h < N-1; ++h){
+    const int hp = (N-h+1)*(N-h+2)*(N-h+3)/6;
+    const int hid = ENMTindex[h]/4;
+    body << "\t// projection, level " << h << "\n";
+    for (int i = 0; i < hp; ++i){
+      vector<string> terms;
+      ok &= sparse4(ENMTval, ENMTid, mesh->ENMT_val.size(), i + hid, sq, terms);
+      sp[i] = "b" + itos(h) + "_" + itos(i);
+      rq[h][i] = "r" + itos(h) + "_" + itos(i);
+      body << "\tconst dfloat " << sp[i] << " = " << sum(terms) << ";\n"
+	   << "\tdacc " << rq[h][i] << " = (dacc) " << sp[i] << "*" << lit(co[h]) << ";\n";
+    }
+    for (int i = 0; i < hp; ++i){
+      sq[i] = sp[i];
+    }
+  }
+
+  // E21^T, then E
+  const int hid = ENMTindex[N-1]/4;
+  body << "\t// degree 1\n";
+  for (int i = 0; i < 4; ++i){
+    vector<string> terms;
+    ok &= sparse4(ENMTval, ENMTid, mesh->ENMT_val.size(), i + hid, sq, terms);
+    sp[i] = "c" + itos(i);
+    body << "\tconst dfloat " << sp[i] << " = " << sum(terms) << ";\n";
+  }
+  for (int i = 0; i < 10; ++i){
+    vector<string> terms;
+    for (int c = 0; c < 4; ++c){
+      if (E[4*i+c]!=0.0){
+	terms.push_back(lit(E[4*i+c]) + "*" + sp[c]);
+      }
+    }
+    if (rq[N-2][i].empty()){
+      ok = 0;
+      continue;
+    }
+    sq[i] = "d" + itos(i);
+    body << "\tconst dfloat " << sq[i] << " = " << rq[N-2][i] << " + (dacc) (" << sum(terms) << ");\n";
+  }
+
+  // elevation back up, adding the saved r_q
+  for (int r = 1; r < N-1; ++r){
+    const int rp = (r+3)*(r+4)*(r+5)/6;
+    const int rid = ENMTindex[N-2-r]/4;
+    const int h = N-2-r;
+    body << "\t// elevation, level " << h << "\n";
+    for (int i = 0; i < rp; ++i){
+      vector<string> terms;
+      ok &= sparse4(ENMval, ENMid, mesh->ENM_val.size(), i + rid, sq, terms);
+      if (rq[h][i].empty()){
+	ok = 0;
+	continue;
+      }
+      body << "\t" << rq[h][i] << " += " << sum(terms) << ";\n";
+    }
+    for (int i = 0; i < rp; ++i){
+      sq[i] = "e" + itos(h) + "_" + itos(i);
+      body << "\tconst dfloat " << sq[i] << " = " << rq[h][i] << ";\n";
+    }
+  }
+
+  for (int i = 0; i < p_Np; ++i){
+    if (sq[i].empty()){
+      ok = 0;
+    }
+  }
+  if (!ok){
+    return 0;
+  }
+
+  os << "kernel void rk_update_BB_WADG_gen(const int K,\n"
+     << "\t\t\t\t  const dfloat * restrict CB,\n"
+     << "\t\t\t\t  const dfloat fa,\n"
+     << "\t\t\t\t  const dfloat fb,\n"
+     << "\t\t\t\t  const dfloat fdt,\n"
+     << "\t\t\t\t  drhs * restrict rhsQ,\n"
+     << "\t\t\t\t  dres * restrict resQ,\n"
+     << "\t\t\t\t  dfloat * restrict Q){\n\n";
+  elementLoops(os);
+  os << "\tconst dfloat CB0 = CB[4*k], CB1 = CB[4*k+1], CB2 = CB[4*k+2], CB3 = CB[4*k+3];\n"
+     << "\tdfloat p[p_Np];\n"
+     << "\tfor(int n=0;n<p_Np;++n){\n"
+     << "\t  p[n] = loadRhs(rhsQ, qid(k, n));\n"
+     << "\t}\n\n"
+     << body.str() << "\n";
+  for (int i = 0; i < p_Np; ++i){
+    os << "\t{\n"
+       << "\t  const dlong id = qid(k, " << i << ");\n"
+       << "\t  const dacc res = fa*loadRes(resQ, id) + fdt*" << sq[i] << ";\n"
+       << "\t  storeRes(resQ, id, res);\n"
+       << "\t  Q[id] += fb*res;\n"
+       << "\t}\n";
+  }
+  os << "\n\t// velocities\n"
+     << "\tfor(int n=0;n<p_Np;++n){\n"
+     << "\t  dlong id = qid(k, n);\n"
+     << "\t  for(int fld=1;fld<p_Nfields;++fld){\n"
+     << "\t    id += p_FieldStride;\n"
+     << "\t    const dacc res = fa*loadRes(resQ, id) + fdt*loadRhs(rhsQ, id);\n"
+     << "\t    storeRes(resQ, id, res);\n"
+     << "\t    Q[id] += fb*res;\n"
+     << "\t  }\n"
+     << "\t}\n";
+  closeLoops(os);
+  return 1;
+}
+
+/* generates the unrolled Bernstein kernels for the current N and registers
+   them as a kernel source; returns its name. hasUpdate is set if
+   rk_update_BB_WADG_gen was generated (N >= 2). */
+string BernKernelGen(Mesh *mesh, int &hasUpdate){
+
+  string base;
+  if (!readKernelSource("okl/WaveKernels.okl", base)){
+    printf("BBDG ERROR: bern_codegen needs okl/WaveKernels.okl\n");
+    exit(1);
+  }
+  // keep the macros, drop the table kernels
+  size_t end = base.find("//  =============== RK first order DG kernels");
+  if (end!=string::npos){
+    base = base.substr(0, end);
+  }
+
+  std::ostringstream os;
+  os << "// generated by BernKernelGen (src/KernelGen.cpp) for N = " << p_N << "\n"
+     << base << "\n"
+     << "#define p_KblkG " << max(GetIntSetting("bern_codegen_block", 32), 1) << " // elements per block\n\n";
+  volumeKernel(mesh, os);
+  surfaceKernel(mesh, os);
+  hasUpdate = p_N >= 2 && updateKernel(mesh, os);
+
+  const string source = os.str();
+  char name[64];
+  sprintf(name, "okl/WaveKernelsBernN%d.okl", p_N);
+  addKernelSource(name, source);
+  printf("bern_codegen: generated %s (%d lines)%s\n", name,
+	 (int) std::count(source.begin(), source.end(), '\n'),
+	 hasUpdate ? "" : ", table update kernel");
+
+  string dir = GetSetting("bern_codegen_dir", "");
+  if (!dir.empty()){
+    makeDirectory(dir);
+    string path = dir + "/" + string(name).substr(4);
+    std::ofstream out(path.c_str());
+    out << source;
+    printf("bern_codegen: wrote %s\n", path.c_str());
+  }
+  return name;
+}
@@ -10,132 +10,20 @@ Mesh *ReadGmsh3d(char *filename){
   
   Mesh *mesh = (Mesh*) calloc(1, sizeof(Mesh));
 
-  std::ifstream meshfile(filename);
-  if(!meshfile.is_open()){
-    std::cout << "BBDG ERROR: Mesh '" << filename << "' not opened" << std::endl;
-    exit(1);
-  }
-
-  int dummy, allVertices, allElements;
-
-  while(meshfile.good()){
-
-    std::string line;
-    getline(meshfile, line);
-
-    /// scan vertices in gmsh file
-    if(line.find("$Nodes") != std::string::npos){
-
-      /// read number of vertices
-      meshfile >> allVertices;
-      mesh->Nv = allVertices;
-
-      /// resize vectors for the coordinates of vertices
-      VX = (double*) calloc(mesh->Nv,sizeof(double));
-      VY = (double*) calloc(mesh->Nv,sizeof(double));
-      VZ = (double*) calloc(mesh->Nv,sizeof(double));
-
-      /// scan line of each vertex, ignoring gmsh index of vertex
-      for (int v = 0; v < allVertices; ++v){
-        meshfile >> dummy >> VX[v] >> VY[v] >> VZ[v];
-	//printf("VXYZ = [%.4f, %.4f, %.4f]\n",VX[v],VY[v],VZ[v]);
-      }
-    }
-
-    /// scan elements in gmsh file
-    if(line.find("$Elements") != std::string::npos){
-
-      /// read number of elements
-      meshfile >> allElements;
-      getline(meshfile, line);
-
-      /// record location in file
-      int marker = meshfile.tellg();
-      int eGmshNum, eGeoType, Tags;
-      VectorXi EToGmshE(allElements);
-
-      /// count number of triangular/tetrahedral elements
-      int KTri = 0;
-      int KTetra = 0;
-      int extra=0;
-      for (int k = 1;k <= allElements; ++k) {
-        meshfile >> eGmshNum >> eGeoType;
-        if(eGeoType == 2){  /// for triangular element
-          KTri++;
-	} else if(eGeoType == 4){  /// for tetrahedral element
-	  EToGmshE(KTetra) = eGmshNum;
-          KTetra++;
-	}else{
-          extra++;
-	}
-        getline(meshfile, line);
-
-      }
-      std::cout << extra << " unknown element types read in gmsh file" << std::endl;
-      
-      /// rewind to beginning of element list
-      meshfile.seekg(marker);
-
-      /// shape EToV to hold Elements triples
-      mesh->Nverts = 4; /* assume tets */
-      mesh->Nedges = 6; /* assume tets */
-      mesh->Nfaces = 4; /* assume tets */
-
-      mesh->K = KTetra;
-
-      mesh->EToV = BuildIntMatrix(KTetra, mesh->Nverts);
-      mesh->EToGmshE = EToGmshE;
-      //mesh->GX = BuildMatrix(mesh->K, mesh->Nverts);
-      //mesh->GY = BuildMatrix(mesh->K, mesh->Nverts);
-      //mesh->GZ = BuildMatrix(mesh->K, mesh->Nverts);
-      mesh->GX.resize(mesh->K, mesh->Nverts);
-      mesh->GY.resize(mesh->K, mesh->Nverts);
-      mesh->GZ.resize(mesh->K, mesh->Nverts);
-
-      int *ETag = BuildIntVector(KTetra);
-      int *ENumGmsh = BuildIntVector(KTetra);
-      for (int k = 0; k < KTetra; ++k) {
-        ETag[k]=0;
-        ENumGmsh[k] = 0;
-      }
-
-      /// save info on triangular/tetrahedral elements
-      int kTetra = 0;
-      for (int k = 0; k < allElements; ++k) {
-        meshfile >> eGmshNum >> eGeoType >> dummy;
-        if (eGeoType==4){
-          ENumGmsh[kTetra] = eGmshNum;           /// save the gmsh number
-          meshfile >> ETag[kTetra] >> dummy;     /// save the element group (physical gmsh label)
-          for(int v=0; v<mesh->Nverts; ++v)
-            meshfile >> mesh->EToV[kTetra][v];         /// save the associated vertices
-          kTetra++;
-        }
-        getline(meshfile, line);
-      }
-
-      int sk = 0, v;
-      for (int k = 0; k < mesh->K; ++k){
-
-        /* correct to 0-index */
-        --(mesh->EToV[k][0]);
-        --(mesh->EToV[k][1]);
-        --(mesh->EToV[k][2]);
-        --(mesh->EToV[k][3]);
-
-        for(v=0;v<mesh->Nverts;++v){
-          mesh->GX(k,v) = VX[mesh->EToV[k][v]];
-          mesh->GY(k,v) = VY[mesh->EToV[k][v]];
-	  mesh->GZ(k,v) = VZ[mesh->EToV[k][v]];
-        }
-	
-      }
-
-      std::cout << "BBDG: " << allVertices << " vertices and " << allElements << " elements in GMSH file " << std::endl;
-      std::cout << "      (" << KTri << " triangles and " << KTetra << " tetrahedron)" << std::endl;
-      std::cout << "mesh->K = " << mesh->K << std::endl;
-
+  // vertices, tets (EToV, EToGmshE, ETag); see GmshReader.cpp
+  ReadGmshFile(filename, mesh, &VX, &VY, &VZ);
+
+  mesh->GX.resize(mesh->K, mesh->Nverts);
+  mesh->GY.resize(mesh->K, mesh->Nverts);
+  mesh->GZ.resize(mesh->K, mesh->Nverts);
+  for (int k = 0; k < mesh->K; ++k){
+    for(int v=0;v<mesh->Nverts;++v){
+      mesh->GX(k,v) = VX[mesh->EToV[k][v]];
+      mesh->GY(k,v) = VY[mesh->EToV[k][v]];
+      mesh->GZ(k,v) = VZ[mesh->EToV[k][v]];
     }
   }
+  std::cout << "mesh->K = " << mesh->K << std::endl;
 
 #if 1
   /// correct orientation of negative elements by permuting their vertices
@@ -286,125 +174,133 @@ void Normals3d(Mesh *mesh, int k,
   }
 }
 
-typedef struct {
-  int k1, f1;
-  int va, vb, vc;
-}face3d;
-
-int compare_pairs3d(const void *obj1, const void *obj2){
-
-  face3d *e1 = (face3d*) obj1;
-  face3d *e2 = (face3d*) obj2;
-
-  int a1 = e1->va, b1 = e1->vb, c1 = e1->vc;
-  int a2 = e2->va, b2 = e2->vb, c2 = e2->vc;
-
-  int va1, vb1, vc1, va2, vb2, vc2;
-
-  va1 = min(a1, min(b1, c1));
-  vc1 = max(a1, max(b1, c1));
-
-  if(va1!=a1 && vc1!=a1) vb1=a1;
-  if(va1!=b1 && vc1!=b1) vb1=b1;
-  if(va1!=c1 && vc1!=c1) vb1=c1;
-
-  va2 = min(a2, min(b2, c2));
-  vc2 = max(a2, max(b2, c2));
-
-  if(va2!=a2 && vc2!=a2) vb2=a2;
-  if(va2!=b2 && vc2!=b2) vb2=b2;
-  if(va2!=c2 && vc2!=c2) vb2=c2;
-
-  if(vc1<vc2)
-    return -1;
-  else if(vc1>vc2)
-    return 1;
-  else if(vb1<vb2)
-    return -1;
-  else if(vb1>vb2)
-    return 1;
-  else if(va1<va2)
-    return -1;
-  else if(va1>va2)
-    return 1;
-
-  return 0;
-
-}
+/* Faces are matched by their sorted vertex triple (va < vb < vc): a
+   counting sort on the smallest vertex va puts every face in the bucket of
+   its va, then each (small) bucket is sorted by the packed (vb, vc) key
+   and face id. Matching faces are adjacent after this. Both passes run
+   in parallel and the result does not depend on the thread count.
 
+   BuildFaceLists then lists the unique faces (owned by the lower numbered
+   element, boundary faces by their element) and the boundary faces, as
+   k*Nfaces + f in increasing order. */
 void FacePair3d(Mesh *mesh){
 
   int K = mesh->K;
   int Nfaces = mesh->Nfaces;
-  int Nverts = mesh->Nverts;
+  int Nv = mesh->Nv;
+  int NfacesK = K*Nfaces;
 
   int **EToV = mesh->EToV;
 
   const int vnum[4][3] = { {0,1,2}, {0,1,3}, {1,2,3}, {0,2,3} };
 
-  int n, k, e, sk, v;
-
   // tag faces by their sorted vertices
-  face3d *myfaces = (face3d*) calloc(K*Nfaces, sizeof(face3d));
+  int *faceVa = (int*) malloc(NfacesK*sizeof(int));
+  unsigned long long *faceKey = (unsigned long long*) malloc(NfacesK*sizeof(unsigned long long));
+  int *bucketStart = (int*) calloc(Nv+1, sizeof(int));
 
-  sk = 0;
-  for(k=0;k<K;++k){
-    for(e=0;e<Nfaces;++e){
+#pragma omp parallel for
+  for(int k=0;k<K;++k){
+    for(int e=0;e<Nfaces;++e){
       int a1 = EToV[k][vnum[e][0]];
       int b1 = EToV[k][vnum[e][1]];
       int c1 = EToV[k][vnum[e][2]];
 
-      myfaces[sk].k1 = k; myfaces[sk].f1 = e;
+      int va1 = min(a1, min(b1, c1));
+      int vc1 = max(a1, max(b1, c1));
+      int vb1 = a1 + b1 + c1 - va1 - vc1;
 
-      int va1, vb1, vc1, va2, vb2, vc2;
-
-      va1 = min(a1, min(b1, c1));
-      vc1 = max(a1, max(b1, c1));
-
-      if(va1!=a1 && vc1!=a1) vb1=a1;
-      if(va1!=b1 && vc1!=b1) vb1=b1;
-      if(va1!=c1 && vc1!=c1) vb1=c1;
-
-      myfaces[sk].va = va1;
-      myfaces[sk].vb = vb1;
-      myfaces[sk].vc = vc1;
-      ++sk;
+      faceVa[k*Nfaces + e] = va1;
+      faceKey[k*Nfaces + e] = ((unsigned long long) vb1 << 32) | (unsigned int) vc1;
+#pragma omp atomic
+      ++bucketStart[va1+1];
     }
   }
+  for(int v=0;v<Nv;++v){
+    bucketStart[v+1] += bucketStart[v];
+  }
 
-  qsort(myfaces, K*Nfaces, sizeof(face3d), compare_pairs3d);
+  // scatter face ids into buckets
+  int *bucketFill = (int*) malloc(Nv*sizeof(int));
+  memcpy(bucketFill, bucketStart, Nv*sizeof(int));
+  int *sorted = (int*) malloc(NfacesK*sizeof(int));
+#pragma omp parallel for
+  for(int id=0;id<NfacesK;++id){
+    int pos;
+#pragma omp atomic capture
+    pos = bucketFill[faceVa[id]]++;
+    sorted[pos] = id;
+  }
 
   mesh->EToE = BuildIntMatrix(K, Nfaces);
   mesh->EToF = BuildIntMatrix(K, Nfaces);
 
-  int id, k1, k2, f1, f2, p1, p2;
-  sk = 0;
-
-  for(n=0; n < K*Nfaces-1; ++n){
-
-    int e1  = myfaces[n].k1;   int e2  = myfaces[n+1].k1;
-    int f1  = myfaces[n].f1;   int f2  = myfaces[n+1].f1;
-    int va1 = myfaces[n].va;   int va2 = myfaces[n+1].va;
-    int vb1 = myfaces[n].vb;   int vb2 = myfaces[n+1].vb;
-    int vc1 = myfaces[n].vc;   int vc2 = myfaces[n+1].vc;
+  // sort each bucket by (key, face id), then pair up equal keys
+#pragma omp parallel for schedule(dynamic,256)
+  for(int v=0;v<Nv;++v){
+    int *ids = sorted + bucketStart[v];
+    int Nb = bucketStart[v+1] - bucketStart[v];
+    for(int i=1;i<Nb;++i){
+      int id = ids[i];
+      int j = i;
+      while (j > 0 && (faceKey[ids[j-1]] > faceKey[id] ||
+		       (faceKey[ids[j-1]]==faceKey[id] && ids[j-1] > id))){
+	ids[j] = ids[j-1];
+	--j;
+      }
+      ids[j] = id;
+    }
 
-    // if faces match
-    if (va1==va2 && vb1==vb2 && vb1==vb2){
+    for(int n=0;n<Nb;++n){
+      int e1 = ids[n]/Nfaces, f1 = ids[n]%Nfaces;
+
+      // if faces match
+      if (n+1 < Nb && faceKey[ids[n]]==faceKey[ids[n+1]]){
+	int e2 = ids[n+1]/Nfaces, f2 = ids[n+1]%Nfaces;
+	mesh->EToE[e1][f1] = e2;
+	mesh->EToF[e1][f1] = f2;
+	mesh->EToE[e2][f2] = e1;
+	mesh->EToF[e2][f2] = f1;
+	++n; // skip to next face
+      }else{ // otherwise, set as boundary face
+	mesh->EToE[e1][f1] = e1;
+	mesh->EToF[e1][f1] = f1;
+      }
+    }
+  }
 
-      mesh->EToE[e1][f1] = e2;
-      mesh->EToF[e1][f1] = f2;
-      mesh->EToE[e2][f2] = e1;
-      mesh->EToF[e2][f2] = f1;
-      ++n; // skip to next face
+  BuildFaceLists(mesh);
 
-    }else{ // otherwise, set as boundary face
+  free(faceVa);
+  free(faceKey);
+  free(bucketStart);
+  free(bucketFill);
+  free(sorted);
+}
 
-      mesh->EToE[e1][f1] = e1;
-      mesh->EToF[e1][f1] = f1;
+// unique and boundary face lists from EToE (rebuilt by ReorderElements)
+void BuildFaceLists(Mesh *mesh){
 
+  int Nfaces = mesh->Nfaces;
+  int NfacesK = mesh->K*Nfaces;
+
+  mesh->NfacesUnique = 0;
+  mesh->NfacesBoundary = 0;
+  for(int id=0;id<NfacesK;++id){
+    int k = id/Nfaces, kP = mesh->EToE[k][id%Nfaces];
+    mesh->NfacesUnique += (kP >= k);
+    mesh->NfacesBoundary += (kP == k);
+  }
+  mesh->faceOwners = (int*) malloc(mesh->NfacesUnique*sizeof(int));
+  mesh->boundaryFaces = (int*) malloc(mesh->NfacesBoundary*sizeof(int));
+  int Nu = 0, Nb = 0;
+  for(int id=0;id<NfacesK;++id){
+    int k = id/Nfaces, kP = mesh->EToE[k][id%Nfaces];
+    if (kP >= k){
+      mesh->faceOwners[Nu++] = id;
+    }
+    if (kP == k){
+      mesh->boundaryFaces[Nb++] = id;
     }
   }
-
-
-  free(myfaces);
 }
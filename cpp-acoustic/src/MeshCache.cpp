@@ -0,0 +1,326 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include "fem.h"
+
+/* Preprocessed mesh cache.
+
+   With mesh_cache = <directory>, the results of mesh setup (vertices,
+   EToV/EToE/EToF, face lists, node maps, packed geofacs, hMax, Cq and
+   Bernstein material coefficients) are written to
+   <directory>/<hash>.bbmesh the first time a mesh is run at a given N and
+   precision. Later runs map the file and skip ReadGmsh3d, FacePair3d,
+   BuildMaps3d and the packed and cubature geofac loops.
+   The hash covers the mesh path, size and modification time, N, dfloat,
+   dlong, the cache version, element_order, split_boundary and the
+   executable (so rebuilding with another material function invalidates
+   old entries).
+
+   File layout: header, section table, then each section's data starting
+   at a multiple of MESH_CACHE_ALIGN bytes, so sections can be used in
+   place from the mapping. Plain arrays (vertices, connectivity, face
+   lists, node maps, geofacs) point into the mapping on a hit, which stays
+   mapped copy-on-write for the rest of the run; Eigen members are copied. */
+
+#define MESH_CACHE_VERSION 3
+#define MESH_CACHE_ALIGN 64
+
+typedef struct {
+  char magic[8];     // "BBWADGMC"
+  int version;
+  int N;
+  int dfloatSize;
+  int K;
+  int Nv;
+  int Nsections;
+} meshCacheHeader;
+
+typedef struct {
+  char name[24];
+  unsigned long long offset; // from start of file
+  unsigned long long bytes;
+} meshCacheSection;
+
+extern double *VX, *VY, *VZ; // vertex coordinates (Mesh3d.cpp)
+
+static string cacheFile;        // empty if caching is off
+static const char *cacheMap = NULL;
+static size_t cacheBytes = 0;
+static vector<pair<string,string> > pendingSections; // written by MeshCacheClose on a miss
+
+static string meshCacheName(const char *meshFile){
+
+  string dir = GetSetting("mesh_cache", "none");
+  if (dir=="none"){
+    return "";
+  }
+
+  struct stat st;
+  char path[PATH_MAX];
+  if (stat(meshFile, &st) || !realpath(meshFile, path)){
+    return "";
+  }
+  std::stringstream key;
+  key << path << " " << st.st_size << " " << st.st_mtime << " " << p_N << " "
+      << sizeof(dfloat) << " " << sizeof(dlong) << " " << MESH_CACHE_VERSION << " "
+      << GetSetting("element_order", "none") << " " << GetIntSetting("split_boundary", 0);
+  if (!stat("/proc/self/exe", &st)){
+    key << " " << st.st_size << " " << st.st_mtime;
+  }
+
+  char hashStr[32];
+  sprintf(hashStr, "%016llx", hashString(key.str(), 14695981039346656037ULL));
+  return dir + "/" + hashStr + ".bbmesh";
+}
+
+static const meshCacheSection *findCacheSection(const char *name){
+  if (!cacheMap){
+    return NULL;
+  }
+  const meshCacheHeader *h = (const meshCacheHeader*) cacheMap;
+  const meshCacheSection *sec = (const meshCacheSection*) (cacheMap + sizeof(meshCacheHeader));
+  for (int i = 0; i < h->Nsections; ++i){
+    if (!strncmp(sec[i].name, name, sizeof(sec[i].name))){
+      return sec + i;
+    }
+  }
+  return NULL;
+}
+
+// map the cache file for this mesh; returns 1 if it exists and is valid
+static int openMeshCache(const char *meshFile){
+
+  cacheFile = meshCacheName(meshFile);
+  if (cacheFile.empty()){
+    return 0;
+  }
+
+  int fd = open(cacheFile.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd >= 0 && !fstat(fd, &st) && (size_t) st.st_size >= sizeof(meshCacheHeader)){
+    cacheBytes = st.st_size;
+    void *map = mmap(NULL, cacheBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    cacheMap = (map==MAP_FAILED) ? NULL : (const char*) map;
+  }
+  if (fd >= 0){
+    close(fd);
+  }
+
+  if (cacheMap){
+    const meshCacheHeader *h = (const meshCacheHeader*) cacheMap;
+    int valid = !strncmp(h->magic, "BBWADGMC", 8) && h->version==MESH_CACHE_VERSION &&
+      h->N==p_N && h->dfloatSize==(int) sizeof(dfloat) &&
+      sizeof(meshCacheHeader) + h->Nsections*sizeof(meshCacheSection) <= cacheBytes;
+    const meshCacheSection *sec = (const meshCacheSection*) (cacheMap + sizeof(meshCacheHeader));
+    for (int i = 0; valid && i < h->Nsections; ++i){
+      valid = sec[i].offset + sec[i].bytes <= cacheBytes;
+    }
+    if (valid){
+      printf("mesh cache hit: %s\n", cacheFile.c_str());
+      return 1;
+    }
+    munmap((void*) cacheMap, cacheBytes);
+    cacheMap = NULL;
+  }
+  printf("mesh cache miss: %s\n", cacheFile.c_str());
+  return 0;
+}
+
+// copy a cached section of exactly the given size; returns 0 if it is not cached
+int MeshCacheGet(const char *name, void *data, size_t bytes){
+  const void *sec = MeshCacheMap(name, bytes);
+  if (!sec){
+    return 0;
+  }
+  memcpy(data, sec, bytes);
+  return 1;
+}
+
+// a cached section of exactly the given size, in place; NULL if it is not cached
+void *MeshCacheMap(const char *name, size_t bytes){
+  const meshCacheSection *sec = findCacheSection(name);
+  if (!sec || sec->bytes!=bytes){
+    return NULL;
+  }
+  return (void*) (cacheMap + sec->offset);
+}
+
+// K x Ncols int matrix (as BuildIntMatrix) whose rows point into a cached section
+static int **mapIntMatrix(const char *name, int K, int Ncols){
+  int *data = (int*) MeshCacheMap(name, (size_t) K*Ncols*sizeof(int));
+  if (!data){
+    return NULL;
+  }
+  int **A = (int**) calloc(K, sizeof(int*));
+  for (int k = 0; k < K; ++k){
+    A[k] = data + (size_t) k*Ncols;
+  }
+  return A;
+}
+
+// queue a section for writing (only when the cache is on and missed)
+void MeshCacheAdd(const char *name, const void *data, size_t bytes){
+  if (cacheFile.empty() || cacheMap){
+    return;
+  }
+  pendingSections.push_back(make_pair(string(name), string((const char*) data, bytes)));
+}
+
+// matrices are stored as rows, cols (int) followed by the column-major data
+int MeshCacheGetMatrix(const char *name, MatrixXd &A){
+  const meshCacheSection *sec = findCacheSection(name);
+  if (!sec || sec->bytes < 2*sizeof(int)){
+    return 0;
+  }
+  int dims[2];
+  memcpy(dims, cacheMap + sec->offset, sizeof(dims));
+  if (sec->bytes != sizeof(dims) + (size_t) dims[0]*dims[1]*sizeof(double)){
+    return 0;
+  }
+  A.resize(dims[0], dims[1]);
+  memcpy(A.data(), cacheMap + sec->offset + sizeof(dims), A.size()*sizeof(double));
+  return 1;
+}
+
+void MeshCacheAddMatrix(const char *name, const MatrixXd &A){
+  int dims[2] = {(int) A.rows(), (int) A.cols()};
+  string data((const char*) dims, sizeof(dims));
+  data.append((const char*) A.data(), A.size()*sizeof(double));
+  MeshCacheAdd(name, data.data(), data.size());
+}
+
+/* ReadGmsh3d followed by FacePair3d and ReorderElements, or the same data
+   from the mesh cache */
+Mesh *ReadMeshCached(char *filename){
+
+  if (!openMeshCache(filename)){
+    Mesh *mesh = ReadGmsh3d(filename);
+    FacePair3d(mesh);
+    ReorderElements(mesh);
+
+    int K = mesh->K;
+    MeshCacheAdd("VX", VX, mesh->Nv*sizeof(double));
+    MeshCacheAdd("VY", VY, mesh->Nv*sizeof(double));
+    MeshCacheAdd("VZ", VZ, mesh->Nv*sizeof(double));
+    MeshCacheAdd("EToV", mesh->EToV[0], K*4*sizeof(int));
+    MeshCacheAdd("EToE", mesh->EToE[0], K*4*sizeof(int));
+    MeshCacheAdd("EToF", mesh->EToF[0], K*4*sizeof(int));
+    MeshCacheAdd("EToGmshE", mesh->EToGmshE.data(), K*sizeof(int));
+    MeshCacheAdd("ETag", mesh->ETag.data(), K*sizeof(int));
+    MeshCacheAdd("faceOwners", mesh->faceOwners, mesh->NfacesUnique*sizeof(int));
+    MeshCacheAdd("boundaryFaces", mesh->boundaryFaces, mesh->NfacesBoundary*sizeof(int));
+    return mesh;
+  }
+
+  const meshCacheHeader *h = (const meshCacheHeader*) cacheMap;
+  Mesh *mesh = (Mesh*) calloc(1, sizeof(Mesh));
+  mesh->Nverts = 4; /* assume tets */
+  mesh->Nedges = 6; /* assume tets */
+  mesh->Nfaces = 4; /* assume tets */
+  mesh->K = h->K;
+  mesh->Nv = h->Nv;
+  int K = mesh->K;
+
+  mesh->EToGmshE.resize(K);
+  mesh->ETag.resize(K);
+
+  const meshCacheSection *owners = findCacheSection("faceOwners");
+  const meshCacheSection *bfaces = findCacheSection("boundaryFaces");
+  mesh->NfacesUnique = owners ? owners->bytes/sizeof(int) : 0;
+  mesh->NfacesBoundary = bfaces ? bfaces->bytes/sizeof(int) : 0;
+
+  // used in place from the mapping
+  VX = (double*) MeshCacheMap("VX", mesh->Nv*sizeof(double));
+  VY = (double*) MeshCacheMap("VY", mesh->Nv*sizeof(double));
+  VZ = (double*) MeshCacheMap("VZ", mesh->Nv*sizeof(double));
+  mesh->EToV = mapIntMatrix("EToV", K, 4);
+  mesh->EToE = mapIntMatrix("EToE", K, 4);
+  mesh->EToF = mapIntMatrix("EToF", K, 4);
+  mesh->faceOwners = (int*) MeshCacheMap("faceOwners", mesh->NfacesUnique*sizeof(int));
+  mesh->boundaryFaces = (int*) MeshCacheMap("boundaryFaces", mesh->NfacesBoundary*sizeof(int));
+
+  int ok = owners && bfaces && VX && VY && VZ &&
+    mesh->EToV && mesh->EToE && mesh->EToF &&
+    MeshCacheGet("EToGmshE", mesh->EToGmshE.data(), K*sizeof(int)) &&
+    MeshCacheGet("ETag", mesh->ETag.data(), K*sizeof(int));
+  if (!ok){
+    printf("BBDG ERROR: mesh cache %s is incomplete, remove it and rerun\n", cacheFile.c_str());
+    exit(1);
+  }
+
+  mesh->GX.resize(K, mesh->Nverts);
+  mesh->GY.resize(K, mesh->Nverts);
+  mesh->GZ.resize(K, mesh->Nverts);
+  for (int k = 0; k < K; ++k){
+    for (int v = 0; v < mesh->Nverts; ++v){
+      mesh->GX(k,v) = VX[mesh->EToV[k][v]];
+      mesh->GY(k,v) = VY[mesh->EToV[k][v]];
+      mesh->GZ(k,v) = VZ[mesh->EToV[k][v]];
+    }
+  }
+  printf("mesh cache: %d vertices and %d tetrahedra\n", mesh->Nv, K);
+  return mesh;
+}
+
+/* call once setup is done: writes the queued sections after a miss. After
+   a hit the mapping is kept, since mesh arrays point into it */
+void MeshCacheClose(Mesh *mesh){
+
+  if (cacheMap){
+    return;
+  }
+  if (cacheFile.empty() || pendingSections.empty()){
+    return;
+  }
+
+  meshCacheHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, "BBWADGMC", 8);
+  h.version = MESH_CACHE_VERSION;
+  h.N = p_N;
+  h.dfloatSize = sizeof(dfloat);
+  h.K = mesh->K;
+  h.Nv = mesh->Nv;
+  h.Nsections = pendingSections.size();
+
+  vector<meshCacheSection> table(h.Nsections);
+  unsigned long long offset = sizeof(h) + h.Nsections*sizeof(meshCacheSection);
+  for (int i = 0; i < h.Nsections; ++i){
+    memset(table[i].name, 0, sizeof(table[i].name));
+    strncpy(table[i].name, pendingSections[i].first.c_str(), sizeof(table[i].name)-1);
+    offset = (offset + MESH_CACHE_ALIGN - 1)/MESH_CACHE_ALIGN*MESH_CACHE_ALIGN;
+    table[i].offset = offset;
+    table[i].bytes = pendingSections[i].second.size();
+    offset += table[i].bytes;
+  }
+
+  size_t slash = cacheFile.find_last_of('/');
+  if (slash!=string::npos){
+    makeDirectory(cacheFile.substr(0, slash));
+  }
+
+  // write to a temporary file first so concurrent runs never see a partial cache
+  char pid[32];
+  sprintf(pid, ".tmp%d", (int) getpid());
+  string tmp = cacheFile + pid;
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if (!fp){
+    printf("could not write mesh cache %s\n", cacheFile.c_str());
+    return;
+  }
+  fwrite(&h, sizeof(h), 1, fp);
+  fwrite(&table[0], sizeof(meshCacheSection), h.Nsections, fp);
+  for (int i = 0; i < h.Nsections; ++i){
+    fseek(fp, table[i].offset, SEEK_SET);
+    fwrite(pendingSections[i].second.data(), 1, table[i].bytes, fp);
+  }
+  fclose(fp);
+  rename(tmp.c_str(), cacheFile.c_str());
+
+  printf("mesh cache: wrote %d sections (%.1f MB) to %s\n",
+	 h.Nsections, offset/1048576.0, cacheFile.c_str());
+  pendingSections.clear();
+}
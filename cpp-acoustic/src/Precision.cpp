@@ -0,0 +1,363 @@
+#include "fem.h"
+
+/* Device precision (setting "precision").
+
+   single: float storage and arithmetic on the device (default)
+   mixed:  float Q/resQ/rhsQ and operators; the RK update kernels and the
+           lift sums accumulate in double (dacc in the kernels)
+   double: double storage and arithmetic
+
+   Device buffers of floating point data are allocated and copied with
+   DeviceFloatMalloc/DeviceFloatCopyFrom/To, which take float or double
+   host arrays and convert when the device type differs, and dfloat kernel
+   arguments are passed through DeviceFloatArg. Everything that feeds the
+   device values is kept in double on the host (operators through
+   setOccaArray, geofacs, Bernstein derivative values, the host fields
+   Q/P), so precision = double never sees float rounding; the host kernels
+   work on dfloat buffers and are only used with precision = single.
+
+   rhsQ and resQ can also be stored in 16 bits (settings rhs_storage and
+   res_storage = full | bf16 | fp16); the kernels convert where they read
+   and write them. StorageCheck (storage_check = 1) runs those conversions
+   over every float bit pattern against host references, and StorageReport
+   compares a run against the exact solution and against a saved run with
+   full storage. */
+
+extern occa::device device;
+
+int DevicePrecision(){
+  static int precision = -1;
+  if (precision < 0){
+    string p = GetSetting("precision", "single");
+    if (p=="mixed"){
+      precision = PRECISION_MIXED;
+    }else if (p=="double"){
+      precision = PRECISION_DOUBLE;
+    }else{
+      if (p!="single"){
+	printf("unknown precision %s, using single\n", p.c_str());
+      }
+      precision = PRECISION_SINGLE;
+    }
+  }
+  return precision;
+}
+
+// bytes per floating point value in device buffers
+size_t DeviceFloatSize(){
+  return DevicePrecision()==PRECISION_DOUBLE ? sizeof(double) : sizeof(float);
+}
+
+template <typename T, typename S>
+static void convertArray(T *dst, const S *src, size_t N){
+#pragma omp parallel for
+  for (size_t n = 0; n < N; ++n){
+    dst[n] = (T) src[n];
+  }
+}
+
+// h_a converted to the device type (h_a itself if no conversion is needed)
+template <typename T>
+static const void *toDevice(const T *h_a, size_t N, void *&tmp){
+  tmp = NULL;
+  if (DeviceFloatSize()==sizeof(T)){
+    return h_a;
+  }
+  tmp = malloc(N*DeviceFloatSize());
+  if (DeviceFloatSize()==sizeof(double)){
+    convertArray((double*) tmp, h_a, N);
+  }else{
+    convertArray((float*) tmp, h_a, N);
+  }
+  return tmp;
+}
+
+// device buffer of N values, initialized from h_a
+template <typename T>
+static occa::memory deviceMalloc(size_t N, const T *h_a){
+  void *tmp;
+  occa::memory c_a = device.malloc(N*DeviceFloatSize(), toDevice(h_a, N, tmp));
+  free(tmp);
+  return c_a;
+}
+
+// copy all of c_a from (to) the host
+template <typename T>
+static void deviceCopyFrom(occa::memory &c_a, const T *h_a){
+  const size_t N = c_a.bytes()/DeviceFloatSize();
+  void *tmp;
+  c_a.copyFrom(toDevice(h_a, N, tmp), N*DeviceFloatSize());
+  free(tmp);
+}
+
+template <typename T>
+static void deviceCopyTo(occa::memory &c_a, T *h_a){
+  const size_t N = c_a.bytes()/DeviceFloatSize();
+  if (DeviceFloatSize()==sizeof(T)){
+    c_a.copyTo(h_a, N*sizeof(T));
+    return;
+  }
+  void *tmp = malloc(N*DeviceFloatSize());
+  c_a.copyTo(tmp, N*DeviceFloatSize());
+  if (DeviceFloatSize()==sizeof(double)){
+    convertArray(h_a, (double*) tmp, N);
+  }else{
+    convertArray(h_a, (float*) tmp, N);
+  }
+  free(tmp);
+}
+
+// uninitialized device buffer of N values
+occa::memory DeviceFloatMalloc(size_t N){
+  return device.malloc(N*DeviceFloatSize());
+}
+
+occa::memory DeviceFloatMalloc(size_t N, const float *h_a){
+  return deviceMalloc(N, h_a);
+}
+
+occa::memory DeviceFloatMalloc(size_t N, const double *h_a){
+  return deviceMalloc(N, h_a);
+}
+
+void DeviceFloatCopyFrom(occa::memory &c_a, const float *h_a){
+  deviceCopyFrom(c_a, h_a);
+}
+
+void DeviceFloatCopyFrom(occa::memory &c_a, const double *h_a){
+  deviceCopyFrom(c_a, h_a);
+}
+
+void DeviceFloatCopyTo(occa::memory &c_a, float *h_a){
+  deviceCopyTo(c_a, h_a);
+}
+
+void DeviceFloatCopyTo(occa::memory &c_a, double *h_a){
+  deviceCopyTo(c_a, h_a);
+}
+
+// dfloat kernel argument in the device type
+occa::kernelArg DeviceFloatArg(double a){
+  if (DeviceFloatSize()==sizeof(double)){
+    return occa::kernelArg(a);
+  }
+  return occa::kernelArg((float) a);
+}
+
+// set occa array:: cast to the device type.
+void setOccaArray(MatrixXd A, occa::memory &c_A){
+  if (DeviceFloatSize()==sizeof(double)){
+    c_A = device.malloc(A.size()*sizeof(double), A.data());
+    return;
+  }
+  int r = A.rows();
+  int c = A.cols();
+  float *f_A = (float*)malloc(r*c*sizeof(float));
+  Map<MatrixXf >(f_A,r,c) = A.cast<float>();
+  c_A = device.malloc(r*c*sizeof(float),f_A);
+  free(f_A);
+}
+
+static int readStorage(const char *name){
+  string format = GetSetting(name, "full");
+  if (format=="bf16"){
+    return STORAGE_BF16;
+  }else if (format=="fp16"){
+    return STORAGE_FP16;
+  }else if (format!="full"){
+    printf("unknown %s %s, using full\n", name, format.c_str());
+  }
+  return STORAGE_FULL;
+}
+
+int RhsStorage(){
+  static int format = -1;
+  if (format < 0){
+    format = readStorage("rhs_storage");
+  }
+  return format;
+}
+
+int ResStorage(){
+  static int format = -1;
+  if (format < 0){
+    format = readStorage("res_storage");
+  }
+  return format;
+}
+
+// zero-filled device buffer of N values in a storage format
+occa::memory FieldStorageMalloc(size_t N, int format){
+  const size_t bytes = N*(format==STORAGE_FULL ? DeviceFloatSize() : sizeof(unsigned short));
+  void *zeros = calloc(bytes, 1);
+  occa::memory c_a = device.malloc(bytes, zeros);
+  free(zeros);
+  return c_a;
+}
+
+// zero a buffer from FieldStorageMalloc (all-zero bits are 0 in every format)
+void FieldStorageZero(occa::memory &c_a){
+  void *zeros = calloc(c_a.bytes(), 1);
+  c_a.copyFrom(zeros, c_a.bytes());
+  free(zeros);
+}
+
+// bf16 reference: the upper 16 bits, rounded to nearest even on the lower 16
+static unsigned short bf16Reference(unsigned int b){
+  unsigned int upper = b >> 16, lower = b & 0xffffu;
+  if (lower > 0x8000u || (lower==0x8000u && (upper & 1u))){
+    ++upper;
+  }
+  return (unsigned short) upper;
+}
+
+#ifdef __FLT16_MANT_DIG__
+// fp16 reference: the compiler's _Float16 conversions
+static unsigned short fp16Reference(float a){
+  _Float16 h = (_Float16) a;
+  unsigned short b;
+  memcpy(&b, &h, sizeof(b));
+  return b;
+}
+
+static float fp16Value(unsigned short b){
+  _Float16 h;
+  memcpy(&h, &b, sizeof(h));
+  return (float) h;
+}
+#else
+// fp16 reference without _Float16: round |a| to a multiple of the fp16 ulp
+// in double (nearbyint rounds to even), subnormals share exponent -14
+static unsigned short fp16Reference(float a){
+  const unsigned short sign = signbit(a) ? 0x8000 : 0;
+  const double x = fabs((double) a);
+  if (isinf(x)){
+    return sign | 0x7c00;
+  }
+  int e;
+  frexp(x, &e);
+  e = max(e - 1, -14);
+  double q = nearbyint(ldexp(x, 10 - e)); // in units of 2^(e-10)
+  if (q >= 2048){ // rounded up to the next power of two
+    q /= 2;
+    ++e;
+  }
+  if (e > 15){
+    return sign | 0x7c00;
+  }
+  if (q < 1024){
+    return sign | (unsigned short) q;
+  }
+  return sign | (unsigned short) (((e + 15) << 10) | ((int) q - 1024));
+}
+
+static float fp16Value(unsigned short b){
+  const int absb = b & 0x7fff;
+  double x = INFINITY;
+  if (absb < 0x0400){
+    x = ldexp((double) absb, -24);
+  }else if (absb < 0x7c00){
+    x = ldexp((double) (1024 + (absb & 0x3ff)), (absb >> 10) - 25);
+  }
+  return (float) ((b & 0x8000) ? -x : x);
+}
+#endif
+
+/* storage_check = 1: every float bit pattern through the storage_convert
+   kernel, i.e. the floatToHalf/halfToFloat used by loadRhs/storeRhs and
+   loadRes/storeRes, against the references above. The 16-bit value must
+   match bit for bit and convert back to the reference float (nan only
+   needs to stay nan). Checks each format in use by rhs_storage or
+   res_storage; needs the kernel defines set by WaveInitOCCA3d. */
+void StorageCheck(){
+
+  const char *names[3] = {"full", "bf16", "fp16"};
+  const int N = 1<<22;
+  const int Nchunks = (int) ((1ull<<32)/N);
+  occa::kernel storage_convert = buildKernel("okl/WaveKernels.okl", "storage_convert");
+  occa::memory c_h = device.malloc(N*sizeof(unsigned short));
+  occa::memory c_a = device.malloc(N*sizeof(float));
+  unsigned short *h = (unsigned short*) malloc(N*sizeof(unsigned short));
+  float *a = (float*) malloc(N*sizeof(float));
+
+  for (int format = STORAGE_BF16; format <= STORAGE_FP16; ++format){
+    if (RhsStorage()!=format && ResStorage()!=format){
+      continue;
+    }
+    const unsigned short nanBits = format==STORAGE_BF16 ? 0x7f80 : 0x7c00;
+    size_t mismatch = 0;
+    for (int chunk = 0; chunk < Nchunks; ++chunk){
+      storage_convert(N, chunk, format, c_h, c_a);
+      c_h.copyTo(h, N*sizeof(unsigned short));
+      c_a.copyTo(a, N*sizeof(float));
+
+#pragma omp parallel for reduction(+:mismatch)
+      for (int n = 0; n < N; ++n){
+	const unsigned int bits = (unsigned int) chunk*N + n;
+	float x;
+	memcpy(&x, &bits, sizeof(x));
+	if (isnan(x)){
+	  mismatch += !((h[n] & 0x7fff) > nanBits && isnan(a[n]));
+	  continue;
+	}
+	unsigned short href;
+	float aref;
+	if (format==STORAGE_BF16){
+	  href = bf16Reference(bits);
+	  const unsigned int abits = ((unsigned int) href) << 16;
+	  memcpy(&aref, &abits, sizeof(aref));
+	}else{
+	  href = fp16Reference(x);
+	  aref = fp16Value(href);
+	}
+	mismatch += (h[n]!=href || memcmp(&a[n], &aref, sizeof(float))!=0);
+      }
+    }
+    printf("storage_check %s: %lu of 2^32 float bit patterns differ from the reference\n",
+	   names[format], (unsigned long) mismatch);
+  }
+  free(h);
+  free(a);
+}
+
+/* accuracy of the rhsQ/resQ storage formats: error of the final pressure Q
+   against the exact solution, and against a run with full storage saved to
+   the storage_reference file (written by that run, read by the others) */
+void StorageReport(Mesh *mesh, double *Q, double time,
+		   double(*uexptr)(double,double,double,double)){
+
+  const char *names[3] = {"full", "bf16", "fp16"};
+  const dlong Ntotal = (dlong) p_Nfields*mesh->K*p_Np;
+  double L2err, relL2err;
+  compute_error(mesh, time, Q, uexptr, L2err, relL2err);
+  printf("storage rhsQ = %s, resQ = %s, N = %d: L2 error at time %g = %6.6e (relative %6.6e)\n",
+	 names[RhsStorage()], names[ResStorage()], p_N, time, L2err, relL2err);
+
+  string file = GetSetting("storage_reference", "");
+  if (file.empty()){
+    return;
+  }
+  if (RhsStorage()==STORAGE_FULL && ResStorage()==STORAGE_FULL){
+    FILE *fp = fopen(file.c_str(), "wb");
+    if (fp){
+      fwrite(Q, sizeof(double), Ntotal, fp);
+      fclose(fp);
+      printf("storage reference written to %s\n", file.c_str());
+    }
+    return;
+  }
+  double *Qref = (double*) malloc(Ntotal*sizeof(double));
+  FILE *fp = fopen(file.c_str(), "rb");
+  if (fp && fread(Qref, sizeof(double), Ntotal, fp)==(size_t) Ntotal && fgetc(fp)==EOF){
+    double L2diff, relL2diff;
+    compute_difference_Bern(mesh, Q, Qref, L2diff, relL2diff);
+    printf("storage rhsQ = %s, resQ = %s, N = %d: L2 difference to full storage = %6.6e (relative %6.6e)\n",
+	   names[RhsStorage()], names[ResStorage()], p_N, L2diff, relL2diff);
+  }else{
+    printf("no full storage reference in %s for this mesh, run with full storage first\n", file.c_str());
+  }
+  if (fp){
+    fclose(fp);
+  }
+  free(Qref);
+}
@@ -1,5 +1,8 @@
 #include <stdio.h>
+#include <sys/time.h>
 #include "fem.h"
+#include <omp.h>
+#include <unistd.h>
 #include <occa.hpp>
 
 // switches b/w nodal and bernstein bases
@@ -8,7 +11,6 @@ int ngeo, nvgeo, nfgeo; // number of geometric factors
 
 // OCCA device
 occa::device device;
-occa::kernelInfo dgInfo;
 
 // OCCA array for geometric factors
 occa::memory c_vgeo;
@@ -28,6 +30,11 @@ occa::memory c_resP;
 occa::memory c_Q;
 occa::memory c_P;
 
+// scheme(s) advanced by the RK step; in compare mode the FQWADG copy (c_P)
+// runs on its own stream so it can overlap with BBWADG on c_Q
+int waveScheme = SCHEME_COMPARE;
+occa::stream streamQ, streamP;
+
 // OCCA arrays for nodal derivative/lift matrices
 occa::memory c_Dr;
 occa::memory c_Ds;
@@ -87,13 +94,56 @@ occa::kernel rk_surface_bern;
 // used for both nodal and Bernstein
 occa::kernel rk_update;
 
+// face-based flux: jumps computed once per unique face, then lifted per element
+int useFaceFlux = 0;
+int NfacesUnique = 0;
+occa::memory c_faceOwners, c_mapF, c_faceFlux, c_faceFluxP;
+occa::kernel rk_flux_faces;
+occa::kernel rk_surface_faces;
+occa::kernel rk_surface_bern_faces;
+
 // kernels added by myself
 occa::kernel rk_update_BB_WADG;
 occa::kernel rk_update_WADG;
 
+// Bernstein kernels with the tables as literals (KernelGen.cpp, setting
+// bern_codegen); the update kernel is generated only for N >= 2
+int useBernCodegen = 0, useBernCodegenUpdate = 0;
+occa::kernel rk_volume_bern_gen;
+occa::kernel rk_surface_bern_gen;
+occa::kernel rk_update_BB_WADG_gen;
+
+// elements 0..KInterior-1 have no boundary face (setting split_boundary);
+// their surface terms use the variants built with p_INTERIOR = 1
+int KInterior = 0;
+occa::kernel rk_surface_interior;
+occa::kernel rk_surface_bern_interior;
+occa::kernel rk_surface_bern_gen_interior;
+
 // block sizes for optimization of kernels
 int KblkV, KblkS, KblkU;
 
+// names KblkV/KblkS/KblkU are stored under in the tuning database
+#if USE_BERN && USE_SLICE_LIFT
+static const char *tunedNames[3] = {"rk_volume_bern", "rk_surface_bern_slice", "rk_update_BB_WADG"};
+#elif USE_BERN
+static const char *tunedNames[3] = {"rk_volume_bern", "rk_surface_bern", "rk_update_BB_WADG"};
+#else
+static const char *tunedNames[3] = {"rk_volume", "rk_surface", "rk_update_BB_WADG"};
+#endif
+
+// native CPU kernels (HostKernels.cpp) instead of OCCA: nodal volume/surface
+// or, with USE_BERN, the SIMD Bernstein volume kernel
+int useHostKernels = 0;
+
+// fused host LSRK stage (nodal): writes the new solution to c_Qnext, then swaps with c_Q
+int useFusedStage = 0;
+occa::memory c_Qnext;
+
+// temporal blocking (nodal): stages per host sweep over element patches, 0 = off
+int useTemporalBlocking = 0;
+occa::memory c_resQnext;
+
 // runtime counters
 double timeV = 0.0, timeS = 0.0, timeU=0.0, timeQ = 0.0, timeQf = 0.0, timeM = 0.0, timeP = 0.0;
 
@@ -113,16 +163,6 @@ void diagnose_array(const char *message, occa::memory &c_a, int N){
 }
 
 
-// set occa array:: cast to dfloat.
-void setOccaArray(MatrixXd A, occa::memory &c_A){
-  int r = A.rows();
-  int c = A.cols();
-  dfloat *f_A = (dfloat*)malloc(r*c*sizeof(dfloat));
-  Map<MatrixXdf >(f_A,r,c) = A.cast<dfloat>();
-  c_A = device.malloc(r*c*sizeof(dfloat),f_A);
-  free(f_A);
-}
-
 // set occa array:: cast to dfloat
 void setOccaIntArray(MatrixXi A, occa::memory &c_A){
   int r = A.rows();
@@ -134,21 +174,122 @@ void setOccaIntArray(MatrixXi A, occa::memory &c_A){
 }
 
 
+// read setting "scheme": bbwadg, fqwadg or compare (default)
+int GetSchemeSetting(){
+  string scheme = GetSetting("scheme", "compare");
+  if (scheme=="bbwadg" || scheme=="BBWADG"){
+    return SCHEME_BBWADG;
+  }else if (scheme=="fqwadg" || scheme=="FQWADG"){
+    return SCHEME_FQWADG;
+  }else if (scheme!="compare"){
+    printf("unknown scheme %s, running BBWADG/FQWADG comparison\n", scheme.c_str());
+  }
+  return SCHEME_COMPARE;
+}
+
+// wait for all streams in use
+void WaveFinish(){
+  if (waveScheme==SCHEME_COMPARE){
+    device.setStream(streamP);
+    device.finish();
+    device.setStream(streamQ);
+  }
+  device.finish();
+}
+
+/* OpenMP threads and binding (settings omp_threads, omp_pinning = close,
+   spread, ...), for the host loops and the OCCA OpenMP kernels, which
+   share the runtime of the executable. Call before the first parallel
+   region. The runtime reads OMP_PROC_BIND/OMP_PLACES only at process
+   start, so a binding is either set with them at launch or applied by
+   re-executing the program once with them set. */
+void SetupOpenMP(char **argv){
+
+  int threads = GetIntSetting("omp_threads", 0);
+  if (threads > 0){
+    omp_set_num_threads(threads);
+  }
+
+  string pinning = GetSetting("omp_pinning", "");
+  const char *bind = getenv("OMP_PROC_BIND");
+  if (pinning.size() && (!bind || pinning!=bind)){
+    if (!getenv("BBWADG_OMP_REEXEC")){
+      setenv("OMP_PROC_BIND", pinning.c_str(), 1);
+      setenv("OMP_PLACES", "cores", 0);
+      setenv("BBWADG_OMP_REEXEC", "1", 1);
+      fflush(stdout);
+      execvp(argv[0], argv);
+    }
+    printf("omp_pinning = %s not applied, set OMP_PROC_BIND=%s at launch\n",
+	   pinning.c_str(), pinning.c_str());
+  }
+
+  const char *bindNames[5] = {"false", "true", "master", "close", "spread"};
+  const int b = (int) omp_get_proc_bind();
+  printf("OpenMP threads = %d, binding = %s\n", omp_get_max_threads(),
+	 b >= 0 && b < 5 ? bindNames[b] : "unknown");
+}
+
+// pick the OCCA backend at runtime from the setup file/environment:
+//   occa_mode = Serial | OpenMP | OpenCL | CUDA  (default CUDA)
+//   occa_platform, occa_device                  (OpenCL/CUDA ids)
+//   occa_flags                                  (kernel compiler flags)
+// omp_threads and omp_pinning are applied by SetupOpenMP
+void SetupOccaDevice(){
+
+  string mode = GetSetting("occa_mode", "CUDA");
+  int platformID = GetIntSetting("occa_platform", 0);
+  int deviceID = GetIntSetting("occa_device", 0);
+
+  char setupStr[BUFSIZ];
+  if (mode=="OpenCL" || mode=="CUDA"){
+    sprintf(setupStr, "mode = %s, platformID = %d, deviceID = %d",
+	    mode.c_str(), platformID, deviceID);
+  }else{
+    sprintf(setupStr, "mode = %s", mode.c_str());
+  }
+
+  // keep OCCA's compiled binaries next to the expanded kernel sources.
+  // OCCA reads its environment once, so this precedes any OCCA call
+  string cacheDir = getKernelCacheDir();
+  if (cacheDir!="none"){
+    setenv("OCCA_CACHE_DIR", (cacheDir + "/occa").c_str(), 0);
+  }
+
+  occa::printAvailableDevices();
+
+  printf("OCCA device: %s\n", setupStr);
+  device.setup(setupStr);
+
+  string defaultFlags = "";
+  if (mode=="OpenMP"){
+    defaultFlags = "-O3 -march=native -fopenmp";
+  }else if (mode=="Serial"){
+    defaultFlags = "-O3 -march=native";
+  }
+  string flags = GetSetting("occa_flags", defaultFlags.c_str());
+  if (flags.size()){
+    printf("OCCA kernel compiler flags: %s\n", flags.c_str());
+    device.setCompilerFlags(flags);
+  }
+}
+
 dfloat WaveInitOCCA3d(Mesh *mesh, int KblkVin, int KblkSin,
 		      int KblkUin){
 
 
-  KblkV = KblkVin;
-  KblkS = KblkSin;
-  KblkU = KblkUin;
+  SetupOccaDevice();
+  FieldLayoutInit(mesh);
 
-  occa::printAvailableDevices();
+  KInterior = InteriorElementCount(mesh);
+  if (GetIntSetting("split_boundary", 0)){
+    printf("split_boundary: %d interior, %d boundary elements\n", KInterior, mesh->K - KInterior);
+  }
 
-  //device.setup("mode = OpenCL, platformID = 0, deviceID = 1");
-  //device.setup("mode = OpenMP, platformID = 0, deviceID = 0");
-  //device.setup("mode = Serial");
-  device.setup("mode = CUDA, platformID = 0, deviceID = 0");
-  //device.setCompiler("nvcc"); device.setCompilerFlags("--use_fast_math"); device.setCompilerFlags("--fmad=true");
+  // block sizes: command line if given (> 0), else tuning database, else defaults
+  KblkV = KblkVin > 0 ? KblkVin : getTunedKblk(tunedNames[0], 1);
+  KblkS = KblkSin > 0 ? KblkSin : getTunedKblk(tunedNames[1], 1);
+  KblkU = KblkUin > 0 ? KblkUin : getTunedKblk(tunedNames[2], 8);
 
   printf("KblkV = %d, KblkS = %d, KblkU = %d\n",KblkV,KblkS,KblkU);
   
@@ -193,7 +334,7 @@ dfloat WaveInitOCCA3d(Mesh *mesh, int KblkVin, int KblkSin,
 
   // bernstein Dmatrices (4 entries per row)
   sz = 4*p_Np*sizeof(int);
-  c_Dvals4 = device.malloc(4*p_Np*sizeof(dfloat), mesh->D_vals[0]);
+  setOccaArray(mesh->D_vals.transpose(), c_Dvals4); // [n][j], 4 per row
 
   // barycentric deriv indices organized for ILP
   // expand to a Np x 4 matrix for float4 storage
@@ -263,161 +404,348 @@ dfloat WaveInitOCCA3d(Mesh *mesh, int KblkVin, int KblkSin,
 
   // =====================  geofacs ==================================
 
-  double drdx, dsdx, dtdx;
-  double drdy, dsdy, dtdy;
-  double drdz, dsdz, dtdz, J;
-
   int sk = 0;
   int skP = -1;
-  double *nxk = (double*) calloc(mesh->Nfaces,sizeof(double));
-  double *nyk = (double*) calloc(mesh->Nfaces,sizeof(double));
-  double *nzk = (double*) calloc(mesh->Nfaces,sizeof(double));
-  double *sJk = (double*) calloc(mesh->Nfaces,sizeof(double));
 
   // [JC] packed geo + surface
   nvgeo = 9; // rst/xyz
   nfgeo = 4; // Fscale, (3)nxyz,
   ngeo = nfgeo*p_Nfaces + nvgeo; // nxyz + tau + Fscale (faces), G'*G (volume)
   dfloat *geo = (dfloat*) malloc(mesh->K*ngeo*sizeof(dfloat));
-  dfloat *vgeo = (dfloat*) malloc(K*nvgeo*sizeof(dfloat));
-  dfloat *fgeo = (dfloat*) malloc(K*nfgeo*p_Nfaces*sizeof(dfloat));
+  // kept in double and converted once on upload (precision = double uses them as is)
+  double *vgeo = (double*) MeshCacheMap("vgeo", K*nvgeo*sizeof(double));
+  double *fgeo = (double*) MeshCacheMap("fgeo", K*nfgeo*p_Nfaces*sizeof(double));
+
+  // packed geofacs (or use them in place from the mesh cache)
+  const int cachedGeo = vgeo && fgeo;
+  if (!cachedGeo){
+    vgeo = (double*) malloc(K*nvgeo*sizeof(double));
+    fgeo = (double*) malloc(K*nfgeo*p_Nfaces*sizeof(double));
+  }
 
-  dfloat FscaleMax = 0.f;
-  for(int k=0;k<mesh->K;++k){
+  // elements are independent: one pass over all of them, in parallel
+  if (!cachedGeo){
+#pragma omp parallel for
+    for(int k=0;k<K;++k){
 
-    GeometricFactors3d(mesh, k,
-		       &drdx, &dsdx, &dtdx,
-		       &drdy, &dsdy, &dtdy,
-		       &drdz, &dsdz, &dtdz, &J);
+      double drdx, dsdx, dtdx;
+      double drdy, dsdy, dtdy;
+      double drdz, dsdz, dtdz, J;
+      double nxk[p_Nfaces], nyk[p_Nfaces], nzk[p_Nfaces], sJk[p_Nfaces];
 
-    Normals3d(mesh, k, nxk, nyk, nzk, sJk);
+      GeometricFactors3d(mesh, k,
+			 &drdx, &dsdx, &dtdx,
+			 &drdy, &dsdy, &dtdy,
+			 &drdz, &dsdz, &dtdz, &J);
 
-    vgeo[k*nvgeo + 0] = drdx;    vgeo[k*nvgeo + 1] = drdy;    vgeo[k*nvgeo + 2] = drdz;
-    vgeo[k*nvgeo + 3] = dsdx;    vgeo[k*nvgeo + 4] = dsdy;    vgeo[k*nvgeo + 5] = dsdz;
-    vgeo[k*nvgeo + 6] = dtdx;    vgeo[k*nvgeo + 7] = dtdy;    vgeo[k*nvgeo + 8] = dtdz;
+      Normals3d(mesh, k, nxk, nyk, nzk, sJk);
 
-#if 0
-    if (k==0){
-      printf("rxyz = %f, %f, %f\n",drdx,drdy,drdz);
-      printf("sxyz = %f, %f, %f\n",dsdx,dsdy,dsdz);
-      printf("txyz = %f, %f, %f\n",dtdx,dtdy,dtdz);
-      printf("J = %f\n\n",J);
-    }
-#endif
+      vgeo[k*nvgeo + 0] = drdx;    vgeo[k*nvgeo + 1] = drdy;    vgeo[k*nvgeo + 2] = drdz;
+      vgeo[k*nvgeo + 3] = dsdx;    vgeo[k*nvgeo + 4] = dsdy;    vgeo[k*nvgeo + 5] = dsdz;
+      vgeo[k*nvgeo + 6] = dtdx;    vgeo[k*nvgeo + 7] = dtdy;    vgeo[k*nvgeo + 8] = dtdz;
 
-    for(int f=0;f<mesh->Nfaces;++f){
+      for(int f=0;f<mesh->Nfaces;++f){
 
-      dfloat Fscale = sJk[f]/J; //sJk[f]/(2.*J);
-      dfloat nx = nxk[f];
-      dfloat ny = nyk[f];
-      dfloat nz = nzk[f];
+        double Fscale = sJk[f]/J; //sJk[f]/(2.*J);
+        double nx = nxk[f];
+        double ny = nyk[f];
+        double nz = nzk[f];
 
-      // for dt
-      FscaleMax = max(FscaleMax,Fscale);
-
-      fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 0] = Fscale; // Fscale
-      fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 1] = nx;
-      fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 2] = ny;
-      fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 3] = nz;
+        fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 0] = Fscale; // Fscale
+        fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 1] = nx;
+        fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 2] = ny;
+        fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 3] = nz;
+      }
     }
   }
 
-  // correct vmapP for Nfields > 1
-  int *h_vmapP = (int*) malloc(mesh->K*p_Nfp*p_Nfaces*sizeof(int));
+  // for dt
+  double FscaleMax = 0.0;
+  for (int i = 0; i < K*p_Nfaces; ++i){
+    FscaleMax = max(FscaleMax,fgeo[i*nfgeo]); // Fscale
+  }
+  if (!cachedGeo){
+    MeshCacheAdd("vgeo", vgeo, K*nvgeo*sizeof(double));
+    MeshCacheAdd("fgeo", fgeo, K*nfgeo*p_Nfaces*sizeof(double));
+  }
+
+  // correct vmapP for Nfields > 1 and the device field layout
+  dlong *h_vmapP = (dlong*) malloc((size_t) mesh->K*p_Nfp*p_Nfaces*sizeof(dlong));
   for (int e = 0; e < mesh->K; ++e){
     for (int i = 0; i < p_Nfp*p_Nfaces; ++i){
       int f = i/p_Nfp;
-      int idP = mesh->vmapP[i + p_Nfp*p_Nfaces*e];
-  
       int eNbr = mesh->EToE[e][f];
-      idP -= p_Np*eNbr; // decrement
-      idP += p_Np*p_Nfields*eNbr; // re-increment
+      int nP = (int) (mesh->vmapP[i + (dlong) p_Nfp*p_Nfaces*e] - (dlong) p_Np*eNbr);
 
-      h_vmapP[i+p_Nfp*p_Nfaces*e] = idP;
+      h_vmapP[i + (dlong) p_Nfp*p_Nfaces*e] = FieldIndex(eNbr, 0, nP);
     }
   }
 
+#if USE_BERN
+  waveScheme = GetSchemeSetting();
+  const char *schemeNames[3] = {"BBWADG", "FQWADG", "BBWADG vs FQWADG comparison"};
+  printf("scheme = %s\n", schemeNames[waveScheme]);
+#else
+  // the nodal kernels advance a single solution with rk_update
+  printf("scheme does not apply to the nodal build (USE_BERN=0), ignoring\n");
+  waveScheme = SCHEME_BBWADG;
+#endif
+
   // storage for solution variables
-  dfloat *f_Q    = (dfloat*) calloc(mesh->K*p_Nfields*p_Np, sizeof(dfloat));
-  dfloat *f_resQ = (dfloat*) calloc(mesh->K*p_Nfields*p_Np, sizeof(dfloat));
-  dfloat *f_rhsQ = (dfloat*) calloc(mesh->K*p_Nfields*p_Np, sizeof(dfloat));
-
-  dfloat *f_P    = (dfloat*) calloc(mesh->K*p_Nfields*p_Np, sizeof(dfloat));
-  dfloat *f_resP = (dfloat*) calloc(mesh->K*p_Nfields*p_Np, sizeof(dfloat));
-  dfloat *f_rhsP = (dfloat*) calloc(mesh->K*p_Nfields*p_Np, sizeof(dfloat));
-
-  // store the solution of BBWADG with M=1
-  c_Q    = device.malloc(sizeof(dfloat)*mesh->K*p_Np*p_Nfields, f_Q);
-  c_resQ = device.malloc(sizeof(dfloat)*mesh->K*p_Np*p_Nfields, f_resQ);
-  c_rhsQ = device.malloc(sizeof(dfloat)*mesh->K*p_Np*p_Nfields, f_rhsQ);
-
-  // store solution of full-quadrature WADG
-  c_P    = device.malloc(sizeof(dfloat)*mesh->K*p_Np*p_Nfields, f_P);
-  c_resP = device.malloc(sizeof(dfloat)*mesh->K*p_Np*p_Nfields, f_resP);
-  c_rhsP = device.malloc(sizeof(dfloat)*mesh->K*p_Np*p_Nfields, f_rhsP);
+  double *f_Q = (double*) calloc(FieldStorageSize(), sizeof(double));
+
+  c_Q    = DeviceFloatMalloc(FieldStorageSize(), f_Q);
+  c_resQ = FieldStorageMalloc(FieldStorageSize(), ResStorage());
+  c_rhsQ = FieldStorageMalloc(FieldStorageSize(), RhsStorage());
+
+  // second copy of the solution only needed when comparing schemes
+  if (waveScheme==SCHEME_COMPARE){
+    c_P    = DeviceFloatMalloc(FieldStorageSize(), f_Q);
+    c_resP = FieldStorageMalloc(FieldStorageSize(), ResStorage());
+    c_rhsP = FieldStorageMalloc(FieldStorageSize(), RhsStorage());
+
+    streamQ = device.getStream();
+    streamP = device.createStream();
+    device.setStream(streamQ);
+  }
+  free(f_Q);
   
-  c_vgeo = device.malloc(mesh->K*nvgeo*sizeof(dfloat), vgeo);
-  c_fgeo = device.malloc(mesh->K*nfgeo*p_Nfaces*sizeof(dfloat), fgeo);
-  c_vmapP  = device.malloc(p_Nfp*p_Nfaces*mesh->K*sizeof(int),h_vmapP);
+  c_vgeo = DeviceFloatMalloc(mesh->K*nvgeo, vgeo);
+  c_fgeo = DeviceFloatMalloc(mesh->K*nfgeo*p_Nfaces, fgeo);
+
+  // native host kernels (host_kernels) and the settings they do not support
+  useHostKernels = GetIntSetting("host_kernels", 0);
+  if (useHostKernels && device.mode()!="Serial" && device.mode()!="OpenMP"){
+    printf("host_kernels needs occa_mode = Serial or OpenMP, ignoring\n");
+    useHostKernels = 0;
+  }
+  if (useHostKernels && (DeviceFloatSize()!=sizeof(dfloat) || DevicePrecision()==PRECISION_MIXED)){
+    printf("host_kernels store and accumulate in dfloat, ignoring with precision = mixed or double\n");
+    useHostKernels = 0;
+  }
+  if (useHostKernels && (RhsStorage()!=STORAGE_FULL || ResStorage()!=STORAGE_FULL)){
+    printf("host_kernels work on dfloat buffers, ignoring with 16-bit rhs_storage/res_storage\n");
+    useHostKernels = 0;
+  }
+  if (useHostKernels && FieldLayout()!=LAYOUT_ELEMENT){
+    printf("host_kernels use the element field layout, ignoring with field_layout = field or aosoa\n");
+    useHostKernels = 0;
+  }
+
+  // compact connectivity: neighbor/orientation codes plus per-N face node permutations
+  int useCompactConn = GetIntSetting("compact_connectivity", 0);
+  if (useCompactConn && useHostKernels){
+    printf("compact_connectivity is not used by the host kernels, ignoring\n");
+    useCompactConn = 0;
+  }
+  if (useCompactConn){
+    const int Nperm = p_Nfaces*p_Nfaces*6;
+    dlong *conn = BuildCompactConnectivity(mesh);
+
+    // check the reconstructed neighbor nodes against the full vmapP
+    int mismatch = 0;
+    for (int e = 0; e < mesh->K; ++e){
+      for (int n = 0; n < p_Nfp*p_Nfaces; ++n){
+	dlong code = conn[Nperm*p_Nfp + (dlong) e*p_Nfaces + n/p_Nfp];
+	int perm = code % Nperm;
+	int fP = (perm/6) % p_Nfaces;
+	dlong idP = FieldIndex(code/Nperm, 0, mesh->Fmask(conn[perm*p_Nfp + n%p_Nfp], fP));
+	mismatch += (idP != h_vmapP[n + (dlong) e*p_Nfp*p_Nfaces]);
+      }
+    }
+    if (mismatch){
+      printf("compact_connectivity: %d mismatched face nodes, using full vmapP\n", mismatch);
+      useCompactConn = 0;
+    }else{
+      size_t bytes = (Nperm*p_Nfp + (size_t) mesh->K*p_Nfaces)*sizeof(dlong);
+      printf("compact_connectivity: %lu bytes instead of %lu\n",
+	     (unsigned long) bytes, (unsigned long) ((size_t) p_Nfp*p_Nfaces*mesh->K*sizeof(dlong)));
+      c_vmapP = device.malloc(bytes, conn);
+    }
+    free(conn);
+  }
+  if (!useCompactConn){
+    c_vmapP  = device.malloc((size_t) p_Nfp*p_Nfaces*mesh->K*sizeof(dlong),h_vmapP);
+  }
+  addKernelDefine("p_COMPACT_CONN", useCompactConn);
+
+  useFaceFlux = GetIntSetting("face_flux", 0);
+#if USE_SLICE_LIFT
+  if (useFaceFlux){
+    printf("face_flux is not implemented for the slice-by-slice surface kernel, ignoring\n");
+    useFaceFlux = 0;
+  }
+#endif
+  if (useFaceFlux && useHostKernels && !USE_BERN){
+    printf("face_flux is not used by the nodal host kernels, ignoring\n");
+    useFaceFlux = 0;
+  }
+  if (useFaceFlux){
+    // unique faces from FacePair3d, owned by the lower numbered element (boundary faces by their element)
+    NfacesUnique = mesh->NfacesUnique;
+    int *faceIds = (int*) malloc(mesh->K*p_Nfaces*sizeof(int));
+    for (int uf = 0; uf < NfacesUnique; ++uf){
+      int e = mesh->faceOwners[uf]/p_Nfaces, f = mesh->faceOwners[uf]%p_Nfaces;
+      faceIds[e*p_Nfaces + f] = uf;
+      faceIds[mesh->EToE[e][f]*p_Nfaces + mesh->EToF[e][f]] = uf;
+    }
+
+    // face node of each volume node, per face
+    MatrixXi FmaskInv = MatrixXi::Constant(p_Np, p_Nfaces, -1);
+    for (int f = 0; f < p_Nfaces; ++f){
+      for (int i = 0; i < p_Nfp; ++i){
+	FmaskInv(mesh->Fmask(i,f), f) = i;
+      }
+    }
+
+    // element face node -> jump in faceFlux; -(id+1) if the neighbor owns the face
+    dlong *h_mapF = (dlong*) malloc((size_t) mesh->K*p_Nfp*p_Nfaces*sizeof(dlong));
+    for (int e = 0; e < mesh->K; ++e){
+      for (int n = 0; n < p_Nfp*p_Nfaces; ++n){
+	int f = n/p_Nfp;
+	int uf = faceIds[e*p_Nfaces + f];
+	int eNbr = mesh->EToE[e][f];
+	if (eNbr >= e){
+	  h_mapF[n + (dlong) e*p_Nfp*p_Nfaces] = n%p_Nfp + (dlong) 2*p_Nfp*uf;
+	}else{
+	  int vid = (int) (mesh->vmapP[n + (dlong) e*p_Nfp*p_Nfaces] - (dlong) eNbr*p_Np);
+	  int i = FmaskInv(vid, mesh->EToF[e][f]);
+	  h_mapF[n + (dlong) e*p_Nfp*p_Nfaces] = -(i + (dlong) 2*p_Nfp*uf) - 1;
+	}
+      }
+    }
+
+    c_faceOwners = device.malloc(NfacesUnique*sizeof(int), mesh->faceOwners);
+    c_mapF = device.malloc((size_t) mesh->K*p_Nfp*p_Nfaces*sizeof(dlong), h_mapF);
+    c_faceFlux = DeviceFloatMalloc((size_t) 2*p_Nfp*NfacesUnique);
+    if (waveScheme==SCHEME_COMPARE){
+      c_faceFluxP = DeviceFloatMalloc((size_t) 2*p_Nfp*NfacesUnique);
+    }
+    printf("face flux: %d unique faces for %d element faces\n", NfacesUnique, mesh->K*p_Nfaces);
+    free(faceIds);
+    free(h_mapF);
+  }
 
   // build kernels
-  if (sizeof(dfloat)==8){
-    dgInfo.addDefine("USE_DOUBLE", 1);
-  }else{
-    dgInfo.addDefine("USE_DOUBLE", 0);
-  }
-  dgInfo.addDefine("p_EEL_size",mesh->EEL_val_vec.rows());
-  dgInfo.addDefine("p_EEL_nnz",mesh->EEL_nnz);
-  dgInfo.addDefine("p_L0_nnz",min(p_Nfp,7)); // max 7 nnz with L0 matrix
-  dgInfo.addDefine("p_Nfields",      p_Nfields); // wave equation
-  dgInfo.addDefine("p_N",      p_N);
-  dgInfo.addDefine("p_KblkV",  KblkV);
-  dgInfo.addDefine("p_KblkS",  KblkS);
-  dgInfo.addDefine("p_KblkU",  KblkU);
-  dgInfo.addDefine("p_Np",      p_Np);
-  dgInfo.addDefine("p_NMp",    p_NMp);
-  dgInfo.addDefine("p_Nfp",     p_Nfp);
-  dgInfo.addDefine("p_Nfaces",  p_Nfaces);
-  dgInfo.addDefine("p_NfpNfaces",   p_Nfp*p_Nfaces);
+  addKernelDefine("USE_DOUBLE", DevicePrecision()==PRECISION_DOUBLE);
+  addKernelDefine("USE_DOUBLE_ACCUM", DevicePrecision()!=PRECISION_SINGLE);
+  addKernelDefine("p_RHS_FORMAT", RhsStorage());
+  addKernelDefine("p_RES_FORMAT", ResStorage());
+  addKernelDefine("USE_DLONG", sizeof(dlong)==8);
+  addKernelDefine("p_EEL_size",mesh->EEL_val_vec.rows());
+  addKernelDefine("p_EEL_nnz",mesh->EEL_nnz);
+  addKernelDefine("p_L0_nnz",min(p_Nfp,7)); // max 7 nnz with L0 matrix
+  addKernelDefine("p_Nfields",      p_Nfields); // wave equation
+  addKernelDefine("p_LAYOUT", FieldLayout());
+  addKernelDefine("p_Lanes",  FieldLanes());
+  addKernelDefine("p_Kpad",   FieldLayoutK());
+  addKernelDefine("p_N",      p_N);
+  addKernelDefine("p_KblkV",  KblkV);
+  addKernelDefine("p_KblkS",  KblkS);
+  addKernelDefine("p_KblkU",  KblkU);
+  addKernelDefine("p_Np",      p_Np);
+  addKernelDefine("p_NMp",    p_NMp);
+  addKernelDefine("p_Nfp",     p_Nfp);
+  addKernelDefine("p_Nfaces",  p_Nfaces);
+  addKernelDefine("p_NfpNfaces",   p_Nfp*p_Nfaces);
   
   //add constant for projection_nodal
-  dgInfo.addDefine("p_Vqrows",mesh->Vqrows);
+  addKernelDefine("p_Vqrows",mesh->Vqrows);
   printf("Vqrows=%d\n", mesh->Vqrows);
-  dgInfo.addDefine("p_NpNfields", p_Np*p_Nfields);
+  addKernelDefine("p_NpNfields", p_Np*p_Nfields);
 
   // [JC] max threads
   int T = max(p_Np,p_Nfp*p_Nfaces);
-  dgInfo.addDefine("p_T",T);
-  dgInfo.addDefine("p_Nvgeo",nvgeo);
-  dgInfo.addDefine("p_Nfgeo",nfgeo);
+  addKernelDefine("p_T",T);
+  addKernelDefine("p_INTERIOR",0); // 1 for the interior surface kernels
+  addKernelDefine("p_Nvgeo",nvgeo);
+  addKernelDefine("p_Nfgeo",nfgeo);
+  addKernelDefine("p_KblkF", max(1, 256/p_Nfp)); // faces per block in rk_flux_faces
+
+  if (useHostKernels){
+    HostKernelsInit(mesh);
+    useFusedStage = !USE_BERN && GetIntSetting("host_fused", 0);
+    if (!USE_BERN && GetIntSetting("host_tblock", 0) > 1){
+      useTemporalBlocking = min(GetIntSetting("host_tblock", 0), 5);
+      HostTemporalInit(mesh, (dlong*) c_vmapP.getMemoryHandle(), useTemporalBlocking);
+      c_resQnext = DeviceFloatMalloc(FieldStorageSize());
+    }
+  }
+  if (useFusedStage || useTemporalBlocking){
+    c_Qnext = DeviceFloatMalloc(FieldStorageSize());
+  }
+
+  // generated Bernstein kernels (bern_codegen), built with the others below
+  string gen;
+  if (USE_BERN && GetIntSetting("bern_codegen", 0)){
+    gen = BernKernelGen(mesh, useBernCodegenUpdate);
+    useBernCodegen = 1;
+  }
+
+  // time candidate block sizes on this mesh and store the winners
+  if (GetIntSetting("autotune", 0)){
+    WaveAutotune(mesh);
+  }
 
   std::string src = "okl/WaveKernels.okl";
   std::cout << "using src = " << src.c_str() << std::endl;
 
   printf("Building Bernstein kernels from %s\n",src.c_str());
   // bernstein kernels
-  rk_volume_bern  = device.buildKernelFromSource(src.c_str(), "rk_volume_bern", dgInfo);
+  rk_volume_bern  = buildKernel(src, "rk_volume_bern");
 
   printf("building rk_surface_bern from %s\n",src.c_str());
 #if USE_SLICE_LIFT
-  rk_surface_bern = device.buildKernelFromSource(src.c_str(), "rk_surface_bern_slice", dgInfo);
+  rk_surface_bern = buildKernel(src, "rk_surface_bern_slice");
   printf("using slice-by-slice bern surface kernel; more efficient for N > 6\n");
 #else
   printf("using non-optimal bern surface kernel; more efficient for N < 6\n");
-  rk_surface_bern = device.buildKernelFromSource(src.c_str(), "rk_surface_bern", dgInfo);
+  rk_surface_bern = buildKernel(src, "rk_surface_bern");
 #endif
 
   // nodal kernels
-  rk_volume  = device.buildKernelFromSource(src.c_str(), "rk_volume", dgInfo);
-  rk_surface = device.buildKernelFromSource(src.c_str(), "rk_surface", dgInfo);
-  rk_update  = device.buildKernelFromSource(src.c_str(), "rk_update",dgInfo);
+  rk_volume  = buildKernel(src, "rk_volume");
+  rk_surface = buildKernel(src, "rk_surface");
+  rk_update  = buildKernel(src, "rk_update");
+
+  // surface kernels without the boundary branch for the interior elements
+  if (KInterior){
+    addKernelDefine("p_INTERIOR",1);
+    rk_surface_bern_interior = buildKernel(src, USE_SLICE_LIFT ? "rk_surface_bern_slice" : "rk_surface_bern");
+    rk_surface_interior = buildKernel(src, "rk_surface");
+    addKernelDefine("p_INTERIOR",0);
+  }
  
 
   // adaptive bern kernel
-  rk_update_WADG  = device.buildKernelFromSource(src.c_str(), "rk_update_WADG", dgInfo);  
-  rk_update_BB_WADG  = device.buildKernelFromSource(src.c_str(),"rk_update_BB_WADG",dgInfo);
+  rk_update_WADG  = buildKernel(src, "rk_update_WADG");  
+  rk_update_BB_WADG  = buildKernel(src, "rk_update_BB_WADG");
+
+  if (useFaceFlux){
+    rk_flux_faces = buildKernel(src, "rk_flux_faces");
+    rk_surface_faces = buildKernel(src, "rk_surface_faces");
+    rk_surface_bern_faces = buildKernel(src, "rk_surface_bern_faces");
+  }
+
+  if (useBernCodegen){
+    rk_volume_bern_gen  = buildKernel(gen, "rk_volume_bern_gen");
+    rk_surface_bern_gen = buildKernel(gen, "rk_surface_bern_gen");
+    if (KInterior){
+      addKernelDefine("p_INTERIOR",1);
+      rk_surface_bern_gen_interior = buildKernel(gen, "rk_surface_bern_gen");
+      addKernelDefine("p_INTERIOR",0);
+    }
+    if (useBernCodegenUpdate){
+      rk_update_BB_WADG_gen = buildKernel(gen, "rk_update_BB_WADG_gen");
+    }
+  }
+
+  // 16-bit rhsQ/resQ conversions against host references
+  if ((RhsStorage()!=STORAGE_FULL || ResStorage()!=STORAGE_FULL) && GetIntSetting("storage_check", 0)){
+    StorageCheck();
+  }
+
 
- 
   // estimate dt. may wish to replace with trace inequality constant
   dfloat dt = .25/((p_N+1)*(p_N+1)*FscaleMax);
 
@@ -425,7 +753,7 @@ dfloat WaveInitOCCA3d(Mesh *mesh, int KblkVin, int KblkSin,
 }
 
 // compute using quadrature 
-void compute_error(Mesh *mesh, double time, dfloat *Q,
+void compute_error(Mesh *mesh, double time, double *Q,
 		   double(*uexptr)(double,double,double,double),
 		   double &L2err, double &relL2err){
 
@@ -447,7 +775,7 @@ void compute_error(Mesh *mesh, double time, dfloat *Q,
         x += Vq*mesh->x(j,k);
         y += Vq*mesh->y(j,k);
         z += Vq*mesh->z(j,k);
-        uq += Vq*Q[j+p_Np*p_Nfields*k]; // get field value for pressure
+        uq += Vq*Q[j+(dlong) p_Np*p_Nfields*k]; // get field value for pressure
       }
 
       double uex = (*uexptr)(x,y,z,(double)time);
@@ -463,7 +791,7 @@ void compute_error(Mesh *mesh, double time, dfloat *Q,
 }
 
 // used for comparing the results of WADG and adaptive-BBDG
-void compute_difference_Bern(Mesh *mesh, dfloat *Q, dfloat *P, double &L2error, double &reL2error){
+void compute_difference_Bern(Mesh *mesh, double *Q, double *P, double &L2error, double &reL2error){
 
   //compute error
   L2error = 0.0;
@@ -477,8 +805,8 @@ void compute_difference_Bern(Mesh *mesh, dfloat *Q, dfloat *P, double &L2error,
 
       for(int j=0; j<p_Np;++j){
 	double Vq = mesh->Vq(i,j);
-	uq += Vq * Q[j+p_Np*p_Nfields*k];
-	up += Vq * P[j+p_Np*p_Nfields*k];
+	uq += Vq * Q[j+(dlong) p_Np*p_Nfields*k];
+	up += Vq * P[j+(dlong) p_Np*p_Nfields*k];
       }
       
       double err = uq - up;
@@ -494,13 +822,388 @@ void compute_difference_Bern(Mesh *mesh, dfloat *Q, dfloat *P, double &L2error,
 }
 
 
+// wall clock time in seconds
+static double wallTime(){
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+// run the volume (which = 0), surface (1) or update (2) kernel on the
+// current mesh data the way RK_step launches it; interior is the surface
+// kernel built with p_INTERIOR = 1 for elements 0..KInterior-1
+static void runTuningKernel(Mesh *mesh, int which, occa::kernel &kernel, occa::kernel &interior){
+#if USE_BERN
+  dfloat fdt = 1.f, rka = 1.f, rkb = 1.f;
+  if (which==0){
+    kernel(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_Q, c_rhsQ);
+  }else if (which==1 && useFaceFlux){
+    kernel(mesh->K, c_fgeo, c_mapF, c_faceFlux, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_rhsQ);
+  }else if (which==1){
+    if (KInterior){
+      interior(0, KInterior, c_fgeo, c_Fmask, c_vmapP, c_slice_ids, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL, c_Q, c_rhsQ);
+    }
+    kernel(KInterior, mesh->K, c_fgeo, c_Fmask, c_vmapP, c_slice_ids, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL, c_Q, c_rhsQ);
+  }else{
+    kernel(mesh->K, c_col_id,c_col_val,c_L_id,c_CB,c_ENMT_val,c_ENMT_id,c_ENM_val,c_ENM_id,c_E,c_co, c_ENMT_index,DeviceFloatArg(rka),DeviceFloatArg(rkb),DeviceFloatArg(fdt),c_rhsQ,c_resQ,c_Q);
+  }
+#else
+  if (which==0){
+    kernel(mesh->K, c_vgeo, c_Dr, c_Ds, c_Dt, c_Q, c_rhsQ);
+  }else if (useFaceFlux){
+    kernel(mesh->K, c_fgeo, c_mapF, c_faceFlux, c_LIFT, c_rhsQ);
+  }else{
+    if (KInterior){
+      interior(0, KInterior, c_fgeo, c_Fmask, c_vmapP, c_LIFT, c_Q, c_rhsQ);
+    }
+    kernel(KInterior, mesh->K, c_fgeo, c_Fmask, c_vmapP, c_LIFT, c_Q, c_rhsQ);
+  }
+#endif
+}
+
+#if USE_BERN
+/* Bernstein surface terms of all elements: the interior kernel on
+   0..KInterior-1, then the general one (table or bern_codegen) */
+static void surfaceBern(Mesh *mesh, occa::memory &c_Qs, occa::memory &c_rhs){
+  if (KInterior && useBernCodegen){
+    rk_surface_bern_gen_interior(0, KInterior, c_fgeo, c_Fmask, c_vmapP, c_Qs, c_rhs);
+  }else if (KInterior){
+    rk_surface_bern_interior(0, KInterior, c_fgeo, c_Fmask, c_vmapP, c_slice_ids, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL, c_Qs, c_rhs);
+  }
+  if (useBernCodegen){
+    rk_surface_bern_gen(KInterior, mesh->K, c_fgeo, c_Fmask, c_vmapP, c_Qs, c_rhs);
+  }else{
+    rk_surface_bern(KInterior, mesh->K, c_fgeo, c_Fmask, c_vmapP, c_slice_ids, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL, c_Qs, c_rhs);
+  }
+}
+
+#else
+// nodal surface terms, split the same way (host_kernels or OCCA)
+static void surfaceNodal(Mesh *mesh){
+  if (useHostKernels){
+    const dfloat *fgeo = (dfloat*) c_fgeo.getMemoryHandle();
+    const dlong *vmapP = (dlong*) c_vmapP.getMemoryHandle();
+    const dfloat *Q = (dfloat*) c_Q.getMemoryHandle();
+    dfloat *rhsQ = (dfloat*) c_rhsQ.getMemoryHandle();
+    if (KInterior){
+      host_rk_surface(0, KInterior, 1, fgeo, vmapP, Q, rhsQ);
+    }
+    host_rk_surface(KInterior, mesh->K, 0, fgeo, vmapP, Q, rhsQ);
+    return;
+  }
+  if (KInterior){
+    rk_surface_interior(0, KInterior, c_fgeo, c_Fmask, c_vmapP, c_LIFT, c_Q, c_rhsQ);
+  }
+  rk_surface(KInterior, mesh->K, c_fgeo, c_Fmask, c_vmapP, c_LIFT, c_Q, c_rhsQ);
+}
+#endif
+
+// Sweep KblkV/KblkS/KblkU (same range as runBlkTimings) for the kernels
+// RK_step launches with the current settings, keep the fastest and save it
+// to the tuning database under tunedNames. Block sizes that size no OCCA
+// kernel in this configuration (host_kernels, bern_codegen, the nodal or
+// FQWADG update) are left alone. Must be called after the kernel defines
+// are set and before the kernels are built; uses c_Q/c_rhsQ/c_resQ as
+// scratch.
+void WaveAutotune(Mesh *mesh){
+
+  std::string src = "okl/WaveKernels.okl";
+#if USE_BERN
+#if USE_SLICE_LIFT
+  const char *surfaceName = "rk_surface_bern_slice";
+  int surfaceThreads = p_Nfp;
+  int surfaceShared = 4*p_NfpNfaces + 4*p_Np + 4*p_Nfaces;
+#else
+  const char *surfaceName = "rk_surface_bern";
+  int surfaceThreads = max(p_Np,p_Nfp*p_Nfaces);
+  int surfaceShared = 4*p_Nfp*p_Nfaces + 4*p_Nfaces;
+#endif
+  if (useFaceFlux){
+    surfaceName = "rk_surface_bern_faces";
+    surfaceThreads = max(p_Np,p_Nfp*p_Nfaces);
+    surfaceShared = 4*p_Nfp*p_Nfaces + 4*p_Nfaces;
+  }else if (useBernCodegen){
+    surfaceName = ""; // sized by bern_codegen_block
+  }
+  const char *names[3]   = {useHostKernels || useBernCodegen ? "" : "rk_volume_bern", surfaceName,
+			    useBernCodegenUpdate || waveScheme==SCHEME_FQWADG ? "" : "rk_update_BB_WADG"};
+  int threads[3]         = {p_Np, surfaceThreads, p_NMp};
+  int sharedPerElem[3]   = {4*p_Np + nvgeo, surfaceShared, 2*p_NMp}; // in dfloats
+#else
+  const char *names[3]   = {useHostKernels ? "" : "rk_volume",
+			    useHostKernels ? "" : (useFaceFlux ? "rk_surface_faces" : "rk_surface"),
+			    ""}; // rk_update has a fixed block
+  int threads[3]         = {p_Np, max(p_Np,p_Nfp*p_Nfaces), 0};
+  int sharedPerElem[3]   = {4*p_Np + nvgeo, 2*p_Nfp*p_Nfaces + 3*p_Nfaces, 0}; // in dfloats
+#endif
+  const char *defines[3] = {"p_KblkV", "p_KblkS", "p_KblkU"};
+  int *Kblk[3]           = {&KblkV, &KblkS, &KblkU};
+
+  int maxKblk = GetIntSetting("autotune_max", p_N <= 5 ? 10 : 6);
+  int maxThreads = GetIntSetting("autotune_max_threads", 1024);
+  size_t maxShared = GetIntSetting("autotune_max_shared", 48*1024); // bytes
+  int nstep = GetIntSetting("autotune_steps", 10);
+
+  printf("autotuning block sizes on %s for N = %d, %d elements\n",
+	 getDeviceKey().c_str(), p_N, mesh->K);
+
+  for (int i = 0; i < 3; ++i){
+
+    if (!names[i][0]){
+      printf("  %s: no OCCA kernel launched with it, keeping %d\n", defines[i], *Kblk[i]);
+      continue;
+    }
+    // split_boundary: the interior elements use the p_INTERIOR = 1 build
+    const int split = (i==1 && KInterior && !useFaceFlux);
+
+    int bestKblk = *Kblk[i];
+    double bestTime = 1e30;
+
+    for (int c = 1; c <= min(maxKblk, mesh->K); ++c){
+
+      if (c*threads[i] > maxThreads || c*sharedPerElem[i]*DeviceFloatSize() > maxShared){
+	break;
+      }
+
+      addKernelDefine(defines[i], c);
+      occa::kernel kernel = buildKernel(src, names[i]);
+      occa::kernel interior;
+      if (split){
+	addKernelDefine("p_INTERIOR",1);
+	interior = buildKernel(src, names[i]);
+	addKernelDefine("p_INTERIOR",0);
+      }
+
+      runTuningKernel(mesh, i, kernel, interior); // warm up
+      device.finish();
+      double tstart = wallTime();
+      for (int step = 0; step < nstep; ++step){
+	runTuningKernel(mesh, i, kernel, interior);
+      }
+      device.finish();
+      double elapsed = (wallTime() - tstart)/nstep;
+      kernel.free();
+      if (split){
+	interior.free();
+      }
+
+      printf("  %s: %s = %d, time per call = %g\n", names[i], defines[i], c, elapsed);
+      if (elapsed < bestTime){
+	bestTime = elapsed;
+	bestKblk = c;
+      }
+    }
+
+    *Kblk[i] = bestKblk;
+    addKernelDefine(defines[i], bestKblk);
+    setTunedKblk(tunedNames[i], bestKblk, bestTime);
+    printf("  %s: best %s = %d\n", names[i], defines[i], bestKblk);
+  }
+
+  // the tuned kernels overwrite the solution storage
+  device.finish();
+  dfloat *zeros = (dfloat*) calloc(FieldStorageSize(), sizeof(dfloat));
+  DeviceFloatCopyFrom(c_Q, zeros);
+  free(zeros);
+  FieldStorageZero(c_resQ);
+  FieldStorageZero(c_rhsQ);
+
+  printf("tuned KblkV = %d, KblkS = %d, KblkU = %d saved to %s\n",
+	 KblkV, KblkS, KblkU, getTuningFile().c_str());
+}
+
+/* times the surface kernel used by RK_step and reports its effective
+   bandwidth (traces of both sides, vmapP, fgeo and the rhsQ update), to
+   compare element orders (element_order setting). vmapP, fgeo and rhsQ
+   are counted at their stored size (dlong ids or compact codes, 16-bit
+   rhs_storage) */
+void time_surface(Mesh *mesh){
+
+  int nstep = GetIntSetting("benchmark_steps", 20);
+  double bytes = 2.0*mesh->K*p_Nfaces*p_Nfp*p_Nfields*DeviceFloatSize() +
+    c_vmapP.bytes() + c_fgeo.bytes() + 2.0*c_rhsQ.bytes();
+
+  double elapsed = 0.0;
+  for (int step = -1; step < nstep; ++step){ // step -1 warms up
+    device.finish();
+    double tstart = wallTime();
+#if USE_BERN
+    surfaceBern(mesh, c_Q, c_rhsQ);
+#else
+    surfaceNodal(mesh);
+#endif
+    device.finish();
+    if (step >= 0){
+      elapsed += wallTime() - tstart;
+    }
+  }
+  elapsed /= nstep;
+  printf("surface kernel (element_order = %s, split_boundary = %d): %g s per call, %.2f GB/s effective\n",
+	 GetSetting("element_order", "none").c_str(), GetIntSetting("split_boundary", 0),
+	 elapsed, bytes/elapsed/1e9);
+}
+
+// one Bernstein kernel (0: volume, 1: surface, 2: BB update), table or generated
+static void runBernKernel(Mesh *mesh, int i, int gen, dfloat rka, dfloat rkb, dfloat fdt){
+  if (i==0 && gen){
+    rk_volume_bern_gen(mesh->K, c_vgeo, c_Q, c_rhsQ);
+  }else if (i==0){
+    rk_volume_bern(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_Q, c_rhsQ);
+  }else if (i==1 && gen){
+    rk_surface_bern_gen(0, mesh->K, c_fgeo, c_Fmask, c_vmapP, c_Q, c_rhsQ);
+  }else if (i==1){
+    rk_surface_bern(0, mesh->K, c_fgeo, c_Fmask, c_vmapP, c_slice_ids, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL, c_Q, c_rhsQ);
+  }else if (gen && useBernCodegenUpdate){
+    rk_update_BB_WADG_gen(mesh->K, c_CB, DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt), c_rhsQ, c_resQ, c_Q);
+  }else{
+    rk_update_BB_WADG(mesh->K, c_col_id,c_col_val,c_L_id,c_CB,c_ENMT_val,c_ENMT_id,c_ENM_val,c_ENM_id,c_E,c_co, c_ENMT_index,DeviceFloatArg(rka),DeviceFloatArg(rkb),DeviceFloatArg(fdt),c_rhsQ,c_resQ,c_Q);
+  }
+}
+
+/* times the table-driven Bernstein kernels against the generated ones
+   (bern_codegen) and compares one RK stage (volume, surface, update with
+   rka = 0) of each, starting from the current solution */
+void time_bern_codegen(Mesh *mesh){
+
+  const char *names[3] = {"rk_volume_bern", "rk_surface_bern", "rk_update_BB_WADG"};
+  const int nstep = GetIntSetting("benchmark_steps", 20);
+  const dfloat rka = 0.f, rkb = 1.f, fdt = 1.f;
+  const dlong Ntotal = FieldStorageSize();
+  dfloat *Q0 = (dfloat*) malloc(Ntotal*sizeof(dfloat));
+  dfloat *Qstage[2];
+  double elapsed[2][3] = {{0.0}};
+  DeviceFloatCopyTo(c_Q, Q0);
+
+  for (int gen = 0; gen < 2; ++gen){
+    Qstage[gen] = (dfloat*) malloc(Ntotal*sizeof(dfloat));
+    for (int step = -1; step < nstep; ++step){ // step -1 warms up and is compared
+      DeviceFloatCopyFrom(c_Q, Q0);
+      for (int i = 0; i < 3; ++i){
+	device.finish();
+	double tstart = wallTime();
+	runBernKernel(mesh, i, gen, rka, rkb, fdt);
+	device.finish();
+	if (step >= 0){
+	  elapsed[gen][i] += (wallTime() - tstart)/nstep;
+	}
+      }
+      if (step < 0){
+	DeviceFloatCopyTo(c_Q, Qstage[gen]);
+      }
+    }
+  }
+
+  double diff = 0.0, change = 0.0;
+  for (dlong n = 0; n < Ntotal; ++n){
+    diff = max(diff, (double) fabs(Qstage[1][n] - Qstage[0][n]));
+    change = max(change, (double) fabs(Qstage[0][n] - Q0[n]));
+  }
+  for (int i = 0; i < 3; ++i){
+    printf("bern_codegen %s: table %g s, generated %g s per call (%.2fx)%s\n",
+	   names[i], elapsed[0][i], elapsed[1][i], elapsed[1][i] > 0 ? elapsed[0][i]/elapsed[1][i] : 0.0,
+	   (i==2 && !useBernCodegenUpdate) ? ", both table" : "");
+  }
+  printf("bern_codegen: max difference after one stage %g (max change of Q %g)\n", diff, change);
+
+  DeviceFloatCopyFrom(c_Q, Q0);
+  free(Q0);
+  free(Qstage[0]);
+  free(Qstage[1]);
+}
+
+// volume (0) or nodal surface (1) kernel for time_host_kernels: OCCA or host_kernels
+static void runHostCompareKernel(Mesh *mesh, int i, int host){
+  const dfloat *Q = (dfloat*) c_Q.getMemoryHandle();
+  dfloat *rhsQ = (dfloat*) c_rhsQ.getMemoryHandle();
+#if USE_BERN
+  if (host){
+    host_rk_volume_bern(mesh->K, (dfloat*) c_vgeo.getMemoryHandle(), Q, rhsQ);
+  }else{
+    rk_volume_bern(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_Q, c_rhsQ);
+  }
+#else
+  if (i==0 && host){
+    host_rk_volume(mesh->K, (dfloat*) c_vgeo.getMemoryHandle(), Q, rhsQ);
+  }else if (i==0){
+    rk_volume(mesh->K, c_vgeo, c_Dr, c_Ds, c_Dt, c_Q, c_rhsQ);
+  }else if (host){
+    host_rk_surface(0, mesh->K, 0, (dfloat*) c_fgeo.getMemoryHandle(),
+		    (dlong*) c_vmapP.getMemoryHandle(), Q, rhsQ);
+  }else{
+    rk_surface(0, mesh->K, c_fgeo, c_Fmask, c_vmapP, c_LIFT, c_Q, c_rhsQ);
+  }
+#endif
+}
+
+/* host_kernels against the OCCA kernels of the same backend (Serial or
+   OpenMP): time per call, elements per second per thread, and the largest
+   difference in rhsQ after one volume (+ nodal surface) evaluation */
+void time_host_kernels(Mesh *mesh){
+
+#if USE_BERN
+  const int Nkernels = 1;
+  const char *names[2] = {"rk_volume_bern", ""};
+#else
+  const int Nkernels = 2;
+  const char *names[2] = {"rk_volume", "rk_surface"};
+#endif
+  const int nstep = GetIntSetting("benchmark_steps", 20);
+  const int threads[2] = {device.mode()=="OpenMP" ? omp_get_max_threads() : 1, omp_get_max_threads()};
+  const dlong Ntotal = FieldStorageSize();
+  dfloat *rhs[2];
+  double elapsed[2][2] = {{0.0}};
+
+  for (int host = 0; host < 2; ++host){
+    rhs[host] = (dfloat*) malloc(Ntotal*sizeof(dfloat));
+    for (int step = -1; step < nstep; ++step){ // step -1 warms up and is compared
+      for (int i = 0; i < Nkernels; ++i){
+	device.finish();
+	double tstart = wallTime();
+	runHostCompareKernel(mesh, i, host);
+	device.finish();
+	if (step >= 0){
+	  elapsed[host][i] += (wallTime() - tstart)/nstep;
+	}
+      }
+      if (step < 0){
+	DeviceFloatCopyTo(c_rhsQ, rhs[host]);
+      }
+    }
+  }
+
+  double diff = 0.0, scale = 0.0;
+  for (dlong n = 0; n < Ntotal; ++n){
+    diff = max(diff, (double) fabs(rhs[1][n] - rhs[0][n]));
+    scale = max(scale, (double) fabs(rhs[0][n]));
+  }
+  for (int i = 0; i < Nkernels; ++i){
+    const double perThread[2] = {mesh->K/(elapsed[0][i]*threads[0]), mesh->K/(elapsed[1][i]*threads[1])};
+    printf("host_kernels %s: OCCA %s %g s (%d threads), host %g s (%d threads) per call; "
+	   "%.4g vs %.4g elements/s per thread (%.2fx)\n",
+	   names[i], device.mode().c_str(), elapsed[0][i], threads[0], elapsed[1][i], threads[1],
+	   perThread[0], perThread[1], perThread[1]/perThread[0]);
+  }
+  printf("host_kernels: max difference in rhsQ %g (max |rhsQ| %g)\n", diff, scale);
+
+  free(rhs[0]);
+  free(rhs[1]);
+}
+
 // times planar kernels
 void time_kernels(Mesh *mesh){
 
+  time_surface(mesh);
+  if (useBernCodegen){
+    time_bern_codegen(mesh);
+  }
+  if (useHostKernels){
+    time_host_kernels(mesh);
+  }
+
   double gflops = 0.0;
   double bw = 0.0;
   int nstep = 10;
-  double denom = (double) (nstep * mesh->K * p_Np * p_Nfields); // nstep steps 
+  double denom = (double) nstep * mesh->K * p_Np * p_Nfields; // nstep steps 
   FILE *timingFile = fopen ("blockTimings.txt","a");
 
   timeV = 0.0;
@@ -519,22 +1222,22 @@ void time_kernels(Mesh *mesh){
                    c_Q, c_rhsQ);
     //rk_volume(mesh->K, c_vgeo, c_Dr, c_Ds, c_Dt, c_Q, c_rhsQ);
     device.finish();
-    dfloat elapsedV = occa::toc("volume (bern)",rk_volume_bern, gflops, bw * sizeof(dfloat));
+    dfloat elapsedV = occa::toc("volume (bern)",rk_volume_bern, gflops, bw * DeviceFloatSize());
     
     
     occa::tic("surface (bern))");
-    rk_surface_bern(mesh->K, c_fgeo, c_Fmask, c_vmapP,
+    rk_surface_bern(0, mesh->K, c_fgeo, c_Fmask, c_vmapP,
                     c_slice_ids,c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL,
                     c_Q, c_rhsQ);
     //rk_surface(mesh->K, c_fgeo, c_Fmask, c_vmapP, c_LIFT, c_Q, c_rhsQ);
     device.finish();
-    dfloat elapsedS = occa::toc("surface (bern)",rk_surface_bern, gflops, bw * sizeof(dfloat));
+    dfloat elapsedS = occa::toc("surface (bern)",rk_surface_bern, gflops, bw * DeviceFloatSize());
 
        
     occa::tic("update_WADG (FQWADG)");
-    rk_update_WADG(mesh->K*p_Np*p_Nfields, rka, rkb, fdt, mesh->K, c_VqB, c_Cq, c_PqB, c_rhsQ, c_resQ, c_Q);
+    rk_update_WADG(FieldStorageSize(), DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt), mesh->K, c_VqB, c_Cq, c_PqB, c_rhsQ, c_resQ, c_Q);
     device.finish();
-    dfloat elapsedU = occa::toc("update (FQWADG)",rk_update_WADG, gflops, bw * sizeof(dfloat));
+    dfloat elapsedU = occa::toc("update (FQWADG)",rk_update_WADG, gflops, bw * DeviceFloatSize());
     
     timeV+=elapsedV;
     timeS+=elapsedS;
@@ -566,20 +1269,20 @@ void time_kernels(Mesh *mesh){
                    c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4,
                    c_Q, c_rhsQ);
     device.finish();
-    dfloat elapsedV = occa::toc("volume (bern)",rk_volume_bern, gflops, bw * sizeof(dfloat));
+    dfloat elapsedV = occa::toc("volume (bern)",rk_volume_bern, gflops, bw * DeviceFloatSize());
     
     occa::tic("surface (bern)");
-    rk_surface_bern(mesh->K, c_fgeo, c_Fmask, c_vmapP,
+    rk_surface_bern(0, mesh->K, c_fgeo, c_Fmask, c_vmapP,
                     c_slice_ids,c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL,
                     c_Q, c_rhsQ);
     device.finish();
-    dfloat elapsedS = occa::toc("surface (bern)",rk_surface_bern, gflops, bw * sizeof(dfloat));
+    dfloat elapsedS = occa::toc("surface (bern)",rk_surface_bern, gflops, bw * DeviceFloatSize());
     
     
     occa::tic("update (BBWADG)");
-    rk_update_BB_WADG(mesh->K, c_col_id,c_col_val,c_L_id,c_CB,c_ENMT_val,c_ENMT_id,c_ENM_val,c_ENM_id,c_E,c_co, c_ENMT_index,rka,rkb,fdt,c_rhsQ,c_resQ,c_Q);
+    rk_update_BB_WADG(mesh->K, c_col_id,c_col_val,c_L_id,c_CB,c_ENMT_val,c_ENMT_id,c_ENM_val,c_ENM_id,c_E,c_co, c_ENMT_index,DeviceFloatArg(rka),DeviceFloatArg(rkb),DeviceFloatArg(fdt),c_rhsQ,c_resQ,c_Q);
     device.finish();
-    dfloat elapsedU = occa::toc("update (BBWADG)", rk_update_BB_WADG, gflops, bw * sizeof(dfloat));
+    dfloat elapsedU = occa::toc("update (BBWADG)", rk_update_BB_WADG, gflops, bw * DeviceFloatSize());
   
         
     timeV+=elapsedV;
@@ -623,8 +1326,8 @@ void Wave_RK_sample_error(Mesh *mesh, dfloat FinalTime, dfloat dt,
 
   // for sampling L2 error in time
   FILE *L2errFile = fopen ("longTimeL2err.txt","w");
-  dfloat *Q = (dfloat*) calloc(p_Nfields*mesh->K*p_Np, sizeof(dfloat));   // 4 fields
-  dfloat *P = (dfloat*) calloc(p_Nfields*mesh->K*p_Np, sizeof(dfloat));
+  double *Q = (double*) calloc((dlong) p_Nfields*mesh->K*p_Np, sizeof(double));   // 4 fields
+  double *P = (double*) calloc((dlong) p_Nfields*mesh->K*p_Np, sizeof(double));
   /* outer time step loop  */
   while (time<FinalTime){
 #if 1
@@ -647,9 +1350,9 @@ void Wave_RK_sample_error(Mesh *mesh, dfloat FinalTime, dfloat dt,
     for (INTRK=1; INTRK<=5; ++INTRK) {
 
       // compute DG rhs
-      const dfloat fdt = dt;
-      const dfloat fa = (float)mesh->rk4a[INTRK-1];
-      const dfloat fb = (float)mesh->rk4b[INTRK-1];
+      const double fdt = dt;
+      const double fa = mesh->rk4a[INTRK-1];
+      const double fb = mesh->rk4b[INTRK-1];
 
       if (tstep==0 && INTRK==1){
         printf("running regular kernel\n\n");
@@ -692,14 +1395,18 @@ void Wave_RK(Mesh *mesh, dfloat FinalTime, dfloat dt){
     /* adjust final step to end exactly at FinalTime */
     if (time+dt > FinalTime) { dt = FinalTime-time; }
 
-    for (INTRK=1; INTRK<=5; ++INTRK) {
+    if (useTemporalBlocking){
+      RK_step_temporal(mesh, dt);
+    }else{
+      for (INTRK=1; INTRK<=5; ++INTRK) {
 
-      // compute DG rhs
-      const dfloat fdt = dt;
-      const dfloat fa = (float)mesh->rk4a[INTRK-1];
-      const dfloat fb = (float)mesh->rk4b[INTRK-1];
+	// compute DG rhs
+	const double fdt = dt;
+	const double fa = mesh->rk4a[INTRK-1];
+	const double fb = mesh->rk4b[INTRK-1];
 
-      RK_step(mesh, fa, fb, fdt);
+	RK_step(mesh, fa, fb, fdt);
+      }
     }
 
     time += dt;     /* increment current time */
@@ -708,35 +1415,113 @@ void Wave_RK(Mesh *mesh, dfloat FinalTime, dfloat dt){
   }
 }
 
-void RK_step(Mesh *mesh, dfloat rka, dfloat rkb, dfloat fdt){
+// all five LSRK stages of one step in sweeps of useTemporalBlocking stages (host, nodal)
+void RK_step_temporal(Mesh *mesh, double fdt){
+
+  for (int s0 = 0; s0 < 5; s0 += useTemporalBlocking){
+    const int ns = min(useTemporalBlocking, 5 - s0);
+    host_rk_stages_temporal(mesh->K, (dfloat*) c_vgeo.getMemoryHandle(), (dfloat*) c_fgeo.getMemoryHandle(),
+			    mesh->rk4a, mesh->rk4b, s0, ns, fdt,
+			    (dfloat*) c_Q.getMemoryHandle(), (dfloat*) c_resQ.getMemoryHandle(),
+			    (dfloat*) c_Qnext.getMemoryHandle(), (dfloat*) c_resQnext.getMemoryHandle());
+
+    occa::memory c_tmp = c_Q;
+    c_Q = c_Qnext;
+    c_Qnext = c_tmp;
+    c_tmp = c_resQ;
+    c_resQ = c_resQnext;
+    c_resQnext = c_tmp;
+  }
+}
+
+void RK_step(Mesh *mesh, double rka, double rkb, double fdt){
 
   double gflops = 0.0;
   double bw = 0.0;
   int K = mesh->K;
   
 #if USE_BERN
-  rk_volume_bern(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_Q, c_rhsQ);
-  rk_surface_bern(mesh->K, c_fgeo, c_Fmask, c_vmapP, c_slice_ids, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL, c_Q, c_rhsQ);
-  rk_update_BB_WADG(mesh->K, c_col_id,c_col_val,c_L_id,c_CB,c_ENMT_val,c_ENMT_id,c_ENM_val,c_ENM_id,c_E,c_co, c_ENMT_index,rka,rkb,fdt,c_rhsQ,c_resQ,c_Q);
-  
-  int Ntotal = p_Nfields*p_Np*mesh->K;
-  rk_volume_bern(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_P, c_rhsP);
-  rk_surface_bern(mesh->K, c_fgeo, c_Fmask, c_vmapP, c_slice_ids, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL, c_P, c_rhsP);
-  rk_update_WADG(Ntotal, rka, rkb, fdt, mesh->K, c_VqB, c_Cq, c_PqB, c_rhsP, c_resP, c_P);
+  dlong Ntotal = FieldStorageSize();
+
+  // c_Q: BBWADG (or FQWADG if that is the only scheme being run)
+  if (useHostKernels){
+    host_rk_volume_bern(mesh->K, (dfloat*) c_vgeo.getMemoryHandle(),
+			(dfloat*) c_Q.getMemoryHandle(), (dfloat*) c_rhsQ.getMemoryHandle());
+  }else if (useBernCodegen){
+    rk_volume_bern_gen(mesh->K, c_vgeo, c_Q, c_rhsQ);
+  }else{
+    rk_volume_bern(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_Q, c_rhsQ);
+  }
+  if (useFaceFlux){
+    rk_flux_faces(NfacesUnique, c_faceOwners, c_fgeo, c_Fmask, c_vmapP, c_Q, c_faceFlux);
+    rk_surface_bern_faces(mesh->K, c_fgeo, c_mapF, c_faceFlux, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_rhsQ);
+  }else{
+    surfaceBern(mesh, c_Q, c_rhsQ);
+  }
+  if (waveScheme==SCHEME_FQWADG){
+    rk_update_WADG(Ntotal, DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt), mesh->K, c_VqB, c_Cq, c_PqB, c_rhsQ, c_resQ, c_Q);
+  }else if (useBernCodegenUpdate){
+    rk_update_BB_WADG_gen(mesh->K, c_CB, DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt), c_rhsQ, c_resQ, c_Q);
+  }else{
+    rk_update_BB_WADG(mesh->K, c_col_id,c_col_val,c_L_id,c_CB,c_ENMT_val,c_ENMT_id,c_ENM_val,c_ENM_id,c_E,c_co, c_ENMT_index,DeviceFloatArg(rka),DeviceFloatArg(rkb),DeviceFloatArg(fdt),c_rhsQ,c_resQ,c_Q);
+  }
 
+  // c_P: full-quadrature WADG on a second stream for comparison
+  if (waveScheme==SCHEME_COMPARE){
+    device.setStream(streamP);
+    if (useHostKernels){
+      host_rk_volume_bern(mesh->K, (dfloat*) c_vgeo.getMemoryHandle(),
+			  (dfloat*) c_P.getMemoryHandle(), (dfloat*) c_rhsP.getMemoryHandle());
+    }else if (useBernCodegen){
+      rk_volume_bern_gen(mesh->K, c_vgeo, c_P, c_rhsP);
+    }else{
+      rk_volume_bern(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_P, c_rhsP);
+    }
+    if (useFaceFlux){
+      rk_flux_faces(NfacesUnique, c_faceOwners, c_fgeo, c_Fmask, c_vmapP, c_P, c_faceFluxP);
+      rk_surface_bern_faces(mesh->K, c_fgeo, c_mapF, c_faceFluxP, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_rhsP);
+    }else{
+      surfaceBern(mesh, c_P, c_rhsP);
+    }
+    rk_update_WADG(Ntotal, DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt), mesh->K, c_VqB, c_Cq, c_PqB, c_rhsP, c_resP, c_P);
+    device.setStream(streamQ);
+  }
   
 #else
   
-  int Ntotal = p_Nfields*p_Np*mesh->K;
-  rk_volume(mesh->K, c_vgeo, c_Dr, c_Ds, c_Dt, c_Q, c_rhsQ);
-  rk_surface(mesh->K, c_fgeo, c_Fmask, c_vmapP, c_LIFT, c_Q, c_rhsQ);
-  rk_update(Ntotal, rka, rkb, fdt, c_rhsQ, c_resQ, c_Q);
+  dlong Ntotal = FieldStorageSize();
+  if (useFusedStage){
+    host_rk_stage_fused(mesh->K, (dfloat*) c_vgeo.getMemoryHandle(), (dfloat*) c_fgeo.getMemoryHandle(),
+			(dlong*) c_vmapP.getMemoryHandle(), rka, rkb, fdt,
+			(dfloat*) c_Q.getMemoryHandle(), (dfloat*) c_resQ.getMemoryHandle(),
+			(dfloat*) c_Qnext.getMemoryHandle());
+    occa::memory c_tmp = c_Q;
+    c_Q = c_Qnext;
+    c_Qnext = c_tmp;
+    return;
+  }
+  if (useHostKernels){
+    // host backends: OCCA buffers are plain host arrays
+    const dfloat *Q = (dfloat*) c_Q.getMemoryHandle();
+    dfloat *rhsQ = (dfloat*) c_rhsQ.getMemoryHandle();
+    host_rk_volume(mesh->K, (dfloat*) c_vgeo.getMemoryHandle(), Q, rhsQ);
+    surfaceNodal(mesh);
+  }else{
+    rk_volume(mesh->K, c_vgeo, c_Dr, c_Ds, c_Dt, c_Q, c_rhsQ);
+    if (useFaceFlux){
+      rk_flux_faces(NfacesUnique, c_faceOwners, c_fgeo, c_Fmask, c_vmapP, c_Q, c_faceFlux);
+      rk_surface_faces(mesh->K, c_fgeo, c_mapF, c_faceFlux, c_LIFT, c_rhsQ);
+    }else{
+      surfaceNodal(mesh);
+    }
+  }
+  rk_update(Ntotal, DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt), c_rhsQ, c_resQ, c_Q);
   
 #endif
  
 #if 0
-  dfloat *f_Q = (dfloat*) calloc(p_Nfields*mesh->K*p_Np, sizeof(dfloat));
-  c_Q.copyTo(f_Q);
+  dfloat *f_Q = (dfloat*) calloc((dlong) p_Nfields*mesh->K*p_Np, sizeof(dfloat));
+  DeviceFloatCopyTo(c_Q, f_Q);
   for(int fld = 0; fld < p_Nfields; ++fld){
     printf("Field solution is %d: \n",fld);
     for(int i = 0; i < p_Np; ++i){
@@ -752,14 +1537,14 @@ void RK_step(Mesh *mesh, dfloat rka, dfloat rkb, dfloat fdt){
 
 
 // set initial condition using interpolation
-void WaveSetU0(Mesh *mesh, dfloat *Q, dfloat *P, dfloat time,
+void WaveSetU0(Mesh *mesh, double *Q, double *P, double time,
 	       double(*uexptr)(double,double,double,double)){
 
   // write out field = fields 2-4 = 0 (velocity)
   for(int k = 0; k < mesh->K; ++k){
     // store local interpolant
-    dfloat *Qloc = BuildVector(p_Np);
-    dfloat *Ploc = BuildVector(p_Np);
+    double *Qloc = (double*) calloc(p_Np, sizeof(double));
+    double *Ploc = (double*) calloc(p_Np, sizeof(double));
     for(int i = 0; i < p_Np; ++i){
       double x = mesh->x(i,k);
       double y = mesh->y(i,k);
@@ -770,11 +1555,11 @@ void WaveSetU0(Mesh *mesh, dfloat *Q, dfloat *P, dfloat time,
 
 #if USE_BERN // convert nodal values to bernstein coefficients
 
-    dfloat *Qtmp = BuildVector(p_Np);
-    dfloat *Ptmp = BuildVector(p_Np);
+    double *Qtmp = (double*) calloc(p_Np, sizeof(double));
+    double *Ptmp = (double*) calloc(p_Np, sizeof(double));
       for (int i = 0; i < p_Np; ++i){
-      Qtmp[i] = 0.f;
-      Ptmp[i] = 0.f;
+      Qtmp[i] = 0.0;
+      Ptmp[i] = 0.0;
       for (int j = 0; j < p_Np; ++j){
 	Qtmp[i] += mesh->invVB(i,j)*Qloc[j];
 	Ptmp[i] += mesh->invVB(i,j)*Ploc[j];
@@ -788,7 +1573,7 @@ void WaveSetU0(Mesh *mesh, dfloat *Q, dfloat *P, dfloat time,
 #endif
 
     for (int i = 0; i < p_Np; ++i){
-      int id = k*p_Np*p_Nfields + i;
+      dlong id = (dlong) k*p_Np*p_Nfields + i;
       // set pressure by value of CavitySolution
       Q[id] = Qloc[i]; P[id] = Ploc[i];  id += p_Np;
       // set velocity to be all zeros
@@ -800,13 +1585,14 @@ void WaveSetU0(Mesh *mesh, dfloat *Q, dfloat *P, dfloat time,
 }
 
 // set initial condition using L2 projection
-void WaveProjectU0(Mesh *mesh, dfloat *Q, dfloat time,
+void WaveProjectU0(Mesh *mesh, double *Q, double time,
 		   double(*uexptr)(double,double,double,double)){
 
   int Nq = mesh->Nq;
   VectorXd wq = mesh->wq;
   MatrixXd Vq = mesh->Vq;
   MatrixXd Qloc(p_Np,1);
+  VectorXd xq(Nq), yq(Nq), zq(Nq);
 
   // write out field = fields 2-4 = 0 (velocity)
   for(int k = 0; k < mesh->K; ++k){
@@ -816,12 +1602,10 @@ void WaveProjectU0(Mesh *mesh, dfloat *Q, dfloat time,
     MatrixXd Mloc = Vq.transpose() * wq.asDiagonal() * J * Vq;
 
     // compute fxn at quad nodes
+    QuadratureNodes(mesh, k, xq, yq, zq);
     MatrixXd uq(Nq,1);
     for (int i = 0; i < Nq; ++i){
-      double xq = mesh->xq(i,k);
-      double yq = mesh->yq(i,k);
-      double zq = mesh->zq(i,k);
-      double uqi = (*uexptr)(xq,yq,zq,0.0);
+      double uqi = (*uexptr)(xq(i),yq(i),zq(i),0.0);
       uq(i,0) = uqi*wq(i)*J;
     }
     MatrixXd b = mesh->Vq.transpose() * uq;
@@ -835,7 +1619,7 @@ void WaveProjectU0(Mesh *mesh, dfloat *Q, dfloat time,
 
     // set pressure
     for (int i = 0; i < p_Np; ++i){
-      int id = k*p_Np*p_Nfields + i;
+      dlong id = (dlong) k*p_Np*p_Nfields + i;
       Q[id] = Qloc(i,0); id += p_Np;
       Q[id] = 0.f;       id += p_Np;
       Q[id] = 0.f;       id += p_Np;
@@ -846,33 +1630,61 @@ void WaveProjectU0(Mesh *mesh, dfloat *Q, dfloat time,
 }
 
 
-void WaveSetData3d(dfloat *Q, dfloat *P){
-  c_Q.copyFrom(Q);
-  c_P.copyFrom(P);
+void WaveSetData3d(double *Q, double *P){
+  if (FieldLayout()==LAYOUT_ELEMENT){
+    DeviceFloatCopyFrom(c_Q, Q);
+    if (waveScheme==SCHEME_COMPARE){
+      DeviceFloatCopyFrom(c_P, P);
+    }
+    return;
+  }
+  // reorder into the device field layout
+  double *Qdev = (double*) malloc(FieldStorageSize()*sizeof(double));
+  FieldsToDevice(Q, Qdev);
+  DeviceFloatCopyFrom(c_Q, Qdev);
+  if (waveScheme==SCHEME_COMPARE){
+    FieldsToDevice(P, Qdev);
+    DeviceFloatCopyFrom(c_P, Qdev);
+  }
+  free(Qdev);
 }
 
 
-void WaveGetData3d(Mesh *mesh, dfloat *Q, dfloat *P){//dfloat *d_p, dfloat *d_fp, dfloat *d_fdpdn){
+void WaveGetData3d(Mesh *mesh, double *Q, double *P){//dfloat *d_p, dfloat *d_fp, dfloat *d_fdpdn){
 
-  c_Q.copyTo(Q);
-  c_P.copyTo(P);
+  WaveFinish();
+  if (FieldLayout()==LAYOUT_ELEMENT){
+    DeviceFloatCopyTo(c_Q, Q);
+    if (waveScheme==SCHEME_COMPARE){
+      DeviceFloatCopyTo(c_P, P);
+    }
+  }else{
+    double *Qdev = (double*) malloc(FieldStorageSize()*sizeof(double));
+    DeviceFloatCopyTo(c_Q, Qdev);
+    FieldsFromDevice(Qdev, Q);
+    if (waveScheme==SCHEME_COMPARE){
+      DeviceFloatCopyTo(c_P, Qdev);
+      FieldsFromDevice(Qdev, P);
+    }
+    free(Qdev);
+  }
 
 #if USE_BERN // convert back to nodal representation for L2 error, etc
-  dfloat *Qtmp = BuildVector(p_Np);
-  dfloat *Ptmp = BuildVector(p_Np);
+  double *Qtmp = (double*) calloc(p_Np, sizeof(double));
+  double *Ptmp = (double*) calloc(p_Np, sizeof(double));
   for (int fld = 0; fld < p_Nfields; fld++){
     for (int e = 0; e < mesh->K; ++e){
       for (int i = 0; i < p_Np; ++i){
 	Qtmp[i] = 0.f;
 	Ptmp[i] = 0.f;
 	for (int j = 0; j < p_Np; ++j){
-	  int id = j + fld*p_Np + e*p_Nfields*p_Np;
+	  dlong id = j + fld*p_Np + (dlong) e*p_Nfields*p_Np;
 	  Qtmp[i] += mesh->VB(i,j)*Q[id];
 	  Ptmp[i] += mesh->VB(i,j)*P[id];
 	}
       }
       for (int i = 0; i < p_Np; ++i){
-	int id = i + fld*p_Np + e*p_Nfields*p_Np;
+	dlong id = i + fld*p_Np + (dlong) e*p_Nfields*p_Np;
 	Q[id] = Qtmp[i];
 	P[id] = Ptmp[i];
       }
@@ -956,7 +1768,7 @@ void writeVisToGMSH(string fileName, Mesh *mesh, dfloat *Q, int iField, int Nfie
   for(int k=0; k<K; k++){
     *posFile << mesh->EToGmshE(k) << " " << p_Np;
     for(int i=0; i<p_Np; i++)
-      *posFile << " " << Q[i + iField*p_Np + k*p_Np*Nfields];
+      *posFile << " " << Q[i + iField*p_Np + (dlong) k*p_Np*Nfields];
     *posFile << endl;
   }
   *posFile << "$EndElementNodeData" << endl;
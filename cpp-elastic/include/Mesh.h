@@ -5,10 +5,12 @@
 
 #include "Basis.h"
 
-// default order
-#ifndef p_N
-#define p_N 6
+// polynomial order, chosen at run time (setting "N", default from make N=...).
+// Kernels are still JIT-specialized on it through the kernel defines.
+#ifndef p_N_DEFAULT
+#define p_N_DEFAULT 6
 #endif
+extern int p_N;
 
 
 
@@ -46,7 +48,13 @@ typedef struct foo {
   int **EToE; /* element to neighbor element (elements numbered by their proc) */
   int **EToF; /* element to neighbor face    (element local number 0,1,2) */
 
+  int NfacesUnique;   /* number of unique faces */
+  int *faceOwners;    /* k*Nfaces + f of each unique face, owned by the lower numbered element */
+  int NfacesBoundary; /* number of boundary faces */
+  int *boundaryFaces; /* k*Nfaces + f of each boundary face */
+
   VectorXi EToGmshE;
+  VectorXi ETag; /* physical tag of each element (0 if none) */
 
   int *bcflag; /* vector. entry n is 1 if vertex n is on a boundary */
 
@@ -61,6 +69,7 @@ typedef struct foo {
   //MatrixXi Fmask;
   int   **FmaskC; /* face node numbers in element volume data */
   MatrixXi Fmask;
+  MatrixXi FPerm; // face node permutations between neighboring faces (BuildFacePermutations)
   MatrixXi faceVolPerm  ; // permutation of f=0 lift matrix rows for f = 1,2,3
   VectorXd r,s,t;
 
@@ -80,13 +89,13 @@ typedef struct foo {
 
   // sparse bernstein arrays
   int **D1_ids, **D2_ids, **D3_ids, **D4_ids;
-  dfloat **D_vals;
+  MatrixXd D_vals;
 
   // decomposition of BB lift operator
-  dfloat **EEL_vals;
+  MatrixXd EEL_vals;
   int **EEL_ids;
   int EEL_nnz, L0_nnz; // max number of nonzeros in EEL scaled degree elevation matrix
-  dfloat **L0_vals;   // decomposition of lift operator - small Nfp/Nfp matrix
+  MatrixXd L0_vals;   // decomposition of lift operator - small Nfp/Nfp matrix
   int **L0_ids;
   VectorXd cEL;
 
@@ -120,11 +129,11 @@ typedef struct foo {
 
 
   // DG STUFF (EXPERIMENTAL)
-  int *mapM,  *mapP; // face node id of +/- nodes (used in mesh connectivity)
-  int *vmapM, *vmapP; // volume id of -/+ ve trace of face node
+  dlong *mapM, *mapP; // face node id of +/- nodes (used in mesh connectivity)
+  dlong *vmapM, *vmapP; // volume id of -/+ ve trace of face node
 
   // time stepping constants
-  dfloat *rk4a, *rk4b, *rk4c;
+  double *rk4a, *rk4b, *rk4c;
 
   //Vector that stores the best approximation degree of c^2 function w.r.t BB basis
   MatrixXi m1;
@@ -12,6 +12,14 @@ using namespace std;
 
 //#define MPI_DFLOAT MPI_FLOAT
 
+// global dof index (k*p_Np*p_Nfields + n, vmapM/vmapP). 32-bit unless
+// built with DLONG=1, which is needed from 2^31 dofs on
+#if USE_DLONG
+#define dlong long
+#else
+#define dlong int
+#endif
+
 // dfloat matrix with eigen
 #define MatrixXdf Matrix<dfloat,Dynamic,Dynamic>
 
@@ -5,6 +5,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <ctype.h>
+#include <map>
+#include <string>
+#include <sstream>
 
 #include "dfloat.h"
 
@@ -25,8 +29,14 @@ int     *DestroyIntVector(int *);
 void PrintMatrix(char *message, dfloat **A, int Nrows, int Ncols);
 void SaveMatrix(char *filename, dfloat **A, int Nrows, int Ncols);
 
+/* runtime settings (setup file + BBWADG_<KEY> environment overrides) */
+void ReadSettings(const char *filename);
+string GetSetting(const char *key, const char *defaultVal);
+int GetIntSetting(const char *key, int defaultVal);
+
 /* geometric/mesh functions */
 Mesh *ReadGmsh3d(char *filename);
+void ReadGmshFile(const char *filename, Mesh *mesh, double **VX, double **VY, double **VZ);
 
 void PrintMesh ( Mesh *mesh );
 
@@ -43,7 +53,12 @@ void GeometricFactors3d(Mesh *mesh, int k,
 // start up
 void StartUp3d(Mesh *mesh);
 void BuildMaps3d(Mesh *mesh);
+void BuildFacePermutations(Mesh *mesh, VectorXd r, VectorXd s, VectorXd t);
+int FaceOrientation(Mesh *mesh, int k, int f);
+dlong *BuildCompactConnectivity(Mesh *mesh);
 void FacePair3d(Mesh *mesh);
+void BuildFaceLists(Mesh *mesh);
+int ReorderElements(Mesh *mesh);
 
 void projection_nodal(Mesh *mesh);
 void AdaptiveM(Mesh *mesh,double(*c2_ptr)(double,double,double));
@@ -51,35 +66,98 @@ void BB_mult(Mesh *mesh);
 void BB_projection(Mesh *mesh);
 
 // set initial condition
-void WaveSetU0(Mesh *mesh, dfloat *Q, dfloat time, int field,
+void WaveSetU0(Mesh *mesh, double *Q, double time, int field,
 	       double(*uexptr)(double,double,double,double));
-void WaveSetU0P0(Mesh *mesh, dfloat *Q, dfloat *P, dfloat time, int field,
+void WaveSetU0P0(Mesh *mesh, double *Q, double *P, double time, int field,
 		 double(*uexptr)(double,double,double,double));
 
-void WaveSetData3d(dfloat *Q, dfloat *P);
-void WaveGetData3d(Mesh *mesh, dfloat *Q, dfloat *P);
+void WaveSetData3d(double *Q, double *P);
+void WaveGetData3d(Mesh *mesh, double *Q, double *P);
 
 // solver
+void SetupOpenMP(char **argv);
+void SetupOccaDevice();
+
+// kernel defines + cached kernel builds (KernelCache.cpp)
+void setKernelDefine(string name, string value);
+template <typename T>
+void addKernelDefine(string name, const T &value){
+  std::stringstream ss;
+  ss << value;
+  setKernelDefine(name, ss.str());
+}
+string getKernelDefines();
+string getKernelCacheDir();
+int haveKernelSource(string file);
+occa::kernel buildKernel(string file, string kernelName);
+unsigned long long hashString(const string &str, unsigned long long h);
+void makeDirectory(string dir);
+
+// preprocessed mesh cache (MeshCache.cpp)
+Mesh *ReadMeshCached(char *filename);
+int MeshCacheGet(const char *name, void *data, size_t bytes);
+void *MeshCacheMap(const char *name, size_t bytes);
+void MeshCacheAdd(const char *name, const void *data, size_t bytes);
+int MeshCacheGetMatrix(const char *name, MatrixXd &A);
+void MeshCacheAddMatrix(const char *name, const MatrixXd &A);
+void MeshCacheClose(Mesh *mesh);
+
+// reference-element operator cache (OperatorCache.cpp)
+void OperatorCacheField(const char *name, MatrixXd &A);
+void OperatorCacheField(const char *name, MatrixXi &A);
+void OperatorCacheField(const char *name, VectorXd &A);
+void OperatorCacheField(const char *name, VectorXi &A);
+void OperatorCacheField(const char *name, int &a);
+void OperatorCacheField(const char *name, int **&A, int rows, int cols);
+void CachedOperators(const char *group, Mesh *mesh,
+		     void (*build)(Mesh*), void (*fields)(Mesh*));
+
+// host memory reporting and lean mesh mode (HostMemory.cpp)
+int LeanMesh();
+void QuadratureNodes(Mesh *mesh, int k, VectorXd &xq, VectorXd &yq, VectorXd &zq);
+void ReleaseHostArrays(Mesh *mesh);
+void ReportHostMemory(const char *stage);
+
+// kernel block size tuning database (KernelCache.cpp)
+string getTuningFile();
+string getDeviceKey();
+int getTunedKblk(string kernelName, int defaultKblk);
+void setTunedKblk(string kernelName, int Kblk, double time);
+
+// time-stepping schemes (setting "scheme" = bbwadg, fqwadg or compare).
+// BBWADG and FQWADG advance c_Q only; compare also advances c_P with FQWADG
+#define SCHEME_BBWADG  0
+#define SCHEME_FQWADG  1
+#define SCHEME_COMPARE 2
+extern int waveScheme;
+int GetSchemeSetting();
+void WaveFinish();
 void test_kernels(Mesh *mesh);
 void time_kernels(Mesh *mesh);
+void WaveAutotune(Mesh *mesh);
 void time_curved_kernels(Mesh *mesh,int nsteps);
 void Wave_RK(Mesh *mesh, dfloat FinalTime, dfloat dt, int useWADG);
 void time_kernels_elas(Mesh *mesh);
+void time_host_kernels(Mesh *mesh);
 // for BB vs NDG stability (paper result only)
 void Wave_RK_sample_error(Mesh *mesh, dfloat FinalTime, dfloat dt,
                           double(*uexptr)(double,double,double,double));
 
-void RK_step(Mesh *mesh, dfloat rka, dfloat rkb, dfloat fdt);
-void compute_error(Mesh *mesh, double time, dfloat *Q,
+void RK_step(Mesh *mesh, double rka, double rkb, double fdt);
+void compute_error(Mesh *mesh, double time, double *Q,
 		   double(*uexptr)(double,double,double,double),
 		   double &L2err, double &relL2err);
-void compute_error_adaptive(Mesh *mesh, dfloat *Q, dfloat *P, double &L2error,double &reL2error);
+void compute_error_adaptive(Mesh *mesh, double *Q, double *P, double &L2error,double &reL2error);
 // planar elements + heterogeneous media
-void RK_step_WADG_subelem(Mesh *mesh, dfloat rka, dfloat rkb, dfloat fdt, dfloat time);
+void RK_step_WADG_subelem(Mesh *mesh, double rka, double rkb, double fdt, double time);
+
+// native CPU kernels (HostKernels.cpp)
+void HostKernelsInit(Mesh *mesh);
+void host_rk_volume_bern_elas(int K, const dfloat *vgeo, const dfloat *Q, dfloat *rhsQ);
 
 // curvilinear and WADG-based
 void InitQuadratureArrays(Mesh *mesh);
-void WaveProjectU0(Mesh *mesh, dfloat *Q, dfloat time,int field,
+void WaveProjectU0(Mesh *mesh, double *Q, double time,int field,
 		   double(*uexptr)(double,double,double,double));
 
 void BuildFaceNodeMaps(Mesh *mesh, MatrixXd xf, MatrixXd yf, MatrixXd zf,
@@ -92,12 +170,40 @@ void checkCurvedGeo(Mesh *mesh);
 void RK_step_WADG(Mesh *mesh, dfloat rka, dfloat rkb, dfloat fdt);
 
 void test_RK(Mesh *mesh, int KblkU);
+// device precision (Precision.cpp, setting "precision")
+#define PRECISION_SINGLE 0
+#define PRECISION_MIXED  1
+#define PRECISION_DOUBLE 2
+int DevicePrecision();
+size_t DeviceFloatSize();
+occa::memory DeviceFloatMalloc(size_t N);
+occa::memory DeviceFloatMalloc(size_t N, const float *h_a);
+occa::memory DeviceFloatMalloc(size_t N, const double *h_a);
+void DeviceFloatCopyFrom(occa::memory &c_a, const float *h_a);
+void DeviceFloatCopyFrom(occa::memory &c_a, const double *h_a);
+void DeviceFloatCopyTo(occa::memory &c_a, float *h_a);
+void DeviceFloatCopyTo(occa::memory &c_a, double *h_a);
+occa::kernelArg DeviceFloatArg(double a);
+
+// device layout of Q/rhsQ/resQ (FieldLayout.cpp, setting field_layout)
+#define LAYOUT_ELEMENT 0
+#define LAYOUT_FIELD   1
+#define LAYOUT_AOSOA   2
+void FieldLayoutInit(Mesh *mesh);
+int FieldLayout();
+int FieldLanes();
+int FieldLayoutK();
+dlong FieldStorageSize();
+dlong FieldIndex(int k, int fld, int n);
+void FieldsToDevice(const double *Q, double *Qdev);
+void FieldsFromDevice(const double *Qdev, double *Q);
+
 void setOccaArray(MatrixXd A, occa::memory &B); // assumes matrix is double
 void setOccaIntArray(MatrixXi A, occa::memory &B); // assumes matrix is int
 
 // cruft - can remove, but may be useful in future
 void setupCG(Mesh *mesh);
 
-void writeVisToGMSH(string fileName,Mesh *mesh, dfloat *Q, int iField, int Nfields);
+void writeVisToGMSH(string fileName,Mesh *mesh, double *Q, int iField, int Nfields);
 
 #endif
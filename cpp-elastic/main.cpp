@@ -21,10 +21,17 @@ int main(int argc, char **argv){
   Mesh *mesh;
   int k,n, sk=0;
 
-  // read GMSH file
-  mesh = ReadGmsh3d(argv[1]);
+  // OpenMP threads and binding, before any parallel loop
+  SetupOpenMP(argv);
 
-  int KblkV = 1, KblkS = 1, KblkU = 1, KblkQ = 1, KblkQf = 1;
+  // polynomial order
+  p_N = GetIntSetting("N", p_N);
+  printf("N = %d\n", p_N);
+
+  // read GMSH file and find element-element connectivity (or load both from the mesh cache)
+  mesh = ReadMeshCached(argv[1]);
+
+  int KblkV = 0, KblkS = 0, KblkU = 0, KblkQ = 1, KblkQf = 1; // 0 = tuned value (or default)
   if(argc >= 8){
     KblkV = atoi(argv[3]);
     KblkS = atoi(argv[4]);
@@ -33,7 +40,6 @@ int main(int argc, char **argv){
   printf("for N = %d, Kblk (V,S,U) = %d,%d,%d\n",
   	 p_N,KblkV,KblkS,KblkU);
 
-  FacePair3d(mesh);
   StartUp3d(mesh);
 
   printf("%d elements in mesh\n", mesh->K);
@@ -47,21 +53,32 @@ int main(int argc, char **argv){
 
   double (*wptr)(double,double,double) = &WaveWeight;
   
-  AdaptiveM(mesh,wptr);
+  // Bernstein material coefficients (or load them from the mesh cache)
+  if (!(MeshCacheGetMatrix("rho_BB", mesh->rho_BB) &&
+	MeshCacheGetMatrix("lambda_BB", mesh->lambda_BB) &&
+	MeshCacheGetMatrix("mu_BB", mesh->mu_BB))){
+    AdaptiveM(mesh,wptr);
+    MeshCacheAddMatrix("rho_BB", mesh->rho_BB);
+    MeshCacheAddMatrix("lambda_BB", mesh->lambda_BB);
+    MeshCacheAddMatrix("mu_BB", mesh->mu_BB);
+  }
+  MeshCacheClose(mesh);
 
   BB_mult(mesh);
 
   BB_projection(mesh);
 
   InitWADG_subelem(mesh,wptr);
+  ReleaseHostArrays(mesh);
+  ReportHostMemory("setup");
 
   printf("initialized wadg subelem\n");
 
-  //  =========== field storage (dfloat) ===========
+  //  =========== field storage (double, converted to the device precision) ===========
 
   printf("Number of field = %d\n",p_Nfields);
-  dfloat *Q = (dfloat*) calloc(p_Nfields*mesh->K*p_Np, sizeof(dfloat));   // 9 fields
-  dfloat *P = (dfloat*) calloc(p_Nfields*mesh->K*p_Np, sizeof(dfloat));
+  double *Q = (double*) calloc((dlong) p_Nfields*mesh->K*p_Np, sizeof(double));   // 9 fields
+  double *P = (double*) calloc((dlong) p_Nfields*mesh->K*p_Np, sizeof(double));
 
 
   
@@ -77,7 +94,11 @@ int main(int argc, char **argv){
   printf("Loading data onto GPU\n");
   WaveSetData3d(Q,P);
   
-  time_kernels_elas(mesh); return 0;
+  // kernel benchmarks instead of a solve
+  if (GetIntSetting("time_kernels", 0)){
+    time_kernels_elas(mesh);
+    return 0;
+  }
   
   dfloat FinalTime = 1.5;
   if (argc > 2){
@@ -96,10 +117,12 @@ int main(int argc, char **argv){
   printf("Writing data to GMSH\n");
   writeVisToGMSH("meshes/p.msh",mesh,Q,0,p_Nfields);
 
-  double L2err, relL2err;
-  compute_error_adaptive(mesh,Q,P,L2err,relL2err);
+  if (waveScheme==SCHEME_COMPARE){
+    double L2err, relL2err;
+    compute_error_adaptive(mesh,Q,P,L2err,relL2err);
 
-  printf("N = %d, Mesh size = %f, ndofs = %d, L2 error at time %f = %6.6e\n", p_N,mesh->hMax,mesh->K*p_Np,FinalTime,L2err);   
+    printf("N = %d, Mesh size = %f, ndofs = %d, L2 error at time %f = %6.6e\n", p_N,mesh->hMax,mesh->K*p_Np,FinalTime,L2err);   
+  }
 
   /*    
   for(int i = 0; i < p_Np; ++i){
@@ -752,109 +752,102 @@ void GradBernTet(int N, VectorXd r, VectorXd s, VectorXd t,
 
 // ===================== geofacs routines =======================
 
-// (v/s)geofacs = array of volume, surface geofacs
-MatrixXd vgeofacs3d(VectorXd x,VectorXd y,VectorXd z,
-		    MatrixXd Dr,MatrixXd Ds,MatrixXd Dt){
-
-  int Npts = Dr.rows();
-  MatrixXd vgeofacs(Npts,10); // rx,sx,tx,ry,sy,ty,rz,sz,tz,J
-
-  VectorXd xr = Dr*x;  VectorXd xs = Ds*x;  VectorXd xt = Dt*x;
-  VectorXd yr = Dr*y;  VectorXd ys = Ds*y;  VectorXd yt = Dt*y;
-  VectorXd zr = Dr*z;  VectorXd zs = Ds*z;  VectorXd zt = Dt*z;
-
-  VectorXd J =
-    xr.array()*(ys.array()*zt.array()-zs.array()*yt.array()) -
-    yr.array()*(xs.array()*zt.array()-zs.array()*xt.array()) +
-    zr.array()*(xs.array()*yt.array()-ys.array()*xt.array());
-
-  VectorXd rx =  (ys.array()*zt.array() - zs.array()*yt.array())/J.array();
-  VectorXd ry = -(xs.array()*zt.array() - zs.array()*xt.array())/J.array();
-  VectorXd rz =  (xs.array()*yt.array() - ys.array()*xt.array())/J.array();
-  VectorXd sx = -(yr.array()*zt.array() - zr.array()*yt.array())/J.array();
-  VectorXd sy =  (xr.array()*zt.array() - zr.array()*xt.array())/J.array();
-  VectorXd sz = -(xr.array()*yt.array() - yr.array()*xt.array())/J.array();
-  VectorXd tx =  (yr.array()*zs.array() - zr.array()*ys.array())/J.array();
-  VectorXd ty = -(xr.array()*zs.array() - zr.array()*xs.array())/J.array();
-  VectorXd tz =  (xr.array()*ys.array() - yr.array()*xs.array())/J.array();
-
-  vgeofacs.col(0) = rx;
-  vgeofacs.col(1) = sx;
-  vgeofacs.col(2) = tx;
-  vgeofacs.col(3) = ry;
-  vgeofacs.col(4) = sy;
-  vgeofacs.col(5) = ty;
-  vgeofacs.col(6) = rz;
-  vgeofacs.col(7) = sz;
-  vgeofacs.col(8) = tz;
-  vgeofacs.col(9) = J;
-  return vgeofacs;
+// (v/s)geofacs = arrays of volume, surface geofacs, computed for a block of
+// Kb elements (columns e0..e0+Kb-1 of x,y,z) at once and written to columns
+// o0..o0+Kb-1 of the output arrays (o0 = e0 for whole-mesh arrays, 0 for a
+// block buffer). w is a workspace of at least Npts x 9*Kb; callers keep one
+// per thread so the element loops do not allocate.
+
+// xr,xs,xt,yr,ys,yt,zr,zs,zt for the block, stored as column blocks of w
+static void geoDerivatives(const MatrixXd &x, const MatrixXd &y, const MatrixXd &z,
+			   int e0, int Kb,
+			   const MatrixXd &Dr, const MatrixXd &Ds, const MatrixXd &Dt,
+			   MatrixXd &w){
+  const MatrixXd *D[3] = {&Dr, &Ds, &Dt};
+  const MatrixXd *X[3] = {&x, &y, &z};
+  for (int c = 0; c < 3; ++c){
+    for (int d = 0; d < 3; ++d){
+      w.block(0,(3*c+d)*Kb,D[d]->rows(),Kb).noalias() = (*D[d])*X[c]->middleCols(e0,Kb);
+    }
+  }
 }
 
-// D(rst)f = matrix mapping nodal values to derivatives at face cubature points
-MatrixXd sgeofacs3d(VectorXd x,VectorXd y,VectorXd z,
-		    MatrixXd Drf,MatrixXd Dsf,MatrixXd Dtf){
-  MatrixXd vgeo = vgeofacs3d(x,y,z,Drf,Dsf,Dtf);
-  VectorXd rx = vgeo.col(0);
-  VectorXd sx = vgeo.col(1);
-  VectorXd tx = vgeo.col(2);
-  VectorXd ry = vgeo.col(3);
-  VectorXd sy = vgeo.col(4);
-  VectorXd ty = vgeo.col(5);
-  VectorXd rz = vgeo.col(6);
-  VectorXd sz = vgeo.col(7);
-  VectorXd tz = vgeo.col(8);
-  VectorXd J  = vgeo.col(9);
-
-  int Npts = Drf.rows();
-  MatrixXd sgeofacs(Npts,4); // nx,ny,nz,sJ
-
-  int Nfpts = Npts/4; // assume each face has the same quadrature
-  VectorXd nx(Npts);
-  VectorXd ny(Npts);
-  VectorXd nz(Npts);
-  for (int i = 0; i < Nfpts; ++i){
-    // face 1
-    int id = i;
-    nx(id) = -tx(id);
-    ny(id) = -ty(id);
-    nz(id) = -tz(id);
-
-    // face 2
-    id += Nfpts;
-    nx(id) = -sx(id);
-    ny(id) = -sy(id);
-    nz(id) = -sz(id);
-
-    // face 3
-    id += Nfpts;
-    nx(id) = rx(id) + sx(id) + tx(id);
-    ny(id) = ry(id) + sy(id) + ty(id);
-    nz(id) = rz(id) + sz(id) + tz(id);
-
-    // face 4
-    id += Nfpts;
-    nx(id) = -rx(id);
-    ny(id) = -ry(id);
-    nz(id) = -rz(id);
+// rx,sx,tx,ry,sy,ty,rz,sz,tz,J at point i of element e of the block
+static void geoFactors(const MatrixXd &w, int Kb, int i, int e, double *g){
+  const double xr = w(i,0*Kb+e), xs = w(i,1*Kb+e), xt = w(i,2*Kb+e);
+  const double yr = w(i,3*Kb+e), ys = w(i,4*Kb+e), yt = w(i,5*Kb+e);
+  const double zr = w(i,6*Kb+e), zs = w(i,7*Kb+e), zt = w(i,8*Kb+e);
+
+  const double J =
+    xr*(ys*zt-zs*yt) -
+    yr*(xs*zt-zs*xt) +
+    zr*(xs*yt-ys*xt);
+
+  g[0] =  (ys*zt - zs*yt)/J; // rx
+  g[3] = -(xs*zt - zs*xt)/J; // ry
+  g[6] =  (xs*yt - ys*xt)/J; // rz
+  g[1] = -(yr*zt - zr*yt)/J; // sx
+  g[4] =  (xr*zt - zr*xt)/J; // sy
+  g[7] = -(xr*yt - yr*xt)/J; // sz
+  g[2] =  (yr*zs - zr*ys)/J; // tx
+  g[5] = -(xr*zs - zr*xs)/J; // ty
+  g[8] =  (xr*ys - yr*xs)/J; // tz
+  g[9] = J;
+}
+
+// vgeo[0..9] = rx,sx,tx,ry,sy,ty,rz,sz,tz,J at the points of Dr,Ds,Dt
+void vgeofacs3d(const MatrixXd &x, const MatrixXd &y, const MatrixXd &z, int e0, int Kb,
+		const MatrixXd &Dr, const MatrixXd &Ds, const MatrixXd &Dt,
+		MatrixXd &w, MatrixXd *vgeo[10], int o0){
+
+  geoDerivatives(x,y,z,e0,Kb,Dr,Ds,Dt,w);
+
+  const int Npts = Dr.rows();
+  double g[10];
+  for (int e = 0; e < Kb; ++e){
+    for (int i = 0; i < Npts; ++i){
+      geoFactors(w,Kb,i,e,g);
+      for (int c = 0; c < 10; ++c){
+	(*vgeo[c])(i,o0+e) = g[c];
+      }
+    }
   }
-  VectorXd sJ =
-    (nx.array()*nx.array() +
-     ny.array()*ny.array() +
-     nz.array()*nz.array()).array().sqrt();
-
-  // normalize and scale sJ
-  nx.array()/=sJ.array();
-  ny.array()/=sJ.array();
-  nz.array()/=sJ.array();
-  sJ.array() *= J.array();
-
-  sgeofacs.col(0) = nx;
-  sgeofacs.col(1) = ny;
-  sgeofacs.col(2) = nz;
-  sgeofacs.col(3) = sJ;
-  return sgeofacs;
+}
 
+// D(rst)f = matrix mapping nodal values to derivatives at face cubature points
+// sgeo[0..3] = nx,ny,nz,sJ
+void sgeofacs3d(const MatrixXd &x, const MatrixXd &y, const MatrixXd &z, int e0, int Kb,
+		const MatrixXd &Drf, const MatrixXd &Dsf, const MatrixXd &Dtf,
+		MatrixXd &w, MatrixXd *sgeo[4], int o0){
+
+  geoDerivatives(x,y,z,e0,Kb,Drf,Dsf,Dtf,w);
+
+  const int Npts = Drf.rows();
+  const int Nfpts = Npts/4; // assume each face has the same quadrature
+  double g[10];
+  for (int e = 0; e < Kb; ++e){
+    for (int i = 0; i < Npts; ++i){
+      geoFactors(w,Kb,i,e,g);
+      const double rx = g[0], sx = g[1], tx = g[2];
+      const double ry = g[3], sy = g[4], ty = g[5];
+      const double rz = g[6], sz = g[7], tz = g[8];
+
+      double nx, ny, nz;
+      switch(i/Nfpts){
+      case 0: nx = -tx; ny = -ty; nz = -tz; break;
+      case 1: nx = -sx; ny = -sy; nz = -sz; break;
+      case 2: nx = rx + sx + tx; ny = ry + sy + ty; nz = rz + sz + tz; break;
+      default: nx = -rx; ny = -ry; nz = -rz; break;
+      }
+      double sJ = sqrt(nx*nx + ny*ny + nz*nz);
+
+      // normalize and scale sJ
+      (*sgeo[0])(i,o0+e) = nx/sJ;
+      (*sgeo[1])(i,o0+e) = ny/sJ;
+      (*sgeo[2])(i,o0+e) = nz/sJ;
+      (*sgeo[3])(i,o0+e) = sJ*g[9];
+    }
+  }
 }
 
 
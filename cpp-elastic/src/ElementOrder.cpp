@@ -0,0 +1,221 @@
+#include <algorithm>
+#include "fem.h"
+
+/* Element reordering for neighbor locality.
+
+   Gmsh numbers elements in whatever order its mesher produced them, so
+   the neighbor traces gathered through vmapP in the surface kernels come
+   from all over Q. With element_order = hilbert or morton, elements are
+   sorted along a space-filling curve through their centroids (21 bits per
+   coordinate); with element_order = rcm, by reverse Cuthill-McKee on the
+   EToE face graph. Default: none (Gmsh order).
+
+   ReorderElements runs right after FacePair3d, before any node data
+   exists: it permutes EToV, EToE/EToF (renumbering neighbors),
+   EToGmshE, ETag and GX/GY/GZ, and rebuilds the face lists. Everything
+   built later (nodes, maps, geofacs, materials) follows the new order,
+   and EToGmshE keeps the Gmsh element numbers for output. */
+
+#define ORDER_BITS 21
+
+// interleave the bits of X[0..2] (most significant first)
+static unsigned long long interleaveBits(const unsigned int X[3]){
+  unsigned long long key = 0;
+  for (int b = ORDER_BITS-1; b >= 0; --b){
+    for (int i = 0; i < 3; ++i){
+      key = (key << 1) | ((X[i] >> b) & 1);
+    }
+  }
+  return key;
+}
+
+// Hilbert index of X (Skilling's transpose form, then interleaved)
+static unsigned long long hilbertKey(unsigned int X[3]){
+  const unsigned int M = 1u << (ORDER_BITS-1);
+  for (unsigned int Q = M; Q > 1; Q >>= 1){
+    unsigned int P = Q - 1;
+    for (int i = 0; i < 3; ++i){
+      if (X[i] & Q){
+	X[0] ^= P;
+      }else{
+	unsigned int t = (X[0] ^ X[i]) & P;
+	X[0] ^= t;
+	X[i] ^= t;
+      }
+    }
+  }
+  X[1] ^= X[0];
+  X[2] ^= X[1];
+  unsigned int t = 0;
+  for (unsigned int Q = M; Q > 1; Q >>= 1){
+    if (X[2] & Q){
+      t ^= Q - 1;
+    }
+  }
+  for (int i = 0; i < 3; ++i){
+    X[i] ^= t;
+  }
+  return interleaveBits(X);
+}
+
+// order[newk] = old element, sorted by curve index of the centroid
+static void curveOrder(Mesh *mesh, int hilbert, vector<int> &order){
+
+  const int K = mesh->K;
+  VectorXd cx = mesh->GX.rowwise().mean();
+  VectorXd cy = mesh->GY.rowwise().mean();
+  VectorXd cz = mesh->GZ.rowwise().mean();
+  const double x0 = cx.minCoeff(), y0 = cy.minCoeff(), z0 = cz.minCoeff();
+  double L = max(cx.maxCoeff() - x0, max(cy.maxCoeff() - y0, cz.maxCoeff() - z0));
+  const double scale = L > 0 ? ((1u << ORDER_BITS) - 1)/L : 0.0;
+
+  vector<pair<unsigned long long,int> > keys(K);
+#pragma omp parallel for
+  for (int k = 0; k < K; ++k){
+    unsigned int X[3] = {(unsigned int) ((cx(k) - x0)*scale),
+			 (unsigned int) ((cy(k) - y0)*scale),
+			 (unsigned int) ((cz(k) - z0)*scale)};
+    keys[k] = make_pair(hilbert ? hilbertKey(X) : interleaveBits(X), k);
+  }
+  std::sort(keys.begin(), keys.end());
+  for (int k = 0; k < K; ++k){
+    order[k] = keys[k].second;
+  }
+}
+
+static int faceDegree(Mesh *mesh, int k){
+  int d = 0;
+  for (int f = 0; f < mesh->Nfaces; ++f){
+    d += mesh->EToE[k][f]!=k;
+  }
+  return d;
+}
+
+/* breadth first search from start over unvisited elements, neighbors in
+   increasing degree; appends to order and returns the last element */
+static int cuthillMcKee(Mesh *mesh, int start, vector<char> &visited, vector<int> &order){
+  size_t head = order.size();
+  order.push_back(start);
+  visited[start] = 1;
+  while (head < order.size()){
+    int k = order[head++];
+    int nbr[4], Nn = 0;
+    for (int f = 0; f < mesh->Nfaces; ++f){
+      int kP = mesh->EToE[k][f];
+      if (!visited[kP]){
+	visited[kP] = 1;
+	int j = Nn++;
+	for (; j > 0 && faceDegree(mesh, nbr[j-1]) > faceDegree(mesh, kP); --j){
+	  nbr[j] = nbr[j-1];
+	}
+	nbr[j] = kP;
+      }
+    }
+    order.insert(order.end(), nbr, nbr + Nn);
+  }
+  return order.back();
+}
+
+// reverse Cuthill-McKee on the face graph, one connected component at a time
+static void rcmOrder(Mesh *mesh, vector<int> &order){
+
+  const int K = mesh->K;
+  vector<char> visited(K, 0), trial(K, 0);
+  vector<int> component;
+  order.clear();
+  for (int k0 = 0; k0 < K; ++k0){
+    if (visited[k0]){
+      continue;
+    }
+    // start from the far end of a first sweep (pseudo-peripheral element)
+    component.clear();
+    trial = visited;
+    int start = cuthillMcKee(mesh, k0, trial, component);
+    cuthillMcKee(mesh, start, visited, order);
+  }
+  std::reverse(order.begin(), order.end());
+}
+
+// mean and max |k - neighbor| over interior faces
+static void neighborDistance(Mesh *mesh, double &mean, int &maxDist){
+  double sum = 0.0;
+  long count = 0;
+  maxDist = 0;
+  for (int k = 0; k < mesh->K; ++k){
+    for (int f = 0; f < mesh->Nfaces; ++f){
+      int d = abs(mesh->EToE[k][f] - k);
+      if (d){
+	sum += d;
+	++count;
+	maxDist = max(maxDist, d);
+      }
+    }
+  }
+  mean = count ? sum/count : 0.0;
+}
+
+template <class T>
+static void permuteRows(T **A, int K, int cols, const vector<int> &order){
+  vector<T> old(A[0], A[0] + (size_t) K*cols);
+  for (int k = 0; k < K; ++k){
+    for (int c = 0; c < cols; ++c){
+      A[k][c] = old[(size_t) order[k]*cols + c];
+    }
+  }
+}
+
+/* renumber the elements of a freshly read and paired mesh according to the
+   element_order setting; returns 1 if the elements were reordered */
+int ReorderElements(Mesh *mesh){
+
+  string method = GetSetting("element_order", "none");
+  const int K = mesh->K;
+  vector<int> order(K);
+  if (method=="hilbert" || method=="morton"){
+    curveOrder(mesh, method=="hilbert", order);
+  }else if (method=="rcm"){
+    rcmOrder(mesh, order);
+  }else{
+    if (method!="none"){
+      printf("unknown element_order %s, keeping the Gmsh element order\n", method.c_str());
+    }
+    return 0;
+  }
+
+  double meanOld, meanNew;
+  int maxOld, maxNew;
+  neighborDistance(mesh, meanOld, maxOld);
+
+  vector<int> inv(K);
+  for (int k = 0; k < K; ++k){
+    inv[order[k]] = k;
+  }
+
+  permuteRows(mesh->EToV, K, mesh->Nverts, order);
+  permuteRows(mesh->EToF, K, mesh->Nfaces, order);
+  permuteRows(mesh->EToE, K, mesh->Nfaces, order);
+  for (int k = 0; k < K; ++k){
+    for (int f = 0; f < mesh->Nfaces; ++f){
+      mesh->EToE[k][f] = inv[mesh->EToE[k][f]];
+    }
+  }
+
+  VectorXi gmshE = mesh->EToGmshE, tag = mesh->ETag;
+  MatrixXd GX = mesh->GX, GY = mesh->GY, GZ = mesh->GZ;
+  for (int k = 0; k < K; ++k){
+    mesh->EToGmshE(k) = gmshE(order[k]);
+    mesh->ETag(k) = tag(order[k]);
+    mesh->GX.row(k) = GX.row(order[k]);
+    mesh->GY.row(k) = GY.row(order[k]);
+    mesh->GZ.row(k) = GZ.row(order[k]);
+  }
+
+  free(mesh->faceOwners);
+  free(mesh->boundaryFaces);
+  BuildFaceLists(mesh);
+
+  neighborDistance(mesh, meanNew, maxNew);
+  printf("element_order = %s: mean neighbor distance %.1f -> %.1f elements, max %d -> %d\n",
+	 method.c_str(), meanOld, meanNew, maxOld, maxNew);
+  return 1;
+}
@@ -0,0 +1,97 @@
+#include "fem.h"
+
+/* Device layout of Q, rhsQ and resQ (setting field_layout).
+
+   element (default): [k][fld][n], the fields of an element are contiguous
+   field:             [fld][k][n], one array per field
+   aosoa:             [k/W][fld][n][k%W] with W = field_lanes (default 8):
+                      W consecutive elements interleaved node by node, for
+                      SIMD across elements on CPUs. K is padded to a
+                      multiple of W; padding elements stay zero.
+
+   The kernels index through qid/p_FieldStride (ElasKernelsWADG.okl) and the
+   host through FieldIndex; vmapP holds FieldIndex offsets.
+   WaveSetData3d/WaveGetData3d reorder between the host [k][fld][n] arrays
+   and the device layout. */
+
+static int layout = LAYOUT_ELEMENT;
+static int lanes = 1;
+static int Kmesh = 0;
+static int Klayout = 0; // elements, padded to a multiple of lanes
+
+void FieldLayoutInit(Mesh *mesh){
+
+  string name = GetSetting("field_layout", "element");
+  layout = LAYOUT_ELEMENT;
+  lanes = 1;
+  if (name=="field"){
+    layout = LAYOUT_FIELD;
+  }else if (name=="aosoa"){
+    layout = LAYOUT_AOSOA;
+    lanes = max(GetIntSetting("field_lanes", 8), 1);
+  }else if (name!="element"){
+    printf("unknown field_layout %s, using element\n", name.c_str());
+  }
+  Kmesh = mesh->K;
+  Klayout = (mesh->K + lanes - 1)/lanes*lanes;
+
+  const char *names[3] = {"element", "field", "aosoa"};
+  if (layout==LAYOUT_AOSOA){
+    printf("field_layout = %s, %d lanes (%d padding elements)\n",
+	   names[layout], lanes, Klayout - mesh->K);
+  }else{
+    printf("field_layout = %s\n", names[layout]);
+  }
+}
+
+int FieldLayout(){
+  return layout;
+}
+
+int FieldLanes(){
+  return lanes;
+}
+
+// elements in the device arrays (K padded to a multiple of the lane width)
+int FieldLayoutK(){
+  return Klayout;
+}
+
+// values in each of Q, rhsQ and resQ on the device
+dlong FieldStorageSize(){
+  return (dlong) Klayout*p_Np*p_Nfields;
+}
+
+// device offset of node n of field fld of element k (qid in the kernels)
+dlong FieldIndex(int k, int fld, int n){
+  if (layout==LAYOUT_FIELD){
+    return ((dlong) fld*Klayout + k)*p_Np + n;
+  }else if (layout==LAYOUT_AOSOA){
+    return (((dlong) (k/lanes)*p_Nfields + fld)*p_Np + n)*lanes + k%lanes;
+  }
+  return ((dlong) k*p_Nfields + fld)*p_Np + n;
+}
+
+// host [k][fld][n] to the device layout (FieldStorageSize values)
+void FieldsToDevice(const double *Q, double *Qdev){
+  memset(Qdev, 0, FieldStorageSize()*sizeof(double));
+#pragma omp parallel for
+  for (int k = 0; k < Kmesh; ++k){
+    for (int fld = 0; fld < p_Nfields; ++fld){
+      for (int n = 0; n < p_Np; ++n){
+	Qdev[FieldIndex(k, fld, n)] = Q[((dlong) k*p_Nfields + fld)*p_Np + n];
+      }
+    }
+  }
+}
+
+void FieldsFromDevice(const double *Qdev, double *Q){
+#pragma omp parallel for
+  for (int k = 0; k < Kmesh; ++k){
+    for (int fld = 0; fld < p_Nfields; ++fld){
+      for (int n = 0; n < p_Np; ++n){
+	Q[((dlong) k*p_Nfields + fld)*p_Np + n] = Qdev[FieldIndex(k, fld, n)];
+      }
+    }
+  }
+}
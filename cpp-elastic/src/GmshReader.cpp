@@ -0,0 +1,530 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include "fem.h"
+
+/* Gmsh reader for MSH 2.2 and 4.1, ASCII and binary.
+
+   The file is memory mapped and sections are parsed in place. ASCII
+   sections are first split into lines (in parallel), after which nodes
+   and elements are parsed line by line in parallel; binary sections have
+   fixed-size records within each element/entity block. All positions are
+   pointers into the mapping, so files larger than 2 GB are fine.
+
+   Only tetrahedra are kept. Vertex indices are converted from Gmsh node
+   tags to 0-indexed positions in VX/VY/VZ. ETag holds the physical tag of
+   each tet (first tag in MSH 2.2, first physical tag of its volume entity
+   in MSH 4.1, 0 if there is none). */
+
+#define GMSH_CHUNKS 256 // parallel work units for splitting ASCII sections into lines
+
+// number of nodes for Gmsh element types 1-19
+static int gmshNodesPerElement(int type){
+  const int Nnodes[20] = {0, 2, 3, 4, 4, 8, 6, 5, 3, 6, 9, 10, 27, 18, 14, 1, 8, 20, 15, 13};
+  if (type < 1 || type > 19){
+    printf("BBDG ERROR: unsupported Gmsh element type %d\n", type);
+    exit(1);
+  }
+  return Nnodes[type];
+}
+
+template <class T>
+static T readBinary(const char *&p){
+  T val;
+  memcpy(&val, p, sizeof(T));
+  p += sizeof(T);
+  return val;
+}
+
+static const char *nextLine(const char *p, const char *end){
+  const char *nl = (const char*) memchr(p, '\n', end - p);
+  return nl ? nl + 1 : end;
+}
+
+// start of the line after "$name", or NULL
+static const char *findSection(const char *begin, const char *end, const char *name){
+  string tag = string("$") + name;
+  const char *p = begin;
+  while (p < end){
+    const char *hit = (const char*) memmem(p, end - p, tag.c_str(), tag.size());
+    if (!hit){
+      return NULL;
+    }
+    const char *after = hit + tag.size();
+    if ((hit==begin || hit[-1]=='\n') && (after < end) && (*after=='\n' || *after=='\r')){
+      return nextLine(after, end);
+    }
+    p = after;
+  }
+  return NULL;
+}
+
+// start of every line in [begin, end)
+static void indexLines(const char *begin, const char *end, vector<const char*> &lines){
+
+  size_t bytes = end - begin;
+  size_t chunk = (bytes + GMSH_CHUNKS - 1)/GMSH_CHUNKS;
+  vector<size_t> counts(GMSH_CHUNKS + 1, 0);
+
+#pragma omp parallel for
+  for (int c = 0; c < GMSH_CHUNKS; ++c){
+    const char *p = begin + min(bytes, c*chunk);
+    const char *e = begin + min(bytes, (c+1)*chunk);
+    while ((p = (const char*) memchr(p, '\n', e - p)) != NULL){
+      ++p;
+      counts[c+1] += (p < end);
+    }
+  }
+  for (int c = 0; c < GMSH_CHUNKS; ++c){
+    counts[c+1] += counts[c];
+  }
+
+  lines.resize(counts[GMSH_CHUNKS] + 1);
+  lines[0] = begin;
+#pragma omp parallel for
+  for (int c = 0; c < GMSH_CHUNKS; ++c){
+    const char *p = begin + min(bytes, c*chunk);
+    const char *e = begin + min(bytes, (c+1)*chunk);
+    size_t n = counts[c] + 1;
+    while ((p = (const char*) memchr(p, '\n', e - p)) != NULL){
+      ++p;
+      if (p < end){
+	lines[n++] = p;
+      }
+    }
+  }
+}
+
+// node tag -> position in VX/VY/VZ
+static void mapNodeTag(vector<int> &tagToNode, size_t tag, int node){
+  if (tag >= tagToNode.size()){
+    tagToNode.resize(tag + 1, -1);
+  }
+  tagToNode[tag] = node;
+}
+
+static int nodeIndex(const vector<int> &tagToNode, size_t tag){
+  if (tag >= tagToNode.size() || tagToNode[tag] < 0){
+    printf("BBDG ERROR: element refers to unknown Gmsh node %lu\n", (unsigned long) tag);
+    exit(1);
+  }
+  return tagToNode[tag];
+}
+
+// MSH 4.1 $Entities: physical tag of each volume entity
+static void readEntities(const char *p, const char *end, int binary, std::map<int,int> &volumePhys){
+
+  if (!p){
+    return;
+  }
+  size_t Nent[4];
+  if (binary){
+    for (int d = 0; d < 4; ++d){
+      Nent[d] = readBinary<size_t>(p);
+    }
+    for (int d = 0; d < 4; ++d){
+      for (size_t i = 0; i < Nent[d]; ++i){
+	int tag = readBinary<int>(p);
+	p += (d==0 ? 3 : 6)*sizeof(double);
+	size_t Nphys = readBinary<size_t>(p);
+	int phys = Nphys ? readBinary<int>(p) : 0;
+	p += (Nphys ? Nphys - 1 : 0)*sizeof(int);
+	if (d > 0){
+	  size_t Nbound = readBinary<size_t>(p);
+	  p += Nbound*sizeof(int);
+	}
+	if (d==3){
+	  volumePhys[tag] = phys;
+	}
+      }
+    }
+  }else{
+    char *q;
+    for (int d = 0; d < 4; ++d){
+      Nent[d] = strtoul(p, &q, 10); p = q;
+    }
+    p = nextLine(p, end);
+    for (int d = 0; d < 4; ++d){
+      for (size_t i = 0; i < Nent[d]; ++i){
+	int tag = strtol(p, &q, 10); p = q;
+	for (int j = 0; j < (d==0 ? 3 : 6); ++j){
+	  strtod(p, &q); p = q;
+	}
+	size_t Nphys = strtoul(p, &q, 10); p = q;
+	int phys = Nphys ? strtol(p, &q, 10) : 0;
+	if (d==3){
+	  volumePhys[tag] = phys;
+	}
+	p = nextLine(p, end);
+      }
+    }
+  }
+}
+
+static void readNodes22(const char *p, const char *end, int binary, int &Nv,
+			double *&VX, double *&VY, double *&VZ, vector<int> &tagToNode){
+
+  char *q;
+  Nv = strtol(p, &q, 10);
+  p = nextLine(q, end);
+
+  VX = (double*) calloc(Nv, sizeof(double));
+  VY = (double*) calloc(Nv, sizeof(double));
+  VZ = (double*) calloc(Nv, sizeof(double));
+  vector<int> tags(Nv);
+
+  if (binary){
+    const size_t recSize = sizeof(int) + 3*sizeof(double);
+#pragma omp parallel for
+    for (int v = 0; v < Nv; ++v){
+      const char *r = p + v*recSize;
+      tags[v] = readBinary<int>(r);
+      VX[v] = readBinary<double>(r);
+      VY[v] = readBinary<double>(r);
+      VZ[v] = readBinary<double>(r);
+    }
+  }else{
+    const char *e = findSection(p, end, "EndNodes");
+    vector<const char*> lines;
+    indexLines(p, e ? e : end, lines);
+#pragma omp parallel for
+    for (int v = 0; v < Nv; ++v){
+      char *r;
+      tags[v] = strtol(lines[v], &r, 10);
+      VX[v] = strtod(r, &r);
+      VY[v] = strtod(r, &r);
+      VZ[v] = strtod(r, &r);
+    }
+  }
+  for (int v = 0; v < Nv; ++v){
+    mapNodeTag(tagToNode, tags[v], v);
+  }
+}
+
+static void readNodes41(const char *p, const char *end, int binary, int &Nv,
+			double *&VX, double *&VY, double *&VZ, vector<int> &tagToNode){
+
+  size_t Nblocks, Nnodes, maxTag;
+  vector<const char*> lines;
+  size_t line = 0;
+  char *q;
+  if (binary){
+    Nblocks = readBinary<size_t>(p);
+    Nnodes = readBinary<size_t>(p);
+    readBinary<size_t>(p); // min tag
+    maxTag = readBinary<size_t>(p);
+  }else{
+    const char *e = findSection(p, end, "EndNodes");
+    indexLines(p, e ? e : end, lines);
+    Nblocks = strtoul(lines[0], &q, 10);
+    Nnodes = strtoul(q, &q, 10);
+    strtoul(q, &q, 10);
+    maxTag = strtoul(q, &q, 10);
+    line = 1;
+  }
+
+  Nv = Nnodes;
+  VX = (double*) calloc(Nv, sizeof(double));
+  VY = (double*) calloc(Nv, sizeof(double));
+  VZ = (double*) calloc(Nv, sizeof(double));
+  tagToNode.assign(maxTag + 1, -1);
+
+  size_t v0 = 0;
+  for (size_t b = 0; b < Nblocks; ++b){
+    int dim, parametric;
+    size_t Nb;
+    if (binary){
+      dim = readBinary<int>(p);
+      readBinary<int>(p); // entity tag
+      parametric = readBinary<int>(p);
+      Nb = readBinary<size_t>(p);
+      const char *tags = p;
+      const char *coords = p + Nb*sizeof(size_t);
+      const size_t recSize = (3 + (parametric ? dim : 0))*sizeof(double);
+#pragma omp parallel for
+      for (size_t i = 0; i < Nb; ++i){
+	const char *t = tags + i*sizeof(size_t);
+	const char *r = coords + i*recSize;
+	tagToNode[readBinary<size_t>(t)] = v0 + i;
+	VX[v0+i] = readBinary<double>(r);
+	VY[v0+i] = readBinary<double>(r);
+	VZ[v0+i] = readBinary<double>(r);
+      }
+      p = coords + Nb*recSize;
+    }else{
+      dim = strtol(lines[line], &q, 10);
+      strtol(q, &q, 10);
+      parametric = strtol(q, &q, 10);
+      Nb = strtoul(q, &q, 10);
+      const size_t tagLine = line + 1, coordLine = line + 1 + Nb;
+#pragma omp parallel for
+      for (size_t i = 0; i < Nb; ++i){
+	char *r;
+	tagToNode[strtoul(lines[tagLine + i], NULL, 10)] = v0 + i;
+	VX[v0+i] = strtod(lines[coordLine + i], &r);
+	VY[v0+i] = strtod(r, &r);
+	VZ[v0+i] = strtod(r, &r);
+      }
+      line += 1 + 2*Nb;
+    }
+    v0 += Nb;
+  }
+}
+
+/* elements: two passes, first counting tets (and triangles) per block,
+   then filling EToV/EToGmshE/ETag in parallel within each block */
+static void readElements22(const char *p, const char *end, int binary, Mesh *mesh,
+			   const vector<int> &tagToNode, int &Ntri){
+
+  char *q;
+  size_t Nelements = strtoul(p, &q, 10);
+  p = nextLine(q, end);
+
+  int K = 0;
+  Ntri = 0;
+  if (binary){
+    // block headers: type, number of elements, number of tags
+    const char *r = p;
+    for (size_t n = 0; n < Nelements;){
+      int type = readBinary<int>(r);
+      int Nb = readBinary<int>(r);
+      int Ntags = readBinary<int>(r);
+      K += (type==4)*Nb;
+      Ntri += (type==2)*Nb;
+      r += (size_t) Nb*(1 + Ntags + gmshNodesPerElement(type))*sizeof(int);
+      n += Nb;
+    }
+  }else{
+    const char *e = findSection(p, end, "EndElements");
+    vector<const char*> lines;
+    indexLines(p, e ? e : end, lines);
+    vector<int> isTet(Nelements + 1, 0);
+    int Ntri2 = 0;
+#pragma omp parallel for reduction(+:Ntri2)
+    for (size_t n = 0; n < Nelements; ++n){
+      char *r;
+      strtol(lines[n], &r, 10);
+      int type = strtol(r, &r, 10);
+      isTet[n+1] = (type==4);
+      Ntri2 += (type==2);
+    }
+    Ntri = Ntri2;
+    for (size_t n = 0; n < Nelements; ++n){
+      isTet[n+1] += isTet[n];
+    }
+    K = isTet[Nelements];
+
+    mesh->K = K;
+    mesh->EToV = BuildIntMatrix(K, 4);
+    mesh->EToGmshE.resize(K);
+    mesh->ETag.resize(K);
+#pragma omp parallel for
+    for (size_t n = 0; n < Nelements; ++n){
+      if (isTet[n+1]==isTet[n]){
+	continue;
+      }
+      int k = isTet[n];
+      char *r;
+      mesh->EToGmshE(k) = strtol(lines[n], &r, 10);
+      strtol(r, &r, 10); // type
+      int Ntags = strtol(r, &r, 10);
+      mesh->ETag(k) = 0;
+      for (int t = 0; t < Ntags; ++t){
+	int tag = strtol(r, &r, 10);
+	if (t==0){
+	  mesh->ETag(k) = tag; // physical tag
+	}
+      }
+      for (int v = 0; v < 4; ++v){
+	mesh->EToV[k][v] = nodeIndex(tagToNode, strtoul(r, &r, 10));
+      }
+    }
+    return;
+  }
+
+  mesh->K = K;
+  mesh->EToV = BuildIntMatrix(K, 4);
+  mesh->EToGmshE.resize(K);
+  mesh->ETag.resize(K);
+  int k0 = 0;
+  for (size_t n = 0; n < Nelements;){
+    int type = readBinary<int>(p);
+    int Nb = readBinary<int>(p);
+    int Ntags = readBinary<int>(p);
+    const size_t recSize = (1 + Ntags + gmshNodesPerElement(type))*sizeof(int);
+    if (type==4){
+#pragma omp parallel for
+      for (int i = 0; i < Nb; ++i){
+	const char *r = p + i*recSize;
+	int k = k0 + i;
+	mesh->EToGmshE(k) = readBinary<int>(r);
+	mesh->ETag(k) = Ntags ? readBinary<int>(r) : 0;
+	r += (Ntags ? Ntags - 1 : 0)*sizeof(int);
+	for (int v = 0; v < 4; ++v){
+	  mesh->EToV[k][v] = nodeIndex(tagToNode, readBinary<int>(r));
+	}
+      }
+      k0 += Nb;
+    }
+    p += (size_t) Nb*recSize;
+    n += Nb;
+  }
+}
+
+static void readElements41(const char *p, const char *end, int binary, Mesh *mesh,
+			   const vector<int> &tagToNode, const std::map<int,int> &volumePhys, int &Ntri){
+
+  size_t Nblocks;
+  vector<const char*> lines;
+  char *q;
+  if (binary){
+    Nblocks = readBinary<size_t>(p);
+    p += 3*sizeof(size_t); // number of elements, min/max tag
+  }else{
+    const char *e = findSection(p, end, "EndElements");
+    indexLines(p, e ? e : end, lines);
+    Nblocks = strtoul(lines[0], &q, 10);
+  }
+
+  // block headers: entity dim, entity tag, type, number of elements
+  vector<int> blockEntity(Nblocks), blockType(Nblocks);
+  vector<size_t> blockSize(Nblocks), blockStart(Nblocks);
+  vector<const char*> blockData(Nblocks);
+  size_t line = 1;
+  int K = 0;
+  Ntri = 0;
+  for (size_t b = 0; b < Nblocks; ++b){
+    if (binary){
+      readBinary<int>(p);
+      blockEntity[b] = readBinary<int>(p);
+      blockType[b] = readBinary<int>(p);
+      blockSize[b] = readBinary<size_t>(p);
+      blockData[b] = p;
+      p += blockSize[b]*(1 + gmshNodesPerElement(blockType[b]))*sizeof(size_t);
+    }else{
+      strtol(lines[line], &q, 10);
+      blockEntity[b] = strtol(q, &q, 10);
+      blockType[b] = strtol(q, &q, 10);
+      blockSize[b] = strtoul(q, &q, 10);
+      blockStart[b] = line + 1;
+      line += 1 + blockSize[b];
+    }
+    K += (blockType[b]==4)*blockSize[b];
+    Ntri += (blockType[b]==2)*blockSize[b];
+  }
+
+  mesh->K = K;
+  mesh->EToV = BuildIntMatrix(K, 4);
+  mesh->EToGmshE.resize(K);
+  mesh->ETag.resize(K);
+  int k0 = 0;
+  for (size_t b = 0; b < Nblocks; ++b){
+    if (blockType[b]!=4){
+      continue;
+    }
+    std::map<int,int>::const_iterator it = volumePhys.find(blockEntity[b]);
+    const int phys = (it==volumePhys.end()) ? 0 : it->second;
+#pragma omp parallel for
+    for (size_t i = 0; i < blockSize[b]; ++i){
+      const int k = k0 + i;
+      mesh->ETag(k) = phys;
+      if (binary){
+	const char *r = blockData[b] + i*5*sizeof(size_t);
+	mesh->EToGmshE(k) = readBinary<size_t>(r);
+	for (int v = 0; v < 4; ++v){
+	  mesh->EToV[k][v] = nodeIndex(tagToNode, readBinary<size_t>(r));
+	}
+      }else{
+	char *r;
+	mesh->EToGmshE(k) = strtoul(lines[blockStart[b] + i], &r, 10);
+	for (int v = 0; v < 4; ++v){
+	  mesh->EToV[k][v] = nodeIndex(tagToNode, strtoul(r, &r, 10));
+	}
+      }
+    }
+    k0 += blockSize[b];
+  }
+}
+
+void ReadGmshFile(const char *filename, Mesh *mesh, double **VX, double **VY, double **VZ){
+
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st)){
+    printf("BBDG ERROR: Mesh '%s' not opened\n", filename);
+    exit(1);
+  }
+  size_t bytes = st.st_size;
+  const char *begin = (const char*) mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (begin==MAP_FAILED){
+    printf("BBDG ERROR: could not map mesh '%s'\n", filename);
+    exit(1);
+  }
+  madvise((void*) begin, bytes, MADV_SEQUENTIAL);
+  const char *end = begin + bytes;
+
+  // $MeshFormat: version, file type (1 = binary), data size
+  const char *p = findSection(begin, end, "MeshFormat");
+  if (!p){
+    printf("BBDG ERROR: '%s' is not a Gmsh file\n", filename);
+    exit(1);
+  }
+  char *q;
+  double version = strtod(p, &q);
+  int binary = strtol(q, &q, 10);
+  int dataSize = strtol(q, &q, 10);
+  p = nextLine(q, end);
+  if (binary){
+    if (readBinary<int>(p)!=1){
+      printf("BBDG ERROR: binary Gmsh file '%s' has different endianness\n", filename);
+      exit(1);
+    }
+  }
+  const int msh4 = (version >= 4.0);
+  if ((version < 2.0 || version >= 3.0) && (version < 4.1 || version >= 5.0)){
+    printf("BBDG ERROR: unsupported Gmsh format %g (MSH 2.2 or 4.1 expected)\n", version);
+    exit(1);
+  }
+  if (binary && dataSize!=8){
+    printf("BBDG ERROR: unsupported data size %d in binary Gmsh file\n", dataSize);
+    exit(1);
+  }
+
+  const char *nodes = findSection(p, end, "Nodes");
+  if (!nodes){
+    printf("BBDG ERROR: no $Nodes in '%s'\n", filename);
+    exit(1);
+  }
+  vector<int> tagToNode;
+  if (msh4){
+    readNodes41(nodes, end, binary, mesh->Nv, *VX, *VY, *VZ, tagToNode);
+  }else{
+    readNodes22(nodes, end, binary, mesh->Nv, *VX, *VY, *VZ, tagToNode);
+  }
+
+  const char *elements = findSection(nodes, end, "Elements");
+  if (!elements){
+    printf("BBDG ERROR: no $Elements in '%s'\n", filename);
+    exit(1);
+  }
+  int Ntri = 0;
+  if (msh4){
+    std::map<int,int> volumePhys;
+    readEntities(findSection(p, nodes, "Entities"), nodes, binary, volumePhys);
+    readElements41(elements, end, binary, mesh, tagToNode, volumePhys, Ntri);
+  }else{
+    readElements22(elements, end, binary, mesh, tagToNode, Ntri);
+  }
+
+  mesh->Nverts = 4; /* assume tets */
+  mesh->Nedges = 6; /* assume tets */
+  mesh->Nfaces = 4; /* assume tets */
+
+  printf("Gmsh %.1f %s: %d vertices, %d triangles and %d tetrahedra\n",
+	 version, binary ? "binary" : "ASCII", mesh->Nv, Ntri, mesh->K);
+
+  munmap((void*) begin, bytes);
+  close(fd);
+}
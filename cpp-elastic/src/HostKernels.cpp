@@ -0,0 +1,154 @@
+#include "fem.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Native CPU version of the Bernstein rk_volume_bern_elas kernel.
+
+   Elements are packed p_W at a time element-interleaved (X[n*p_W + e],
+   one SIMD vector per node and field) so that the 4-nonzero derivative
+   stencils D1_ids..D4_ids, which are the same for every element, become
+   contiguous vector FMAs with no gathers. Blocks of p_W elements are
+   distributed over OpenMP threads, each with its own workspace.
+
+   Selected with the setting "host_kernels = 1" in RK_step_WADG_subelem.
+   Works on the OCCA buffers directly, so it needs a host backend
+   (occa_mode = Serial or OpenMP). */
+
+// elements per SIMD vector (AVX2: 8, AVX-512: 16)
+#ifndef p_W
+#if defined(__AVX512F__)
+#define p_W 16
+#else
+#define p_W 8
+#endif
+#endif
+
+extern int nvgeo; // geometric factors per element (WaveOKL3d.cpp)
+
+static int *hDids = NULL;     // stencil: node n, direction d, nonzero j at [(n*4 + d)*4 + j]
+static dfloat *hDvals = NULL; // stencil weights [n*4 + j], shared by all directions
+static int Nthreads = 1;
+static dfloat **workspace = NULL; // per thread
+
+void HostKernelsInit(Mesh *mesh){
+
+  hDids = (int*) malloc(16*p_Np*sizeof(int));
+  hDvals = (dfloat*) malloc(4*p_Np*sizeof(dfloat));
+  for (int n = 0; n < p_Np; ++n){
+    for (int j = 0; j < 4; ++j){
+      hDids[(n*4 + 0)*4 + j] = mesh->D1_ids[n][j];
+      hDids[(n*4 + 1)*4 + j] = mesh->D2_ids[n][j];
+      hDids[(n*4 + 2)*4 + j] = mesh->D3_ids[n][j];
+      hDids[(n*4 + 3)*4 + j] = mesh->D4_ids[n][j];
+      hDvals[n*4 + j] = mesh->D_vals(n,j);
+    }
+  }
+
+#ifdef _OPENMP
+  Nthreads = omp_get_max_threads();
+#endif
+
+  // packed Q and packed rhs
+  workspace = (dfloat**) calloc(Nthreads, sizeof(dfloat*));
+  for (int t = 0; t < Nthreads; ++t){
+    workspace[t] = (dfloat*) calloc(2*p_Nfields*p_Np*p_W, sizeof(dfloat));
+  }
+
+  printf("host Bernstein kernels: %d elements per SIMD vector, %d threads\n", p_W, Nthreads);
+}
+
+void host_rk_volume_bern_elas(int K, const dfloat *vgeo, const dfloat *Q, dfloat *rhsQ){
+
+  const int Nblocks = (K + p_W - 1)/p_W;
+
+#pragma omp parallel for schedule(static)
+  for (int blk = 0; blk < Nblocks; ++blk){
+
+    int t = 0;
+#ifdef _OPENMP
+    t = omp_get_thread_num();
+#endif
+    dfloat *sQ = workspace[t];             // [fld][n][e]
+    dfloat *R  = sQ + p_Nfields*p_Np*p_W;  // [fld][n][e]
+
+    const int k0 = blk*p_W;
+    const int Kb = min(p_W, K - k0);
+
+    // pad with the last element
+    dfloat G[9][p_W];
+    for (int e = 0; e < p_W; ++e){
+      const int k = k0 + min(e, Kb-1);
+      for (int g = 0; g < 9; ++g){
+	G[g][e] = vgeo[k*nvgeo + g];
+      }
+      const dfloat *Qk = Q + (dlong) k*p_Np*p_Nfields;
+      for (int n = 0; n < p_Nfields*p_Np; ++n){
+	sQ[n*p_W + e] = Qk[n];
+      }
+    }
+
+    for (int n = 0; n < p_Np; ++n){
+
+      // barycentric derivatives of all fields
+      dfloat Q1[p_Nfields][p_W], Q2[p_Nfields][p_W], Q3[p_Nfields][p_W], Q4[p_Nfields][p_W];
+      for (int fld = 0; fld < p_Nfields; ++fld){
+#pragma omp simd
+	for (int e = 0; e < p_W; ++e){
+	  Q1[fld][e] = Q2[fld][e] = Q3[fld][e] = Q4[fld][e] = 0.f;
+	}
+      }
+
+      for (int j = 0; j < 4; ++j){
+	const dfloat Dval = hDvals[n*4 + j];
+	const int i1 = hDids[(n*4 + 0)*4 + j]*p_W;
+	const int i2 = hDids[(n*4 + 1)*4 + j]*p_W;
+	const int i3 = hDids[(n*4 + 2)*4 + j]*p_W;
+	const int i4 = hDids[(n*4 + 3)*4 + j]*p_W;
+	for (int fld = 0; fld < p_Nfields; ++fld){
+	  const dfloat *sQf = sQ + fld*p_Np*p_W;
+#pragma omp simd
+	  for (int e = 0; e < p_W; ++e){
+	    Q1[fld][e] += Dval*sQf[i1 + e];
+	    Q2[fld][e] += Dval*sQf[i2 + e];
+	    Q3[fld][e] += Dval*sQf[i3 + e];
+	    Q4[fld][e] += Dval*sQf[i4 + e];
+	  }
+	}
+      }
+
+      // reference then physical derivatives: Q1,Q2,Q3 = d/dx, d/dy, d/dz
+      for (int fld = 0; fld < p_Nfields; ++fld){
+#pragma omp simd
+	for (int e = 0; e < p_W; ++e){
+	  const dfloat dr = .5f*(Q2[fld][e] - Q1[fld][e]);
+	  const dfloat ds = .5f*(Q3[fld][e] - Q1[fld][e]);
+	  const dfloat dt = .5f*(Q4[fld][e] - Q1[fld][e]);
+	  Q1[fld][e] = G[0][e]*dr + G[3][e]*ds + G[6][e]*dt;
+	  Q2[fld][e] = G[1][e]*dr + G[4][e]*ds + G[7][e]*dt;
+	  Q3[fld][e] = G[2][e]*dr + G[5][e]*ds + G[8][e]*dt;
+	}
+      }
+
+#pragma omp simd
+      for (int e = 0; e < p_W; ++e){
+	R[(n + 0*p_Np)*p_W + e] = Q1[3][e] + Q2[8][e] + Q3[7][e]; // divSx
+	R[(n + 1*p_Np)*p_W + e] = Q1[8][e] + Q2[4][e] + Q3[6][e]; // divSy
+	R[(n + 2*p_Np)*p_W + e] = Q1[7][e] + Q2[6][e] + Q3[5][e]; // divSz
+	R[(n + 3*p_Np)*p_W + e] = Q1[0][e];
+	R[(n + 4*p_Np)*p_W + e] = Q2[1][e];
+	R[(n + 5*p_Np)*p_W + e] = Q3[2][e];
+	R[(n + 6*p_Np)*p_W + e] = Q2[2][e] + Q3[1][e];
+	R[(n + 7*p_Np)*p_W + e] = Q1[2][e] + Q3[0][e];
+	R[(n + 8*p_Np)*p_W + e] = Q1[1][e] + Q2[0][e];
+      }
+    }
+
+    for (int e = 0; e < Kb; ++e){
+      dfloat *rhs = rhsQ + (dlong) (k0 + e)*p_Np*p_Nfields;
+      for (int n = 0; n < p_Nfields*p_Np; ++n){
+	rhs[n] = R[n*p_W + e];
+      }
+    }
+  }
+}
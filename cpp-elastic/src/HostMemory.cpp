@@ -0,0 +1,59 @@
+#include "fem.h"
+
+/* Host memory use and the lean mesh mode.
+
+   With lean_mesh = 1 the Nq x K cubature arrays (xq,yq,zq, rxq..tzq, Jq,
+   nxq..sJq) are never stored: InitQuadratureArrays streams the geofacs
+   through per-thread block buffers and keeps only what hMax needs, and
+   cubature node coordinates are interpolated from x,y,z per element when
+   they are used (QuadratureNodes). The Np x K nodal geofacs rx..tz and
+   nx..sJ are not built either (J keeps one row: elements are affine).
+   Arrays that are uploaded to the device (Cq) are released once the
+   device copy exists (ReleaseHostArrays). Peak host memory is reported
+   either way. */
+
+int LeanMesh(){
+  static int lean = -1;
+  if (lean < 0){
+    lean = GetIntSetting("lean_mesh", 0);
+  }
+  return lean;
+}
+
+// cubature node coordinates of element k
+void QuadratureNodes(Mesh *mesh, int k, VectorXd &xq, VectorXd &yq, VectorXd &zq){
+  if (mesh->xq.cols()==mesh->K){
+    xq = mesh->xq.col(k);
+    yq = mesh->yq.col(k);
+    zq = mesh->zq.col(k);
+  }else{
+    xq.noalias() = mesh->Vq*mesh->x.col(k);
+    yq.noalias() = mesh->Vq*mesh->y.col(k);
+    zq.noalias() = mesh->Vq*mesh->z.col(k);
+  }
+}
+
+// free host arrays that only exist to be uploaded (lean mode only)
+void ReleaseHostArrays(Mesh *mesh){
+  if (!LeanMesh()){
+    return;
+  }
+  MatrixXd().swap(mesh->Cq);
+}
+
+// resident and peak resident host memory, from /proc/self/status
+void ReportHostMemory(const char *stage){
+  FILE *fp = fopen("/proc/self/status", "r");
+  if (!fp){
+    return;
+  }
+  char line[256];
+  long rss = -1, hwm = -1;
+  while (fgets(line, sizeof(line), fp)){
+    sscanf(line, "VmRSS: %ld kB", &rss);
+    sscanf(line, "VmHWM: %ld kB", &hwm);
+  }
+  fclose(fp);
+  printf("host memory after %s: %.1f MB resident, %.1f MB peak%s\n",
+	 stage, rss/1024.0, hwm/1024.0, LeanMesh() ? " (lean_mesh)" : "");
+}
@@ -0,0 +1,267 @@
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <omp.h>
+#include "fem.h"
+
+/* Kernel defines and on-disk cache of JIT-compiled kernels.
+
+   Kernels are built from "okl/..." sources that are either compiled into
+   the executable (make EMBED=1, the default) or read from disk. Before a
+   kernel is built the defines are prepended to the source and the result
+   is written once to <kernel_cache>/<hash>.okl, where the hash covers the
+   source, all defines, kernel name, backend and compiler flags. OCCA keys
+   its compiled binaries on file contents, so with OCCA_CACHE_DIR pointing
+   into the same directory a later run with an identical define set
+   reloads the compiled binary instead of recompiling. */
+
+extern occa::device device;
+
+#ifndef EMBED_OKL
+#define EMBED_OKL 0
+#endif
+
+#if EMBED_OKL
+// { "okl/name.okl", "source" } pairs generated from okl/*.okl by make
+static const char *oklSources[][2] = {
+#include "oklSources.h"
+  {NULL, NULL}
+};
+#endif
+
+// defines in the order they were first added
+static vector<pair<string,string> > kernelDefines;
+
+void setKernelDefine(string name, string value){
+  for (size_t i = 0; i < kernelDefines.size(); ++i){
+    if (kernelDefines[i].first==name){
+      kernelDefines[i].second = value;
+      return;
+    }
+  }
+  kernelDefines.push_back(make_pair(name,value));
+}
+
+string getKernelDefines(){
+  string defines;
+  for (size_t i = 0; i < kernelDefines.size(); ++i){
+    defines += "#define " + kernelDefines[i].first + " " + kernelDefines[i].second + "\n";
+  }
+  return defines;
+}
+
+// look up a kernel source: okl_dir setting, then embedded copy, then disk
+static int readKernelSource(string file, string &source){
+
+  string oklDir = GetSetting("okl_dir", "");
+  string path = file;
+  if (oklDir.size()){
+    path = oklDir + "/" + file.substr(file.find_last_of('/')+1);
+  }
+
+#if EMBED_OKL
+  if (oklDir.size()==0){
+    for (int i = 0; oklSources[i][0]; ++i){
+      if (file==oklSources[i][0]){
+	source = oklSources[i][1];
+	return 1;
+      }
+    }
+  }
+#endif
+
+  std::ifstream in(path.c_str());
+  if (!in.good()){
+    return 0;
+  }
+  std::stringstream ss;
+  ss << in.rdbuf();
+  source = ss.str();
+  return 1;
+}
+
+int haveKernelSource(string file){
+  string source;
+  return readKernelSource(file, source);
+}
+
+// 64-bit FNV-1a
+unsigned long long hashString(const string &str, unsigned long long h){
+  for (size_t i = 0; i < str.size(); ++i){
+    h ^= (unsigned char) str[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// mkdir -p
+void makeDirectory(string dir){
+  for (size_t pos = 1; pos <= dir.size(); ++pos){
+    if (pos==dir.size() || dir[pos]=='/'){
+      mkdir(dir.substr(0,pos).c_str(), 0755);
+    }
+  }
+}
+
+// kernel_cache setting: directory for expanded sources/binaries, or "none"
+string getKernelCacheDir(){
+  string defaultDir = ".bbwadg_kernels";
+  const char *home = getenv("HOME");
+  if (home){
+    defaultDir = string(home) + "/.bbwadg/kernels";
+  }
+  return GetSetting("kernel_cache", defaultDir.c_str());
+}
+
+occa::kernel buildKernel(string file, string kernelName){
+
+  string source;
+  if (!readKernelSource(file, source)){
+    printf("could not find kernel source %s for %s\n", file.c_str(), kernelName.c_str());
+    exit(-1);
+  }
+
+  string cacheDir = getKernelCacheDir();
+  if (cacheDir=="none"){
+    occa::kernelInfo info;
+    for (size_t i = 0; i < kernelDefines.size(); ++i){
+      info.addDefine(kernelDefines[i].first, kernelDefines[i].second);
+    }
+    return device.buildKernelFromString(source, kernelName, info);
+  }
+
+  string defines = getKernelDefines();
+  unsigned long long h = 14695981039346656037ULL;
+  h = hashString(source, h);
+  h = hashString(defines, h);
+  h = hashString(kernelName, h);
+  h = hashString(device.mode(), h);
+  h = hashString(GetSetting("occa_flags", ""), h);
+
+  char hashStr[32];
+  sprintf(hashStr, "%016llx", h);
+  string expanded = cacheDir + "/" + hashStr + ".okl";
+
+  std::ifstream cached(expanded.c_str());
+  if (cached.good()){
+    printf("kernel cache hit: %s (%s)\n", kernelName.c_str(), hashStr);
+  }else{
+    printf("kernel cache miss: %s (%s)\n", kernelName.c_str(), hashStr);
+    makeDirectory(cacheDir);
+
+    // write to a temporary file first so concurrent runs never see a partial source
+    char pid[32];
+    sprintf(pid, ".tmp%d", (int) getpid());
+    string tmp = expanded + pid;
+    std::ofstream out(tmp.c_str());
+    out << "// " << file << ": " << kernelName << "\n" << defines << "\n" << source;
+    out.close();
+    rename(tmp.c_str(), expanded.c_str());
+  }
+
+  return device.buildKernelFromSource(expanded, kernelName);
+}
+
+/* Tuning database: one line per tuned kernel,
+     <device> <N> <precision> <kernel> <Kblk> <seconds per call>
+   e.g. "CUDA:0:0 3 float bern:rk_volume_bern 4 1.2e-05". The kernel name
+   is prefixed with the field layout, the basis of the build (bern or
+   nodal) and the settings that change the timed kernel, e.g.
+   "CUDA:0:0 3 float aosoa:8:bern:compact:rk_surface_bern_elas 2 3.1e-05".
+   Later entries for the same device/N/precision/kernel replace earlier
+   ones. */
+
+string getTuningFile(){
+  string defaultFile = ".bbwadg_tuning.txt";
+  const char *home = getenv("HOME");
+  if (home){
+    defaultFile = string(home) + "/.bbwadg/tuning.txt";
+  }
+  return GetSetting("tuning_db", defaultFile.c_str());
+}
+
+// device part of the tuning key: mode plus platform/device ids or thread count
+string getDeviceKey(){
+  string mode = GetSetting("occa_mode", "CUDA");
+  char key[BUFSIZ];
+  if (mode=="OpenCL" || mode=="CUDA"){
+    sprintf(key, "%s:%d:%d", mode.c_str(),
+	    GetIntSetting("occa_platform", 0), GetIntSetting("occa_device", 0));
+  }else if (mode=="OpenMP"){
+    sprintf(key, "%s:%d", mode.c_str(), omp_get_max_threads());
+  }else{
+    sprintf(key, "%s", mode.c_str());
+  }
+  return string(key);
+}
+
+static string getTuningKey(string kernelName){
+  const char *precisionNames[3] = {"float", "mixed", "double"};
+  const char *layoutNames[3] = {"", "field:", "aosoa:"};
+  std::stringstream ss;
+  ss << getDeviceKey() << " " << p_N << " "
+     << precisionNames[DevicePrecision()] << " " << layoutNames[FieldLayout()];
+  if (FieldLayout()==LAYOUT_AOSOA){
+    ss << FieldLanes() << ":";
+  }
+  // settings that change the timed kernels or the element order
+  ss << (USE_BERN ? "bern:" : "nodal:");
+  if (GetSetting("element_order", "none")!="none"){
+    ss << GetSetting("element_order", "none") << ":";
+  }
+  if (GetIntSetting("compact_connectivity", 0)){
+    ss << "compact:";
+  }
+  ss << kernelName;
+  return ss.str();
+}
+
+int getTunedKblk(string kernelName, int defaultKblk){
+
+  string key = getTuningKey(kernelName);
+  std::ifstream in(getTuningFile().c_str());
+  int Kblk = defaultKblk;
+
+  string line;
+  while (std::getline(in, line)){
+    std::stringstream ss(line);
+    string dev, N, prec, name;
+    int K;
+    if (ss >> dev >> N >> prec >> name >> K){
+      if (dev + " " + N + " " + prec + " " + name == key){
+	Kblk = K;
+      }
+    }
+  }
+  return Kblk;
+}
+
+void setTunedKblk(string kernelName, int Kblk, double time){
+
+  string key = getTuningKey(kernelName);
+  string file = getTuningFile();
+
+  // keep all other entries
+  vector<string> lines;
+  std::ifstream in(file.c_str());
+  string line;
+  while (std::getline(in, line)){
+    if (line.compare(0, key.size()+1, key + " ")!=0){
+      lines.push_back(line);
+    }
+  }
+  in.close();
+
+  char entry[BUFSIZ];
+  sprintf(entry, "%s %d %g", key.c_str(), Kblk, time);
+  lines.push_back(string(entry));
+
+  size_t slash = file.find_last_of('/');
+  if (slash!=string::npos){
+    makeDirectory(file.substr(0, slash));
+  }
+  std::ofstream out(file.c_str());
+  for (size_t i = 0; i < lines.size(); ++i){
+    out << lines[i] << "\n";
+  }
+}
@@ -0,0 +1,275 @@
+#include <unistd.h>
+#include <fstream>
+#include "fem.h"
+
+/* Reference-element operator cache.
+
+   The reference operators built by StartUp3d, BB_mult and BB_projection
+   depend only on N and the precision, but take most of the startup time at
+   high order (dense solves, cubature up to degree 3N+1). Each group is
+   written to <operator_cache>/<group>_N<N>_<fp32|fp64>_<Nfields>fields.bbops
+   on first use and read back on later runs (the field count keeps the
+   acoustic and elastic solvers, which store different members, apart).
+   The file stores a fingerprint of the basis code: Nodes3D, the cubature
+   rules and the nodal/Bernstein basis evaluated at a few fixed points,
+   plus OPERATOR_CACHE_VERSION (bump it when the operator assembly in
+   StartUp3d.cpp changes). A file with a different fingerprint is
+   rebuilt.
+
+   A group is described by one "fields" function that passes every member
+   to OperatorCacheField, which reads or writes it depending on whether
+   the group is being loaded or saved. */
+
+#define OPERATOR_CACHE_VERSION 2
+
+enum { OPS_OFF, OPS_READ, OPS_WRITE };
+
+static int opsMode = OPS_OFF;
+static int opsFailed = 0;
+static string opsFile;
+static string opsData;      // file contents (read) or records (write)
+static size_t opsPos = 0;
+
+static unsigned long long hashValues(const MatrixXd &A, unsigned long long h){
+  return hashString(string((const char*) A.data(), A.size()*sizeof(double)), h);
+}
+
+// changes whenever the basis or cubature code produces different values
+static unsigned long long basisFingerprint(){
+
+  static unsigned long long fingerprint = 0;
+  if (fingerprint){
+    return fingerprint;
+  }
+
+  VectorXd r(4), s(4), t(4);
+  r << -0.9, 0.31, -0.47, -0.2;
+  s << -0.8, -0.73, 0.21, -0.4;
+  t << -0.7, -0.66, -0.85, 0.3;
+
+  unsigned long long h = 14695981039346656037ULL;
+  std::stringstream key;
+  key << OPERATOR_CACHE_VERSION << " " << p_N << " " << sizeof(dfloat);
+  h = hashString(key.str(), h);
+
+  VectorXd rn, sn, tn;
+  Nodes3D(p_N, rn, sn, tn);
+  h = hashValues(rn, h); h = hashValues(sn, h); h = hashValues(tn, h);
+
+  MatrixXd V1, V2, V3, V4;
+  h = hashValues(Vandermonde3D(p_N, r, s, t), h);
+  GradVandermonde3D(p_N, r, s, t, V1, V2, V3);
+  h = hashValues(V1, h); h = hashValues(V2, h); h = hashValues(V3, h);
+  h = hashValues(Vandermonde2D(p_N, r, s), h);
+  h = hashValues(BernTet(p_N+1, r, s, t), h);
+  GradBernTet(p_N, r, s, t, V1, V2, V3, V4);
+  h = hashValues(V1, h); h = hashValues(V2, h); h = hashValues(V3, h); h = hashValues(V4, h);
+  h = hashValues(BernTri(p_N, r, s), h);
+
+  int qN[2] = {min(21, 2*p_N+1), min(21, 3*p_N+1)}; // StartUp3d and BB_mult
+  for (int i = 0; i < 2; ++i){
+    VectorXd rq, sq, tq, wq;
+    tet_cubature(qN[i], rq, sq, tq, wq);
+    h = hashValues(rq, h); h = hashValues(wq, h);
+  }
+  VectorXd rfq, sfq, wfq;
+  tri_cubature(min(21, 2*p_N+1), rfq, sfq, wfq);
+  h = hashValues(rfq, h); h = hashValues(wfq, h);
+
+  fingerprint = h ? h : 1;
+  return fingerprint;
+}
+
+// operator_cache setting: directory for cached reference operators, or "none"
+static string operatorCacheName(const char *group){
+  string defaultDir = ".bbwadg_operators";
+  const char *home = getenv("HOME");
+  if (home){
+    defaultDir = string(home) + "/.bbwadg/operators";
+  }
+  string dir = GetSetting("operator_cache", defaultDir.c_str());
+  if (dir=="none"){
+    return "";
+  }
+  char name[128];
+  sprintf(name, "/%s_N%d_%s_%dfields.bbops", group, p_N, sizeof(dfloat)==4 ? "fp32" : "fp64", p_Nfields);
+  return dir + name;
+}
+
+static int opsBegin(const char *group, int mode){
+
+  opsMode = OPS_OFF;
+  opsFailed = 0;
+  opsData.clear();
+  opsFile = operatorCacheName(group);
+  if (opsFile.empty()){
+    return 0;
+  }
+
+  unsigned long long fingerprint = basisFingerprint();
+  if (mode==OPS_WRITE){
+    opsData.append("BBWADGOP", 8);
+    opsData.append((const char*) &fingerprint, sizeof(fingerprint));
+    opsMode = OPS_WRITE;
+    return 1;
+  }
+
+  std::ifstream in(opsFile.c_str(), std::ios::binary);
+  if (!in.good()){
+    printf("operator cache miss: %s\n", opsFile.c_str());
+    return 0;
+  }
+  std::stringstream buf;
+  buf << in.rdbuf();
+  opsData = buf.str();
+  if (opsData.size() < 8 + sizeof(fingerprint) || opsData.compare(0, 8, "BBWADGOP") ||
+      memcmp(opsData.data() + 8, &fingerprint, sizeof(fingerprint))){
+    printf("operator cache stale: %s\n", opsFile.c_str());
+    return 0;
+  }
+  opsPos = 8 + sizeof(fingerprint);
+  opsMode = OPS_READ;
+  return 1;
+}
+
+// returns 1 if every field of the group was read (or written)
+static int opsEnd(){
+
+  int ok = !opsFailed && opsPos==opsData.size();
+  if (opsMode==OPS_WRITE){
+    size_t slash = opsFile.find_last_of('/');
+    if (slash!=string::npos){
+      makeDirectory(opsFile.substr(0, slash));
+    }
+    // write to a temporary file first so concurrent runs never see a partial cache
+    char pid[32];
+    sprintf(pid, ".tmp%d", (int) getpid());
+    string tmp = opsFile + pid;
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (fp){
+      fwrite(opsData.data(), 1, opsData.size(), fp);
+      fclose(fp);
+      rename(tmp.c_str(), opsFile.c_str());
+      printf("operator cache: wrote %s (%.1f KB)\n", opsFile.c_str(), opsData.size()/1024.0);
+    }else{
+      printf("could not write operator cache %s\n", opsFile.c_str());
+    }
+    ok = 1;
+  }else if (opsMode==OPS_READ){
+    printf("operator cache %s: %s\n", ok ? "hit" : "corrupt", opsFile.c_str());
+  }
+  opsMode = OPS_OFF;
+  opsData.clear();
+  return ok;
+}
+
+/* each field is stored as its name, element size, rows, cols and the
+   column-major data. Returns a pointer to rows*cols elements to fill on
+   read (NULL on a mismatch), or appends data on write. */
+static const char *opsRecord(const char *name, int elemSize, int &rows, int &cols, const void *data){
+
+  if (opsMode==OPS_WRITE){
+    int header[4] = {(int) strlen(name), elemSize, rows, cols};
+    opsData.append((const char*) header, sizeof(header));
+    opsData.append(name, header[0]);
+    opsData.append((const char*) data, (size_t) elemSize*rows*cols);
+    return NULL;
+  }
+  if (opsMode!=OPS_READ || opsFailed){
+    opsFailed = 1;
+    return NULL;
+  }
+
+  int header[4];
+  if (opsPos + sizeof(header) > opsData.size()){
+    opsFailed = 1;
+    return NULL;
+  }
+  memcpy(header, opsData.data() + opsPos, sizeof(header));
+  size_t bytes = (size_t) header[1]*header[2]*header[3];
+  if (header[0]!=(int) strlen(name) || header[1]!=elemSize || header[2] < 0 || header[3] < 0 ||
+      opsPos + sizeof(header) + header[0] + bytes > opsData.size() ||
+      opsData.compare(opsPos + sizeof(header), header[0], name)){
+    opsFailed = 1;
+    return NULL;
+  }
+  rows = header[2];
+  cols = header[3];
+  const char *src = opsData.data() + opsPos + sizeof(header) + header[0];
+  opsPos += sizeof(header) + header[0] + bytes;
+  return src;
+}
+
+void OperatorCacheField(const char *name, MatrixXd &A){
+  int rows = A.rows(), cols = A.cols();
+  const char *src = opsRecord(name, sizeof(double), rows, cols, A.data());
+  if (src){
+    A.resize(rows, cols);
+    memcpy(A.data(), src, A.size()*sizeof(double));
+  }
+}
+
+void OperatorCacheField(const char *name, MatrixXi &A){
+  int rows = A.rows(), cols = A.cols();
+  const char *src = opsRecord(name, sizeof(int), rows, cols, A.data());
+  if (src){
+    A.resize(rows, cols);
+    memcpy(A.data(), src, A.size()*sizeof(int));
+  }
+}
+
+void OperatorCacheField(const char *name, VectorXd &A){
+  int rows = A.rows(), cols = 1;
+  const char *src = opsRecord(name, sizeof(double), rows, cols, A.data());
+  if (src){
+    A.resize(rows);
+    memcpy(A.data(), src, A.size()*sizeof(double));
+  }
+}
+
+void OperatorCacheField(const char *name, VectorXi &A){
+  int rows = A.rows(), cols = 1;
+  const char *src = opsRecord(name, sizeof(int), rows, cols, A.data());
+  if (src){
+    A.resize(rows);
+    memcpy(A.data(), src, A.size()*sizeof(int));
+  }
+}
+
+void OperatorCacheField(const char *name, int &a){
+  int rows = 1, cols = 1;
+  const char *src = opsRecord(name, sizeof(int), rows, cols, &a);
+  if (src){
+    memcpy(&a, src, sizeof(int));
+  }
+}
+
+// BuildIntMatrix arrays (contiguous from A[0]); allocated on read
+void OperatorCacheField(const char *name, int **&A, int rows, int cols){
+  int r = rows, c = cols;
+  const char *src = opsRecord(name, sizeof(int), r, c, opsMode==OPS_WRITE ? A[0] : NULL);
+  if (src && r==rows && c==cols){
+    A = BuildIntMatrix(rows, cols);
+    memcpy(A[0], src, (size_t) rows*cols*sizeof(int));
+  }else if (src){
+    opsFailed = 1;
+  }
+}
+
+/* load a group of reference operators from the cache, or build them with
+   build(mesh) and save them. fields(mesh) lists the members of the group. */
+void CachedOperators(const char *group, Mesh *mesh,
+		     void (*build)(Mesh*), void (*fields)(Mesh*)){
+
+  if (opsBegin(group, OPS_READ)){
+    fields(mesh);
+    if (opsEnd()){
+      return;
+    }
+  }
+  build(mesh);
+  if (opsBegin(group, OPS_WRITE)){
+    fields(mesh);
+    opsEnd();
+  }
+}
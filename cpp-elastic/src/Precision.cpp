@@ -0,0 +1,153 @@
+#include "fem.h"
+
+/* Device precision (setting "precision").
+
+   single: float storage and arithmetic on the device (default)
+   mixed:  float Q/resQ/rhsQ and operators; the RK update kernels and the
+           lift sums accumulate in double (dacc in the kernels)
+   double: double storage and arithmetic
+
+   Device buffers of floating point data are allocated and copied with
+   DeviceFloatMalloc/DeviceFloatCopyFrom/To, which take float or double
+   host arrays and convert when the device type differs, and dfloat kernel
+   arguments are passed through DeviceFloatArg. Everything that feeds the
+   device values is kept in double on the host (operators through
+   setOccaArray, geofacs, Bernstein derivative and lift values, the host
+   fields Q/P), so precision = double never sees float rounding; the host
+   kernels work on dfloat buffers and are only used with precision =
+   single. */
+
+extern occa::device device;
+
+int DevicePrecision(){
+  static int precision = -1;
+  if (precision < 0){
+    string p = GetSetting("precision", "single");
+    if (p=="mixed"){
+      precision = PRECISION_MIXED;
+    }else if (p=="double"){
+      precision = PRECISION_DOUBLE;
+    }else{
+      if (p!="single"){
+	printf("unknown precision %s, using single\n", p.c_str());
+      }
+      precision = PRECISION_SINGLE;
+    }
+  }
+  return precision;
+}
+
+// bytes per floating point value in device buffers
+size_t DeviceFloatSize(){
+  return DevicePrecision()==PRECISION_DOUBLE ? sizeof(double) : sizeof(float);
+}
+
+template <typename T, typename S>
+static void convertArray(T *dst, const S *src, size_t N){
+#pragma omp parallel for
+  for (size_t n = 0; n < N; ++n){
+    dst[n] = (T) src[n];
+  }
+}
+
+// h_a converted to the device type (h_a itself if no conversion is needed)
+template <typename T>
+static const void *toDevice(const T *h_a, size_t N, void *&tmp){
+  tmp = NULL;
+  if (DeviceFloatSize()==sizeof(T)){
+    return h_a;
+  }
+  tmp = malloc(N*DeviceFloatSize());
+  if (DeviceFloatSize()==sizeof(double)){
+    convertArray((double*) tmp, h_a, N);
+  }else{
+    convertArray((float*) tmp, h_a, N);
+  }
+  return tmp;
+}
+
+// device buffer of N values, initialized from h_a
+template <typename T>
+static occa::memory deviceMalloc(size_t N, const T *h_a){
+  void *tmp;
+  occa::memory c_a = device.malloc(N*DeviceFloatSize(), toDevice(h_a, N, tmp));
+  free(tmp);
+  return c_a;
+}
+
+// copy all of c_a from (to) the host
+template <typename T>
+static void deviceCopyFrom(occa::memory &c_a, const T *h_a){
+  const size_t N = c_a.bytes()/DeviceFloatSize();
+  void *tmp;
+  c_a.copyFrom(toDevice(h_a, N, tmp), N*DeviceFloatSize());
+  free(tmp);
+}
+
+template <typename T>
+static void deviceCopyTo(occa::memory &c_a, T *h_a){
+  const size_t N = c_a.bytes()/DeviceFloatSize();
+  if (DeviceFloatSize()==sizeof(T)){
+    c_a.copyTo(h_a, N*sizeof(T));
+    return;
+  }
+  void *tmp = malloc(N*DeviceFloatSize());
+  c_a.copyTo(tmp, N*DeviceFloatSize());
+  if (DeviceFloatSize()==sizeof(double)){
+    convertArray(h_a, (double*) tmp, N);
+  }else{
+    convertArray(h_a, (float*) tmp, N);
+  }
+  free(tmp);
+}
+
+// uninitialized device buffer of N values
+occa::memory DeviceFloatMalloc(size_t N){
+  return device.malloc(N*DeviceFloatSize());
+}
+
+occa::memory DeviceFloatMalloc(size_t N, const float *h_a){
+  return deviceMalloc(N, h_a);
+}
+
+occa::memory DeviceFloatMalloc(size_t N, const double *h_a){
+  return deviceMalloc(N, h_a);
+}
+
+void DeviceFloatCopyFrom(occa::memory &c_a, const float *h_a){
+  deviceCopyFrom(c_a, h_a);
+}
+
+void DeviceFloatCopyFrom(occa::memory &c_a, const double *h_a){
+  deviceCopyFrom(c_a, h_a);
+}
+
+void DeviceFloatCopyTo(occa::memory &c_a, float *h_a){
+  deviceCopyTo(c_a, h_a);
+}
+
+void DeviceFloatCopyTo(occa::memory &c_a, double *h_a){
+  deviceCopyTo(c_a, h_a);
+}
+
+// dfloat kernel argument in the device type
+occa::kernelArg DeviceFloatArg(double a){
+  if (DeviceFloatSize()==sizeof(double)){
+    return occa::kernelArg(a);
+  }
+  return occa::kernelArg((float) a);
+}
+
+// set occa array:: cast to the device type.
+void setOccaArray(MatrixXd A, occa::memory &c_A){
+  if (DeviceFloatSize()==sizeof(double)){
+    c_A = device.malloc(A.size()*sizeof(double), A.data());
+    return;
+  }
+  int r = A.rows();
+  int c = A.cols();
+  float *f_A = (float*)malloc(r*c*sizeof(float));
+  Map<MatrixXf >(f_A,r,c) = A.cast<float>();
+  c_A = device.malloc(r*c*sizeof(float),f_A);
+  free(f_A);
+}
@@ -1,25 +1,15 @@
 #include "fem.h"
 #include "Basis.h"
-#define USEFLOAT4 1
 
-void StartUp3d(Mesh *mesh){
+// polynomial order (see Mesh.h)
+int p_N = p_N_DEFAULT;
 
-  // default to planar elements at startup
-  mesh->KCurved = 0;
-  mesh->KPlanar = mesh->K;
-
-  VectorXi KlistCurved(1); KlistCurved.fill(0);
-  mesh->KlistCurved = KlistCurved;
-  VectorXi KlistCurvedPlusNbrs(1); KlistCurvedPlusNbrs.fill(0);
-  mesh->KlistCurvedPlusNbrs = KlistCurvedPlusNbrs;
+#define USEFLOAT4 1
 
-  VectorXi KlistPlanar(mesh->K);
-  for (int e = 0; e < mesh->K; ++e){
-    KlistPlanar(e) = e;
-  }
-  mesh->KlistPlanar = KlistPlanar;
+// reference element operators: nodes, cubature, nodal and Bernstein matrices
+static void BuildReferenceOperators3d(Mesh *mesh){
 
-  int n, m, k;
+  int k;
 
   // ======= computing points, dmats =======
 
@@ -56,6 +46,7 @@ void StartUp3d(Mesh *mesh){
     }
   }
   mesh->Fmask = Fmask;
+  BuildFacePermutations(mesh, r, s, t);
 
   //cout << "Fmask = " << endl << Fmask << endl;
   //cout << "p_Nfp = " << p_Nfp <<endl;
@@ -264,20 +255,19 @@ void StartUp3d(Mesh *mesh){
   mesh->D2_ids = BuildIntMatrix(p_Np,4);
   mesh->D3_ids = BuildIntMatrix(p_Np,4);
   mesh->D4_ids = BuildIntMatrix(p_Np,4);
-  mesh->D_vals = BuildMatrix(p_Np,4);
+  mesh->D_vals = MatrixXd::Zero(p_Np,4);
   for(int i = 0; i < p_Np; ++i){
     for(int j = 0; j < 4; ++j){
       mesh->D1_ids[i][j] = 0;
       mesh->D2_ids[i][j] = 0;
       mesh->D3_ids[i][j] = 0;
       mesh->D4_ids[i][j] = 0;
-      mesh->D_vals[i][j] = 0.0;
       if (j < D1_ids.cols()){
 	mesh->D1_ids[i][j] = D1_ids(i,j);
 	mesh->D2_ids[i][j] = D2_ids(i,j);
 	mesh->D3_ids[i][j] = D3_ids(i,j);
 	mesh->D4_ids[i][j] = D4_ids(i,j);
-	mesh->D_vals[i][j] = D_vals(i,j);
+	mesh->D_vals(i,j) = D_vals(i,j);
       }
     }
   }
@@ -375,13 +365,12 @@ void StartUp3d(Mesh *mesh){
   // decomposition of LIFT operator
   mesh->EEL_nnz = p_Nfp + 3; // max nonzeros per row
   mesh->EEL_ids = BuildIntMatrix(p_Np,mesh->EEL_nnz);
-  mesh->EEL_vals = BuildMatrix(p_Np,mesh->EEL_nnz);
+  mesh->EEL_vals = MatrixXd::Zero(p_Np,mesh->EEL_nnz);
   for(int i = 0; i < p_Np; ++i){
     for (int j = 0; j < mesh->EEL_nnz; ++j){
-      mesh->EEL_vals[i][j] = 0.0;
       mesh->EEL_ids[i][j] = 0;
       if (j < EEL_ids.cols()){
-	mesh->EEL_vals[i][j] = EEL_vals(i,j);
+	mesh->EEL_vals(i,j) = EEL_vals(i,j);
 	mesh->EEL_ids[i][j] = EEL_ids(i,j);
       }
     }
@@ -395,13 +384,12 @@ void StartUp3d(Mesh *mesh){
 
   int L0_nnz = min(p_Nfp,7); // fixed L0 nnz per row
   mesh->L0_ids = BuildIntMatrix(p_Nfp,L0_nnz);
-  mesh->L0_vals = BuildMatrix(p_Nfp,L0_nnz);
+  mesh->L0_vals = MatrixXd::Zero(p_Nfp,L0_nnz);
   for(int i = 0; i < p_Nfp; ++i){
     for (int j = 0; j < L0_nnz; ++j){
-      mesh->L0_vals[i][j] = 0.0;
       mesh->L0_ids[i][j]  = 0;
       if (j < L0_ids.cols()){
-	mesh->L0_vals[i][j] = L0_vals(i,j);
+	mesh->L0_vals(i,j) = L0_vals(i,j);
 	mesh->L0_ids[i][j]  = L0_ids(i,j);
       }
     }
@@ -510,26 +498,105 @@ void StartUp3d(Mesh *mesh){
   mesh->EEL_id_vec = EEL_id_vec;
   //cout << "EEL val vec = " << endl << EEL_val_vec << endl;
   //cout << "EEL id vec = " << endl << EEL_id_vec << endl;
+}
 
+// members set by BuildReferenceOperators3d (see OperatorCache.cpp)
+static void ReferenceOperatorFields3d(Mesh *mesh){
+  const int L0_nnz = min(p_Nfp,7);
+  OperatorCacheField("V", mesh->V);
+  OperatorCacheField("Fmask", mesh->Fmask);
+  OperatorCacheField("FmaskC", mesh->FmaskC, p_Nfaces, p_Nfp);
+  OperatorCacheField("FPerm", mesh->FPerm);
+  OperatorCacheField("rq", mesh->rq);
+  OperatorCacheField("sq", mesh->sq);
+  OperatorCacheField("tq", mesh->tq);
+  OperatorCacheField("wq", mesh->wq);
+  OperatorCacheField("Nq", mesh->Nq);
+  OperatorCacheField("Nfq", mesh->Nfq);
+  OperatorCacheField("wfqFace", mesh->wfqFace);
+  OperatorCacheField("VfqFace", mesh->VfqFace);
+  OperatorCacheField("rfq", mesh->rfq);
+  OperatorCacheField("sfq", mesh->sfq);
+  OperatorCacheField("tfq", mesh->tfq);
+  OperatorCacheField("Vfq", mesh->Vfq);
+  OperatorCacheField("wfq", mesh->wfq);
+  OperatorCacheField("r", mesh->r);
+  OperatorCacheField("s", mesh->s);
+  OperatorCacheField("t", mesh->t);
+  OperatorCacheField("Dr", mesh->Dr);
+  OperatorCacheField("Ds", mesh->Ds);
+  OperatorCacheField("Dt", mesh->Dt);
+  OperatorCacheField("LIFT", mesh->LIFT);
+  OperatorCacheField("Vq", mesh->Vq);
+  OperatorCacheField("VB", mesh->VB);
+  OperatorCacheField("invVB", mesh->invVB);
+  OperatorCacheField("D1_ids", mesh->D1_ids, p_Np, 4);
+  OperatorCacheField("D2_ids", mesh->D2_ids, p_Np, 4);
+  OperatorCacheField("D3_ids", mesh->D3_ids, p_Np, 4);
+  OperatorCacheField("D4_ids", mesh->D4_ids, p_Np, 4);
+  OperatorCacheField("D_vals", mesh->D_vals);
+  OperatorCacheField("cEL", mesh->cEL);
+  OperatorCacheField("faceVolPerm", mesh->faceVolPerm);
+  OperatorCacheField("EEL_nnz", mesh->EEL_nnz);
+  OperatorCacheField("EEL_ids", mesh->EEL_ids, p_Np, mesh->EEL_nnz);
+  OperatorCacheField("EEL_vals", mesh->EEL_vals);
+  OperatorCacheField("L0_ids", mesh->L0_ids, p_Nfp, L0_nnz);
+  OperatorCacheField("L0_vals", mesh->L0_vals);
+  OperatorCacheField("vol_ids", mesh->vol_ids);
+  OperatorCacheField("slice_ids", mesh->slice_ids);
+  OperatorCacheField("EEL_val_vec", mesh->EEL_val_vec);
+  OperatorCacheField("EEL_id_vec", mesh->EEL_id_vec);
+}
 
-  // ====================================================
+void StartUp3d(Mesh *mesh){
+
+  // dof and face node offsets are dlong, 32-bit unless built with DLONG=1
+  const double Nids = max((double) mesh->K*p_Np*p_Nfields, (double) mesh->K*p_Nfp*p_Nfaces);
+  if (sizeof(dlong) < 8 && Nids > 2147483647.0){
+    printf("BBDG ERROR: %.4g dof/face node ids need 64-bit indices, rebuild with DLONG=1\n", Nids);
+    exit(1);
+  }
+
+  // element and face offsets (EToE, codes, 4 fgeo per face) stay int in either build
+  if ((double) mesh->K*p_Nfaces*4 > 2147483647.0){
+    printf("BBDG ERROR: %d elements overflow the int element/face offsets\n", mesh->K);
+    exit(1);
+  }
+
+  // default to planar elements at startup
+  mesh->KCurved = 0;
+  mesh->KPlanar = mesh->K;
+
+  VectorXi KlistCurved(1); KlistCurved.fill(0);
+  mesh->KlistCurved = KlistCurved;
+  VectorXi KlistCurvedPlusNbrs(1); KlistCurvedPlusNbrs.fill(0);
+  mesh->KlistCurvedPlusNbrs = KlistCurvedPlusNbrs;
+
+  VectorXi KlistPlanar(mesh->K);
+  for (int e = 0; e < mesh->K; ++e){
+    KlistPlanar(e) = e;
+  }
+  mesh->KlistPlanar = KlistPlanar;
+
+  // reference element operators (or load them from the operator cache)
+  CachedOperators("StartUp3d", mesh, BuildReferenceOperators3d, ReferenceOperatorFields3d);
 
   // low storage RK coefficients
-  mesh->rk4a = BuildVector(5);
+  mesh->rk4a = (double*) calloc(5, sizeof(double));
   mesh->rk4a[0] =              0.0;
   mesh->rk4a[1] =  -567301805773.0 / 1357537059087.0;
   mesh->rk4a[2] = -2404267990393.0 / 2016746695238.0;
   mesh->rk4a[3] = -3550918686646.0 / 2091501179385.0;
   mesh->rk4a[4] = -1275806237668.0 /  842570457699.0;
 
-  mesh->rk4b = BuildVector(5);
+  mesh->rk4b = (double*) calloc(5, sizeof(double));
   mesh->rk4b[0] =  1432997174477.0 /  9575080441755.0;
   mesh->rk4b[1] =  5161836677717.0 / 13612068292357.0;
   mesh->rk4b[2] =  1720146321549.0 /  2090206949498.0;
   mesh->rk4b[3] =  3134564353537.0 /  4481467310338.0;
   mesh->rk4b[4] =  2277821191437.0 / 14882151754819.0;
 
-  mesh->rk4c = BuildVector(6);
+  mesh->rk4c = (double*) calloc(6, sizeof(double));
   mesh->rk4c[0] =              0.0;
   mesh->rk4c[1] =  1432997174477.0 / 9575080441755.0;
   mesh->rk4c[2] =  2526269341429.0 / 6820363962896.0;
@@ -545,8 +612,9 @@ void StartUp3d(Mesh *mesh){
   mesh->y.resize(p_Np,mesh->K);
   mesh->z.resize(p_Np,mesh->K);
 
-  for(k=0;k<mesh->K;++k){
-    for(n=0;n<p_Np;++n){
+#pragma omp parallel for
+  for(int k=0;k<mesh->K;++k){
+    for(int n=0;n<p_Np;++n){
       //dfloat r = mesh->r[n];
       //dfloat s = mesh->s[n];
       //dfloat t = mesh->t[n];
@@ -575,36 +643,43 @@ void StartUp3d(Mesh *mesh){
   }
 
   // compute geofacs for straight-sided mesh [JC]
-  mesh->rx.resize(p_Np,mesh->K);
-  mesh->sx.resize(p_Np,mesh->K);
-  mesh->tx.resize(p_Np,mesh->K);
-  mesh->ry.resize(p_Np,mesh->K);
-  mesh->sy.resize(p_Np,mesh->K);
-  mesh->ty.resize(p_Np,mesh->K);
-  mesh->rz.resize(p_Np,mesh->K);
-  mesh->sz.resize(p_Np,mesh->K);
-  mesh->tz.resize(p_Np,mesh->K);
-  mesh->J.resize( p_Np,mesh->K);
-
-  mesh->nx.resize(p_Nfp*p_Nfaces,mesh->K);
-  mesh->ny.resize(p_Nfp*p_Nfaces,mesh->K);
-  mesh->nz.resize(p_Nfp*p_Nfaces,mesh->K);
-  mesh->sJ.resize(p_Nfp*p_Nfaces,mesh->K);
-
-  double drdx, dsdx, dtdx;
-  double drdy, dsdy, dtdy;
-  double drdz, dsdz, dtdz, J;
-  double *nxk = (double*) calloc(mesh->Nfaces,sizeof(double));//BuildVector(mesh->Nfaces);
-  double *nyk = (double*) calloc(mesh->Nfaces,sizeof(double));//BuildVector(mesh->Nfaces);
-  double *nzk = (double*) calloc(mesh->Nfaces,sizeof(double));//BuildVector(mesh->Nfaces);
-  double *sJk = (double*) calloc(mesh->Nfaces,sizeof(double));//BuildVector(mesh->Nfaces);
+  // (lean_mesh: only J, one value per element; the rest are rebuilt on the fly)
+  const int lean = LeanMesh();
+  if (!lean){
+    mesh->rx.resize(p_Np,mesh->K);
+    mesh->sx.resize(p_Np,mesh->K);
+    mesh->tx.resize(p_Np,mesh->K);
+    mesh->ry.resize(p_Np,mesh->K);
+    mesh->sy.resize(p_Np,mesh->K);
+    mesh->ty.resize(p_Np,mesh->K);
+    mesh->rz.resize(p_Np,mesh->K);
+    mesh->sz.resize(p_Np,mesh->K);
+    mesh->tz.resize(p_Np,mesh->K);
+
+    mesh->nx.resize(p_Nfp*p_Nfaces,mesh->K);
+    mesh->ny.resize(p_Nfp*p_Nfaces,mesh->K);
+    mesh->nz.resize(p_Nfp*p_Nfaces,mesh->K);
+    mesh->sJ.resize(p_Nfp*p_Nfaces,mesh->K);
+  }
+  mesh->J.resize(lean ? 1 : p_Np,mesh->K);
+
+#pragma omp parallel for
   for(int k=0;k<mesh->K;++k){
 
+    double drdx, dsdx, dtdx;
+    double drdy, dsdy, dtdy;
+    double drdz, dsdz, dtdz, J;
+    double nxk[p_Nfaces], nyk[p_Nfaces], nzk[p_Nfaces], sJk[p_Nfaces];
     GeometricFactors3d(mesh, k,
 		       &drdx, &dsdx, &dtdx,
 		       &drdy, &dsdy, &dtdy,
 		       &drdz, &dsdz, &dtdz, &J);
 
+    mesh->J.col(k).fill(J);
+    if (lean){
+      continue;
+    }
+
     mesh->rx.col(k).fill(drdx);
     mesh->sx.col(k).fill(dsdx);
     mesh->tx.col(k).fill(dtdx);
@@ -614,7 +689,6 @@ void StartUp3d(Mesh *mesh){
     mesh->rz.col(k).fill(drdz);
     mesh->sz.col(k).fill(dsdz);
     mesh->tz.col(k).fill(dtdz);
-    mesh->J.col(k).fill(J);
 
     Normals3d(mesh, k, nxk, nyk, nzk, sJk);
 
@@ -635,326 +709,376 @@ void StartUp3d(Mesh *mesh){
     }
   }
 
-  // build node-node connectivity maps
-  void BuildMaps3d(Mesh *mesh);
-  BuildMaps3d(mesh);
+  // build node-node connectivity maps (or use them in place from the mesh cache)
+  const dlong NfpK = (dlong) p_Nfp*p_Nfaces*mesh->K;
+  mesh->vmapM = (dlong*) MeshCacheMap("vmapM", NfpK*sizeof(dlong));
+  mesh->vmapP = (dlong*) MeshCacheMap("vmapP", NfpK*sizeof(dlong));
+  mesh->mapM = (dlong*) MeshCacheMap("mapM", NfpK*sizeof(dlong));
+  mesh->mapP = (dlong*) MeshCacheMap("mapP", NfpK*sizeof(dlong));
+  if (!(mesh->vmapM && mesh->vmapP && mesh->mapM && mesh->mapP)){
+    mesh->vmapM = (dlong*) calloc(NfpK, sizeof(dlong));
+    mesh->vmapP = (dlong*) calloc(NfpK, sizeof(dlong));
+    mesh->mapM = (dlong*) calloc(NfpK, sizeof(dlong));
+    mesh->mapP = (dlong*) calloc(NfpK, sizeof(dlong));
+    BuildMaps3d(mesh);
+    MeshCacheAdd("vmapM", mesh->vmapM, NfpK*sizeof(dlong));
+    MeshCacheAdd("vmapP", mesh->vmapP, NfpK*sizeof(dlong));
+    MeshCacheAdd("mapM", mesh->mapM, NfpK*sizeof(dlong));
+    MeshCacheAdd("mapP", mesh->mapP, NfpK*sizeof(dlong));
+  }
 
 }
 
-void BuildMaps3d(Mesh *mesh){
+// vertices of each face (as in FacePair3d) and the 6 ways to match them up
+static const int faceVerts[4][3] = { {0,1,2}, {0,1,3}, {1,2,3}, {0,2,3} };
+static const int facePerms[6][3] = { {0,1,2}, {0,2,1}, {1,0,2}, {1,2,0}, {2,0,1}, {2,1,0} };
+
+/* FPerm(i, (f*Nfaces + fP)*6 + o) is the node of face fP matching node i of
+   face f when vertex m of f is vertex facePerms[o][m] of fP. Found once
+   per N by comparing barycentric coordinates on the reference element. */
+void BuildFacePermutations(Mesh *mesh, VectorXd r, VectorXd s, VectorXd t){
+
+  MatrixXd lam(p_Np,4);
+  for (int n = 0; n < p_Np; ++n){
+    lam(n,0) = -.5*(1. + r(n) + s(n) + t(n));
+    lam(n,1) = .5*(1. + r(n));
+    lam(n,2) = .5*(1. + s(n));
+    lam(n,3) = .5*(1. + t(n));
+  }
 
-  //printf("Hello %d\n", 1002);
+  mesh->FPerm.resize(p_Nfp, p_Nfaces*p_Nfaces*6);
+  for (int f = 0; f < p_Nfaces; ++f){
+    for (int fP = 0; fP < p_Nfaces; ++fP){
+      for (int o = 0; o < 6; ++o){
+	const int col = (f*p_Nfaces + fP)*6 + o;
+	for (int i = 0; i < p_Nfp; ++i){
+	  const int n = mesh->Fmask(i,f);
+	  mesh->FPerm(i,col) = -1;
+	  for (int j = 0; j < p_Nfp; ++j){
+	    const int nP = mesh->Fmask(j,fP);
+	    double d = 0.;
+	    for (int m = 0; m < 3; ++m){
+	      d += fabs(lam(n,faceVerts[f][m]) - lam(nP,faceVerts[fP][facePerms[o][m]]));
+	    }
+	    if (d < NODETOL){
+	      mesh->FPerm(i,col) = j;
+	      break;
+	    }
+	  }
+	}
+      }
+    }
+  }
+}
 
-  int K       = mesh->K;
-  int Nfaces  = mesh->Nfaces;
+// orientation o of face f of element k relative to its neighbor face (0 on boundaries)
+int FaceOrientation(Mesh *mesh, int k, int f){
 
-  mesh->vmapM = BuildIntVector(p_Nfp*p_Nfaces*K);
-  mesh->vmapP = BuildIntVector(p_Nfp*p_Nfaces*K);
+  const int kP = mesh->EToE[k][f];
+  const int fP = mesh->EToF[k][f];
+  if (kP==k){
+    return 0;
+  }
+  int perm[3] = {0,0,0};
+  for (int m = 0; m < 3; ++m){
+    const int v = mesh->EToV[k][faceVerts[f][m]];
+    for (int mP = 0; mP < 3; ++mP){
+      if (mesh->EToV[kP][faceVerts[fP][mP]]==v){
+	perm[m] = mP;
+      }
+    }
+  }
+  for (int o = 0; o < 6; ++o){
+    if (perm[0]==facePerms[o][0] && perm[1]==facePerms[o][1]){
+      return o;
+    }
+  }
+  return 0;
+}
 
-  mesh->mapM = BuildIntVector(p_Nfp*p_Nfaces*K);
-  mesh->mapP = BuildIntVector(p_Nfp*p_Nfaces*K);
+/* Compact connectivity: the FPerm tables (Nfaces*Nfaces*6 columns of Nfp
+   nodes) followed by one code kP*Nfaces*Nfaces*6 + (f*Nfaces + fP)*6 + o
+   per element face, as dlong like the vmapP it replaces. Together with
+   Fmask this gives the neighbor node of every face node; see vmapPid in
+   the OKL sources. */
+dlong *BuildCompactConnectivity(Mesh *mesh){
 
-  int m;
-  int k1,f1,p1,n1,id1, k2,f2,p2,n2,id2;
+  const int Nperm = p_Nfaces*p_Nfaces*6;
+  dlong *conn = (dlong*) malloc((Nperm*p_Nfp + (size_t) mesh->K*p_Nfaces)*sizeof(dlong));
+  for (int col = 0; col < Nperm; ++col){
+    for (int i = 0; i < p_Nfp; ++i){
+      conn[i + col*p_Nfp] = mesh->FPerm(i,col);
+    }
+  }
+  dlong *codes = conn + Nperm*p_Nfp;
+  for (int k = 0; k < mesh->K; ++k){
+    for (int f = 0; f < p_Nfaces; ++f){
+      const int kP = mesh->EToE[k][f];
+      const int fP = mesh->EToF[k][f];
+      codes[f + k*p_Nfaces] = (dlong) kP*Nperm + (f*p_Nfaces + fP)*6 + FaceOrientation(mesh, k, f);
+    }
+  }
+  return conn;
+}
 
-  double x1, y1,z1, x2, y2, z2, d12;
+/* Node-node connectivity from the face vertex ordering: node n1 of face f1
+   of k1 matches node FPerm(n1, (f1*Nfaces + f2)*6 + o) of face f2 of k2,
+   with o = FaceOrientation(mesh,k1,f1). This is O(Nfp) per face instead of
+   a coordinate search; verify_maps = 1 still checks every pair against
+   NODETOL. */
+void BuildMaps3d(Mesh *mesh){
+  //printf("Hello %d\n", 1002);
+  int K       = mesh->K;
+  int Nfaces  = mesh->Nfaces;
 
-  double *nxk = (double*) calloc(mesh->Nfaces,sizeof(double));//BuildVector(Nfaces);
-  double *nyk = (double*) calloc(mesh->Nfaces,sizeof(double));//BuildVector(Nfaces);
-  double *nzk = (double*) calloc(mesh->Nfaces,sizeof(double));//BuildVector(Nfaces);
-  double *sJk = (double*) calloc(mesh->Nfaces,sizeof(double));//BuildVector(Nfaces);
+  // vmapM, vmapP, mapM, mapP are allocated by the caller
 
   printf("Hello %d\n", 1001);
+#pragma omp parallel for
+  for(int k1=0;k1<K;++k1){
+    for(int f1=0;f1<Nfaces;++f1){
 
-  /* first build local */
-  for(k1=0;k1<K;++k1){
+      /* find neighbor (k2==k1, f2==f1 and identity orientation on boundaries) */
+      int k2 = mesh->EToE[k1][f1];
+      int f2 = mesh->EToF[k1][f1];
+      int col = (f1*Nfaces + f2)*6 + FaceOrientation(mesh, k1, f1);
 
-    /* get some information about the face geometries */
-    Normals3d(mesh, k1, nxk, nyk, nzk, sJk);
+      for(int n1=0;n1<p_Nfp;++n1){
+	int n2 = mesh->FPerm(n1,col);
+	dlong id1 = n1+f1*p_Nfp+(dlong) k1*p_Nfp*p_Nfaces;
+	dlong id2 = n2+f2*p_Nfp+(dlong) k2*p_Nfp*p_Nfaces;
 
-    for(f1=0;f1<Nfaces;++f1){
-
-      /* volume -> face nodes */
-      for(n1=0;n1<p_Nfp;++n1){
-	id1 = n1+f1*p_Nfp+k1*p_Nfp*p_Nfaces;
-	mesh->vmapM[id1] = mesh->FmaskC[f1][n1] + k1*p_Np;
+	mesh->vmapM[id1] = mesh->FmaskC[f1][n1] + (dlong) k1*p_Np;
 	mesh->mapM[id1] = id1;
+	mesh->vmapP[id1] = mesh->FmaskC[f2][n2] + (dlong) k2*p_Np;
+	mesh->mapP[id1] = id2;
       }
+    }
+  }
 
-      /* find neighbor */
-      k2 = mesh->EToE[k1][f1];
-      f2 = mesh->EToF[k1][f1];
-
-      if(k1==k2){
-	for(n1=0;n1<p_Nfp;++n1){
-	  id1 = n1+f1*p_Nfp+k1*p_Nfp*p_Nfaces;
-	  mesh->vmapP[id1] = k1*p_Np + mesh->FmaskC[f1][n1];
-	  mesh->mapP[id1] = mesh->mapM[id1];
-	}
-      }else{
-	/* treat as boundary for the moment  */
+  if (GetIntSetting("verify_maps", 0)){
+    int lost = 0;
+#pragma omp parallel for reduction(+:lost)
+    for(dlong id1=0;id1<(dlong) p_Nfp*p_Nfaces*K;++id1){
+      dlong idM = mesh->vmapM[id1], idP = mesh->vmapP[id1];
+      double dx = mesh->x(idM%p_Np,idM/p_Np) - mesh->x(idP%p_Np,idP/p_Np);
+      double dy = mesh->y(idM%p_Np,idM/p_Np) - mesh->y(idP%p_Np,idP/p_Np);
+      double dz = mesh->z(idM%p_Np,idM/p_Np) - mesh->z(idP%p_Np,idP/p_Np);
+      if (dx*dx + dy*dy + dz*dz >= NODETOL){
+	printf("LOST NODE on elem %d, face %d!!!\n",(int) (id1/(p_Nfp*p_Nfaces)),(int) ((id1/p_Nfp)%p_Nfaces));
+	++lost;
+      }
+    }
+    printf("verify_maps: %d of %.0f face nodes do not match\n", lost, (double) p_Nfp*p_Nfaces*K);
+  }
+  printf("Hello %d\n", 1337);
+  return;
+}
 
-	for(n1=0;n1<p_Nfp;++n1){
-	  id1 = n1+f1*p_Nfp+k1*p_Nfp*p_Nfaces;
+// brute-force match of the points on face f1 of k1 and face f2 of k2
+static void MatchFacePoints(MatrixXd &xf, MatrixXd &yf, MatrixXd &zf, int Nfpts,
+			    int k1, int f1, int k2, int f2, int *perm){
 
-	  x1 = mesh->x(mesh->FmaskC[f1][n1],k1);
-	  y1 = mesh->y(mesh->FmaskC[f1][n1],k1);
-	  z1 = mesh->z(mesh->FmaskC[f1][n1],k1);
+  for(int i = 0; i < Nfpts; ++i){
 
-	  for(n2=0;n2<p_Nfp;++n2){
+    double minDist = 1000.0;
 
-	    id2 = n2+f2*p_Nfp+k2*p_Nfp*p_Nfaces;
+    int id1 = i + Nfpts * f1;
+    double x1 = xf(id1,k1), y1 = yf(id1,k1), z1 = zf(id1,k1);
+    perm[i] = -1;
+    for(int j = 0; j < Nfpts; ++j){
 
-	    x2 = mesh->x(mesh->FmaskC[f2][n2],k2);
-	    y2 = mesh->y(mesh->FmaskC[f2][n2],k2);
-	    z2 = mesh->z(mesh->FmaskC[f2][n2],k2);
+      int id2 = j + Nfpts * f2;
+      double x2 = xf(id2,k2), y2 = yf(id2,k2), z2 = zf(id2,k2);
 
-	    /* find normalized distance between these nodes */
-	    /* [ use sJk as a measure of edge length (ignore factor of 2) ] */
-	    d12 = ((x1-x2)*(x1-x2) +
-		   (y1-y2)*(y1-y2) +
-		   (z1-z2)*(z1-z2)); /* /(sJk[f1]*sJk[f1]);  */
-	    if(d12<NODETOL){
-	      mesh->vmapP[id1] = k2*p_Np + mesh->FmaskC[f2][n2];
-	      mesh->mapP[id1] = id2;
-	      break;
-	    }
-	  }
-	  if(n2==p_Nfp){
-	    //printf("LOST NODE on elem %d, face %d!!!\n",k1,f1);
-	    printf("LOST NODE on elem %d, face %d!!!  ",k1,f1);
-	    printf("EToE(%d,:) = ",k1);
-	    for (int f = 0; f < p_Nfaces; ++f){
-	      printf("%d ",mesh->EToE[k1][f]);
-	    }
-	    printf(", EToF(%d,:) = ",k1);
-	    for (int f = 0; f < p_Nfaces; ++f){
-	      printf("%d ",mesh->EToF[k1][f]);
-	    }
-	    printf("\n");
-	    
-	  }
-	}
+      // find distance between these nodes
+      double d12 = (x1-x2)*(x1-x2) + (y1-y2)*(y1-y2) + (z1-z2)*(z1-z2);
+      minDist = min(minDist,d12);
+      if (d12<NODETOL){
+	perm[i] = j;
+	break;
       }
     }
-  }
-
-#if 0
-  for (int i = 0; i < p_Nfp*p_Nfaces;++i){
-    printf("mesh->mapP[%d] = ",i);
-    for (int e= 0; e < mesh->K; ++e){
-      int id = i + e*p_Nfp*p_Nfaces;
-      printf("%d ", mesh->mapP[id]);
+    if(perm[i] < 0){
+      MatrixXd xM(Nfpts,3);
+      MatrixXd xP(Nfpts,3);
+      for(int j = 0; j < Nfpts; ++j){
+	xM(j,0) = xf(j + Nfpts*f1,k1); xM(j,1) = yf(j + Nfpts*f1,k1); xM(j,2) = zf(j + Nfpts*f1,k1);
+	xP(j,0) = xf(j + Nfpts*f2,k2); xP(j,1) = yf(j + Nfpts*f2,k2); xP(j,2) = zf(j + Nfpts*f2,k2);
+      }
+      printf("BuildFaceNodeMaps: lost node %d on elems %d, %d. min dist = %g\n",i,k1,k2,minDist);
+      cout << "xM = " << endl << xM << endl;
+      cout << "xP = " << endl << xP << endl;
     }
-    printf("\n");
   }
-#endif
-  return;
 }
 
-
-// general: input nodes (ex: quadrature nodes), get map back
+/* general: input nodes (ex: quadrature nodes), get map back. Face points
+   are matched by coordinates once for the first face with a given
+   (f1, f2, orientation) and the permutation is reused for all others. */
 void BuildFaceNodeMaps(Mesh *mesh, MatrixXd xf, MatrixXd yf, MatrixXd zf,
 		       MatrixXi &mapP){
 
   int K       = mesh->K;
   int Nfaces  = mesh->Nfaces;
-  //  printf("In buildfacenodemaps Nfaces = %d\n",Nfaces);
 
   mapP.resize(xf.rows(),K);
   mapP.fill(-1);
 
   int Nfpts = xf.rows() / Nfaces; // assume same # qpts per face
 
-  int m;
-  int k1,p1,n1,f1,k2,p2,n2,f2;
-
-  double x1, y1, z1, x2, y2, z2, d12;
-
-  printf("Hello %d\n", 1337);
-
-  // first build local
-  for(k1=0;k1<K;++k1){
+  // one point permutation per (f1, f2, orientation)
+  const int Nperm = Nfaces*Nfaces*6;
+  MatrixXi perm(Nfpts,Nperm);
+  vector<int> matched(Nperm,0);
+  for(int k1=0;k1<K;++k1){
+    for(int f1=0;f1<Nfaces;++f1){
+      int k2 = mesh->EToE[k1][f1];
+      int f2 = mesh->EToF[k1][f1];
+      int col = (f1*Nfaces + f2)*6 + FaceOrientation(mesh, k1, f1);
+      if (k1!=k2 && !matched[col]){
+	MatchFacePoints(xf, yf, zf, Nfpts, k1, f1, k2, f2, perm.data() + col*Nfpts);
+	matched[col] = 1;
+      }
+    }
+  }
 
-    for(f1=0;f1<Nfaces;++f1){
+#pragma omp parallel for
+  for(int k1=0;k1<K;++k1){
+    for(int f1=0;f1<Nfaces;++f1){
 
       // find neighbor
-      k2 = mesh->EToE[k1][f1];
-      f2 = mesh->EToF[k1][f1];
+      int k2 = mesh->EToE[k1][f1];
+      int f2 = mesh->EToF[k1][f1];
 
       if(k1==k2){
 	for(int i = 0; i < Nfpts; ++i){
 	  mapP(i + f1*Nfpts,k1) = i + f1*Nfpts + xf.rows()*k1;
 	}
       }else{
-
-        MatrixXd xM(Nfpts,3);
-        MatrixXd xP(Nfpts,3);
-        for(int i = 0; i < Nfpts; ++i){
-	  int id1 = i + Nfpts * f1;
-	  x1 = xf(id1,k1); y1 = yf(id1,k1); z1 = zf(id1,k1);
-          int id2 = i + Nfpts * f2;
-          x2 = xf(id2,k2); y2 = yf(id2,k2); z2 = zf(id2,k2);
-
-          xM(i,0) = x1; xM(i,1) = y1; xM(i,2) = z1;
-          xP(i,0) = x2; xP(i,1) = y2; xP(i,2) = z2;
-        }
-
+	int col = (f1*Nfaces + f2)*6 + FaceOrientation(mesh, k1, f1);
 	for(int i = 0; i < Nfpts; ++i){
-
-	  double minDist = 1000.0;
-
-	  int id1 = i + Nfpts * f1;
-	  x1 = xf(id1,k1); y1 = yf(id1,k1); z1 = zf(id1,k1);
-          bool node_found = false;
-	  for(int j = 0; j < Nfpts; ++j){
-
-	    int id2 = j + Nfpts * f2;
-	    x2 = xf(id2,k2); y2 = yf(id2,k2); z2 = zf(id2,k2);
-
-	    // find distance between these nodes
-	    d12 = (x1-x2)*(x1-x2) + (y1-y2)*(y1-y2) + (z1-z2)*(z1-z2);
-	    minDist = min(minDist,d12);
-	    if (d12<NODETOL){
-	      mapP(id1,k1) = id2 + xf.rows()*k2;
-	      node_found = true;
-	      break;
-	    }
+	  int j = perm(i,col);
+	  if (j >= 0){
+	    mapP(i + f1*Nfpts,k1) = j + f2*Nfpts + xf.rows()*k2;
 	  }
-          if(!node_found){
-            printf("BuildFaceNodeMaps: lost node %d on elems %d, %d. min dist = %g\n",i,k1,k2,minDist);
-            cout << "xM = " << endl << xM << endl;
-            cout << "xP = " << endl << xP << endl;
-          }
 	}
       }
-
     }// faces
   }// k
 
+  if (GetIntSetting("verify_maps", 0)){
+    int lost = 0;
+    for(int k1=0;k1<K;++k1){
+      for(int id1 = 0; id1 < xf.rows(); ++id1){
+	int idP = mapP(id1,k1);
+	if (idP < 0){
+	  ++lost;
+	  continue;
+	}
+	int k2 = idP / xf.rows(), id2 = idP % xf.rows();
+	double dx = xf(id1,k1)-xf(id2,k2), dy = yf(id1,k1)-yf(id2,k2), dz = zf(id1,k1)-zf(id2,k2);
+	lost += (dx*dx + dy*dy + dz*dz >= NODETOL);
+      }
+    }
+    printf("verify_maps: %d of %d face points do not match\n", lost, (int) (xf.rows()*K));
+  }
 
   return;
 
 }
 
 
-void InitQuadratureArrays(Mesh *mesh){
+/* cubature geofacs rxq..sJq (not stored in lean mode) and from them the
+   Jacobian extremes and hMax: stats = minJ, minJelem, maxJ, maxJelem, hMax */
+static void QuadratureGeofacs(Mesh *mesh, double *stats){
 
-  int Nq = mesh->Nq;
-  int Nfq = mesh->Nfq;
-  int Nfaces = mesh->Nfaces;
+  const int K = mesh->K;
+  const int Nq = mesh->Vq.rows();
+  const int lean = LeanMesh();
 
-  // matlab-esque: requires uniform p across elements
-  MatrixXd Vq = mesh->Vq;
-  MatrixXd xq(Vq.rows(),mesh->K);
-  MatrixXd yq(Vq.rows(),mesh->K);
-  MatrixXd zq(Vq.rows(),mesh->K);
-
-  // interpolate to cubature points
-  for (int e = 0; e < mesh->K; ++e){
-    xq.col(e) = Vq*(mesh->x.col(e));
-    yq.col(e) = Vq*(mesh->y.col(e));
-    zq.col(e) = Vq*(mesh->z.col(e));
+  // interp deriv matrices to face cubature points
+  MatrixXd Vrftmp,Vsftmp,Vtftmp;
+  GradVandermonde3D(p_N,mesh->rfq,mesh->sfq,mesh->tfq,Vrftmp,Vsftmp,Vtftmp);
+  MatrixXd Vrf = mrdivide(Vrftmp,mesh->V);
+  MatrixXd Vsf = mrdivide(Vsftmp,mesh->V);
+  MatrixXd Vtf = mrdivide(Vtftmp,mesh->V);
+  const int Nfq = mesh->rfq.rows();
+
+  if (!lean){
+    mesh->rxq.resize(Nq,K);  mesh->sxq.resize(Nq,K);  mesh->txq.resize(Nq,K);
+    mesh->ryq.resize(Nq,K);  mesh->syq.resize(Nq,K);  mesh->tyq.resize(Nq,K);
+    mesh->rzq.resize(Nq,K);  mesh->szq.resize(Nq,K);  mesh->tzq.resize(Nq,K);
+    mesh->Jq.resize(Nq,K);
+    mesh->nxq.resize(Nfq,K);  mesh->nyq.resize(Nfq,K);  mesh->nzq.resize(Nfq,K);
+    mesh->sJq.resize(Nfq,K);
   }
 
-  mesh->xq = xq;
-  mesh->yq = yq;
-  mesh->zq = zq;
-
-  // interp deriv matrices to quadrature
-  MatrixXd Vrqtmp,Vsqtmp,Vtqtmp;
-  GradVandermonde3D(p_N,mesh->rq,mesh->sq,mesh->tq,Vrqtmp,Vsqtmp,Vtqtmp);
-  MatrixXd Vrq = mrdivide(Vrqtmp,mesh->V);
-  MatrixXd Vsq = mrdivide(Vsqtmp,mesh->V);
-  MatrixXd Vtq = mrdivide(Vtqtmp,mesh->V);
+  // per-element extremes of J and sJ (for hMax)
+  VectorXd minJk(K), maxJk(K), maxsJk(K);
+
+  // volume and surface geofacs by blocks of elements, one workspace per thread
+#pragma omp parallel
+  {
+    MatrixXd w(max(Nq,Nfq), 9*GEO_BLOCK);
+
+    // lean: block buffers in place of the whole-mesh arrays
+    MatrixXd vbuf[10], sbuf[4];
+    MatrixXd *vgeo[10] = {&mesh->rxq, &mesh->sxq, &mesh->txq,
+			  &mesh->ryq, &mesh->syq, &mesh->tyq,
+			  &mesh->rzq, &mesh->szq, &mesh->tzq, &mesh->Jq};
+    MatrixXd *sgeo[4] = {&mesh->nxq, &mesh->nyq, &mesh->nzq, &mesh->sJq};
+    if (lean){
+      for (int c = 0; c < 10; ++c){
+	vbuf[c].resize(Nq,GEO_BLOCK);
+	vgeo[c] = vbuf + c;
+      }
+      for (int c = 0; c < 4; ++c){
+	sbuf[c].resize(Nfq,GEO_BLOCK);
+	sgeo[c] = sbuf + c;
+      }
+    }
 
-  mesh->Vq = Vq;
-  mesh->Vrq = Vrq;
-  mesh->Vsq = Vsq;
-  mesh->Vtq = Vtq;
-
-  MatrixXd rxq,sxq,txq,ryq,syq,tyq,rzq,szq,tzq,Jq;
-  rxq.resize(Vq.rows(),mesh->K);  sxq.resize(Vq.rows(),mesh->K);  txq.resize(Vq.rows(),mesh->K);
-  ryq.resize(Vq.rows(),mesh->K);  syq.resize(Vq.rows(),mesh->K);  tyq.resize(Vq.rows(),mesh->K);
-  rzq.resize(Vq.rows(),mesh->K);  szq.resize(Vq.rows(),mesh->K);  tzq.resize(Vq.rows(),mesh->K);
-  Jq.resize(Vq.rows(),mesh->K);
-  for (int e = 0; e < mesh->K; ++e){
-    MatrixXd vgeo = vgeofacs3d(mesh->x.col(e),
-			       mesh->y.col(e),
-			       mesh->z.col(e),
-			       Vrq,Vsq,Vtq);
-    rxq.col(e) = vgeo.col(0);    sxq.col(e) = vgeo.col(1);    txq.col(e) = vgeo.col(2);
-    ryq.col(e) = vgeo.col(3);    syq.col(e) = vgeo.col(4);    tyq.col(e) = vgeo.col(5);
-    rzq.col(e) = vgeo.col(6);    szq.col(e) = vgeo.col(7);    tzq.col(e) = vgeo.col(8);
-    Jq.col(e)  = vgeo.col(9);
+#pragma omp for schedule(static)
+    for (int e0 = 0; e0 < K; e0 += GEO_BLOCK){
+      const int Kb = min(GEO_BLOCK, K-e0);
+      const int o0 = lean ? 0 : e0;
+      vgeofacs3d(mesh->x,mesh->y,mesh->z,e0,Kb,mesh->Vrq,mesh->Vsq,mesh->Vtq,w,vgeo,o0);
+      sgeofacs3d(mesh->x,mesh->y,mesh->z,e0,Kb,Vrf,Vsf,Vtf,w,sgeo,o0);
+      for (int e = 0; e < Kb; ++e){
+	minJk(e0+e) = vgeo[9]->col(o0+e).minCoeff();
+	maxJk(e0+e) = vgeo[9]->col(o0+e).maxCoeff();
+	maxsJk(e0+e) = sgeo[3]->col(o0+e).maxCoeff();
+      }
+    }
   }
-  mesh->Jq = Jq;
-  mesh->rxq = rxq;
-  mesh->ryq = ryq;
-  mesh->rzq = rzq;
-  mesh->sxq = sxq;
-  mesh->syq = syq;
-  mesh->szq = szq;
-  mesh->txq = txq;
-  mesh->tyq = tyq;
-  mesh->tzq = tzq;
-
-  double maxJ = Jq.maxCoeff();
-  double minJ = Jq.minCoeff();
+
+  double maxJ = maxJk.maxCoeff();
+  double minJ = minJk.minCoeff();
   int minJelem = -1;
-  for (int e = 0; e < mesh->K; ++e){
-    if (Jq.col(e).minCoeff() == minJ){
+  for (int e = 0; e < K; ++e){
+    if (minJk(e) == minJ){
       minJelem = e;
       break;
     }
   }
   int maxJelem = -1;
-  for (int e = 0; e < mesh->K; ++e){
-    if (Jq.col(e).maxCoeff() == maxJ){
+  for (int e = 0; e < K; ++e){
+    if (maxJk(e) == maxJ){
       maxJelem = e;
       break;
     }
   }
-  printf("Minimum Jacobian = %g on elem %d, max Jacobian = %g, on elem %d\n",
-	 minJ,minJelem,maxJ,maxJelem);
-
-  // interpolate to face cubature points
-  MatrixXd Vfq = mesh->Vfq;
-
-  // interp face nodes to face qnodes matrix
-  MatrixXd VfqFace = mesh->VfqFace;
-  MatrixXd nxq,nyq,nzq,sJq,Jfq;
-  nxq.resize(mesh->rfq.rows(),mesh->K);
-  nyq.resize(mesh->rfq.rows(),mesh->K);
-  nzq.resize(mesh->rfq.rows(),mesh->K);
-  sJq.resize(mesh->rfq.rows(),mesh->K);
-  Jfq.resize(mesh->rfq.rows(),mesh->K);
-  MatrixXd Vrftmp,Vsftmp,Vtftmp;
-  GradVandermonde3D(p_N,mesh->rfq,mesh->sfq,mesh->tfq,Vrftmp,Vsftmp,Vtftmp);
-  MatrixXd Vrf = mrdivide(Vrftmp,mesh->V);
-  MatrixXd Vsf = mrdivide(Vsftmp,mesh->V);
-  MatrixXd Vtf = mrdivide(Vtftmp,mesh->V);
-
-  for (int e = 0; e < mesh->K; ++e){
-    MatrixXd sgeo = sgeofacs3d(mesh->x.col(e),
-			       mesh->y.col(e),
-			       mesh->z.col(e),
-			       Vrf,Vsf,Vtf);
-    nxq.col(e) = sgeo.col(0);
-    nyq.col(e) = sgeo.col(1);
-    nzq.col(e) = sgeo.col(2);
-    sJq.col(e) = sgeo.col(3);
-  }
-
-  mesh->nxq = nxq;
-  mesh->nyq = nyq;
-  mesh->nzq = nzq;
-  mesh->sJq = sJq;
+  stats[0] = minJ;
+  stats[1] = minJelem;
+  stats[2] = maxJ;
+  stats[3] = maxJelem;
 
   const int edgenum[6][2] = { {0,1}, {1,2}, {2,0}, {0,3}, {1,3}, {2,3} };
   double hMax = 0.0;
-  for (int e = 0; e < mesh->K; ++e){
-    double hK1 = Jq.col(e).maxCoeff() / sJq.col(e).maxCoeff();
+#pragma omp parallel for reduction(max:hMax)
+  for (int e = 0; e < K; ++e){
+    double hK1 = maxJk(e) / maxsJk(e);
     double hK2 = 0; // max edge length
     for (int edge = 0; edge < 6; ++edge){
       double dx = mesh->GX(e,edgenum[edge][0])-mesh->GX(e,edgenum[edge][1]);
@@ -963,13 +1087,48 @@ void InitQuadratureArrays(Mesh *mesh){
       double tmp = sqrt(dx*dx + dy*dy + dz*dz);
       hK2 = max(hK2,tmp);
     }
-    double hK3 = pow(Jq.col(e).maxCoeff(),1.0/3.0); // J ~ h^d
+    double hK3 = pow(maxJk(e),1.0/3.0); // J ~ h^d
     double hK = max(hK1,max(hK2,hK3));
     //double hK = hK2;
 
     hMax = max(hK,hMax); // take max over entire mesh
   }
-  mesh->hMax = hMax;
+  stats[4] = hMax;
+}
+
+void InitQuadratureArrays(Mesh *mesh){
+
+  // interpolate to cubature points (one product over all elements)
+  const MatrixXd &Vq = mesh->Vq;
+  const int lean = LeanMesh(); // stream the cubature geofacs instead of storing them
+  if (!lean){
+    mesh->xq.noalias() = Vq*mesh->x;
+    mesh->yq.noalias() = Vq*mesh->y;
+    mesh->zq.noalias() = Vq*mesh->z;
+  }
+
+  // interp deriv matrices to quadrature
+  MatrixXd Vrqtmp,Vsqtmp,Vtqtmp;
+  GradVandermonde3D(p_N,mesh->rq,mesh->sq,mesh->tq,Vrqtmp,Vsqtmp,Vtqtmp);
+  mesh->Vrq = mrdivide(Vrqtmp,mesh->V);
+  mesh->Vsq = mrdivide(Vsqtmp,mesh->V);
+  mesh->Vtq = mrdivide(Vtqtmp,mesh->V);
+
+  // Jacobian extremes and hMax (or load them from the mesh cache). Of the
+  // cubature geofacs only Jq is read later (projection, error), so a cache
+  // hit loads Jq unless lean and leaves rxq..sJq unset as in lean mode
+  double stats[5];
+  if (!(MeshCacheGet("quadStats", stats, sizeof(stats)) &&
+	(lean || MeshCacheGetMatrix("Jq", mesh->Jq)))){
+    QuadratureGeofacs(mesh, stats);
+    MeshCacheAdd("quadStats", stats, sizeof(stats));
+    if (!lean){
+      MeshCacheAddMatrix("Jq", mesh->Jq);
+    }
+  }
+  printf("Minimum Jacobian = %g on elem %d, max Jacobian = %g, on elem %d\n",
+	 stats[0],(int) stats[1],stats[2],(int) stats[3]);
+  mesh->hMax = stats[4];
 }
 
 
@@ -986,60 +1145,60 @@ void AdaptiveM(Mesh *mesh, double(*c2_ptr)(double,double,double)){
   tq = mesh->tq;
   wq = mesh->wq;
   
-  MatrixXd xq = mesh->xq;
-  MatrixXd yq = mesh->yq;
-  MatrixXd zq = mesh->zq;
-  
   MatrixXd VB = BernTet(m,x,y,z);
   MatrixXd invVB = VB.inverse();
   MatrixXd VMq = Vandermonde3D(m,rq,sq,tq);
   
   int Nq = mesh->Nq;
   
-  // array of wavefield at quadrature points
-  MatrixXd rhoq(Nq, mesh->K);
-  MatrixXd lambdaq(Nq, mesh->K);
-  MatrixXd muq(Nq, mesh->K);
-  
-  for (int j = 0; j < mesh->K; ++j){
-    for (int i = 0; i < Nq; ++i){
-      
-      double weight = (*c2_ptr)(xq(i,j),yq(i,j),zq(i,j));
-      double mu = 1;
-      double lambda = 1;
-      
-      rhoq(i,j) = 1.0;
-      lambdaq(i,j) = lambda;
-      muq(i,j) = mu + weight; // constant mu                                                                                                                         
-      
-      // isotropic but discontinuous
-      double BB = 2.0;
-      if (zq(i,j) < 0){
-        muq(i,j) = BB + weight;
-        lambdaq(i,j) = BB;
+  // projection onto the degree m Bernstein basis, built once for all elements
+  MatrixXd PB = invVB * Vandermonde3D(m,x,y,z)*VMq.transpose()*wq.asDiagonal();
+  const double wsum = wq.sum();
+
+  mesh->rho_BB.resize(mp, mesh->K);
+  mesh->lambda_BB.resize(mp, mesh->K);
+  mesh->mu_BB.resize(mp, mesh->K);
+
+  // material at quadrature points, one element at a time
+#pragma omp parallel
+  {
+    VectorXd xq(Nq), yq(Nq), zq(Nq);
+    VectorXd rhoq(Nq), lambdaq(Nq), muq(Nq);
+#pragma omp for
+    for (int j = 0; j < mesh->K; ++j){
+      QuadratureNodes(mesh, j, xq, yq, zq);
+      for (int i = 0; i < Nq; ++i){
+
+	double weight = (*c2_ptr)(xq(i),yq(i),zq(i));
+	double mu = 1;
+	double lambda = 1;
+
+	rhoq(i) = 1.0;
+	lambdaq(i) = lambda;
+	muq(i) = mu + weight; // constant mu
+
+	// isotropic but discontinuous
+	double BB = 2.0;
+	if (zq(i) < 0){
+	  muq(i) = BB + weight;
+	  lambdaq(i) = BB;
+	}
       }
+      double muavg = wq.dot(muq) / wsum;
+      muq.fill(muavg);
+
+      // upload c_BB to mesh
+      mesh->rho_BB.col(j).noalias() = PB * rhoq;
+      mesh->lambda_BB.col(j).noalias() = PB * lambdaq;
+      mesh->mu_BB.col(j).noalias() = PB * muq;
     }
   }
-  
-  for (int j = 0; j < mesh->K; ++j){
-    double muavg = wq.dot(muq.col(j)) / wq.sum();
-    muq.col(j).fill(muavg);
-  }
-
-  MatrixXd c_rho = invVB * Vandermonde3D(m,x,y,z)*VMq.transpose()*wq.asDiagonal() * rhoq;
-  MatrixXd c_lambda = invVB * Vandermonde3D(m,x,y,z)*VMq.transpose()*wq.asDiagonal() * lambdaq;
-  MatrixXd c_mu = invVB * Vandermonde3D(m,x,y,z)*VMq.transpose()*wq.asDiagonal() * muq;  
-  
-  // upload c_BB to mesh
-  mesh->rho_BB = c_rho;
-  mesh->lambda_BB = c_lambda;
-  mesh->mu_BB = c_mu;
 }
 
 
 
 //Used for multiplication of polynomials w.r.t Bernstein basis
-void BB_mult(Mesh *mesh){
+static void BuildBBMult(Mesh *mesh){
 
   int N  = p_N;
   int N2 = 1;
@@ -1126,8 +1285,18 @@ void BB_mult(Mesh *mesh){
 
 }
 
+static void BBMultFields(Mesh *mesh){
+  OperatorCacheField("L_id", mesh->L_id);
+  OperatorCacheField("col_id", mesh->col_id);
+  OperatorCacheField("col_val", mesh->col_val);
+}
 
-void BB_projection(Mesh *mesh){
+void BB_mult(Mesh *mesh){
+  CachedOperators("BB_mult", mesh, BuildBBMult, BBMultFields);
+}
+
+
+static void BuildBBProjection(Mesh *mesh){
   
   int N = p_N;
   int M = 1;
@@ -1337,20 +1506,27 @@ void BB_projection(Mesh *mesh){
    
 }
 
+static void BBProjectionFields(Mesh *mesh){
+  OperatorCacheField("ENMT_val", mesh->ENMT_val);
+  OperatorCacheField("ENMT_id", mesh->ENMT_id);
+  OperatorCacheField("ENM_val", mesh->ENM_val);
+  OperatorCacheField("ENM_id", mesh->ENM_id);
+  OperatorCacheField("co", mesh->co);
+  OperatorCacheField("E", mesh->E);
+  OperatorCacheField("ENMT_index", mesh->ENMT_index);
+}
+
+void BB_projection(Mesh *mesh){
+  CachedOperators("BB_projection", mesh, BuildBBProjection, BBProjectionFields);
+}
+
 
 // Used for generating the projection matrix w.r.t nodal basis
 void projection_nodal(Mesh *mesh){
 
-  int Nq = mesh->Nq;
-
-  MatrixXd Vq = mesh->Vq;
-  MatrixXd xq = mesh->xq;
-  MatrixXd yq = mesh->yq;
-  MatrixXd zq = mesh->zq;
-    
-  
-  MatrixXd V = mesh->V;
-  MatrixXd wq = mesh->wq;
+  const MatrixXd &Vq = mesh->Vq;
+  const MatrixXd &V = mesh->V;
+  const VectorXd &wq = mesh->wq;
   MatrixXd Pq = V * V.transpose() * Vq.transpose() * wq.asDiagonal();
   
   //upload Pq to mesh                                                                                                                                                        
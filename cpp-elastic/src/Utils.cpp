@@ -155,3 +155,60 @@ int tetbase(Mesh *mesh, int k){
 }
 */
 
+
+/* runtime settings: "key = value" lines read from a setup file (default
+   "setup.rc", or the file named by BBWADG_SETUP). Any key can be
+   overridden by an environment variable BBWADG_<KEY>, e.g.
+   BBWADG_OCCA_MODE=OpenMP. Lines starting with '#' are comments. */
+static std::map<string,string> settings;
+static int settingsRead = 0;
+
+void ReadSettings(const char *filename){
+
+  settingsRead = 1;
+
+  FILE *fp = fopen(filename, "r");
+  if(!fp) return;
+
+  printf("reading settings from %s\n", filename);
+  char buf[BUFSIZ];
+  while(fgets(buf, BUFSIZ, fp)){
+    string line(buf);
+    size_t hash = line.find('#');
+    if(hash!=string::npos) line = line.substr(0, hash);
+
+    size_t eq = line.find('=');
+    if(eq==string::npos) continue;
+
+    string key = line.substr(0, eq), val = line.substr(eq+1);
+    const char *ws = " \t\r\n";
+    key.erase(0, key.find_first_not_of(ws)); key.erase(key.find_last_not_of(ws)+1);
+    val.erase(0, val.find_first_not_of(ws)); val.erase(val.find_last_not_of(ws)+1);
+    if(key.size()) settings[key] = val;
+  }
+  fclose(fp);
+}
+
+string GetSetting(const char *key, const char *defaultVal){
+
+  if(!settingsRead){
+    const char *setupFile = getenv("BBWADG_SETUP");
+    ReadSettings(setupFile ? setupFile : "setup.rc");
+  }
+
+  string envKey = "BBWADG_";
+  for(const char *c = key; *c; ++c) envKey += toupper(*c);
+  const char *envVal = getenv(envKey.c_str());
+  if(envVal) return string(envVal);
+
+  std::map<string,string>::iterator it = settings.find(key);
+  if(it!=settings.end()) return it->second;
+
+  return string(defaultVal);
+}
+
+int GetIntSetting(const char *key, int defaultVal){
+  string val = GetSetting(key, "");
+  if(val.size()==0) return defaultVal;
+  return atoi(val.c_str());
+}
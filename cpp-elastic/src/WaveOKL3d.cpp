@@ -1,5 +1,8 @@
 #include <stdio.h>
+#include <sys/time.h>
 #include "fem.h"
+#include <omp.h>
+#include <unistd.h>
 
 #include <occa.hpp>
 
@@ -11,7 +14,6 @@ int ngeo, nvgeo, nfgeo; // number of geometric factors
 
 // OCCA device
 occa::device device;
-occa::kernelInfo dgInfo;
 
 // OCCA array for geometric factors
 occa::memory c_vgeo;
@@ -30,6 +32,11 @@ occa::memory c_rhsP;
 occa::memory c_resP;
 occa::memory c_P;
 
+// scheme(s) advanced by the RK step; in compare mode the FQWADG copy (c_P)
+// runs on its own stream so it can overlap with BBWADG on c_Q
+int waveScheme = SCHEME_COMPARE;
+occa::stream streamQ, streamP;
+
 
 // OCCA arrays for nodal derivative/lift matrices
 occa::memory c_Dr;
@@ -111,6 +118,10 @@ occa::kernel rk_update_elas;
 // block sizes for optimization of diff kernels
 int KblkV, KblkS, KblkU, KblkQ, KblkQf;
 
+// native CPU SIMD Bernstein volume kernel (HostKernels.cpp) instead of OCCA
+int useHostKernels = 0;
+int NqReduced; // reduced quadrature points for the WADG update
+
 // runtime counters
 double timeV = 0.0, timeS = 0.0, timeU=0.0, timeQ = 0.0, timeQf = 0.0;
 
@@ -249,8 +260,8 @@ void InitWADG_subelem(Mesh *mesh,double(*c2_ptr)(double,double,double)){
   //cout<<"mu="<<endl<<muq<<endl;
   
 
-  dgInfo.addDefine("p_tau_v",1.0); // velocity penalty
-  dgInfo.addDefine("p_tau_s",1.0);
+  addKernelDefine("p_tau_v",1.0); // velocity penalty
+  addKernelDefine("p_tau_s",1.0);
 
   MatrixXd invM = mesh->V*mesh->V.transpose();
   MatrixXd Pq_reduced = invM*Vq_reduced.transpose()*wq.asDiagonal();
@@ -258,12 +269,13 @@ void InitWADG_subelem(Mesh *mesh,double(*c2_ptr)(double,double,double)){
   MatrixXd Pq_BB = mesh->invVB * Pq_reduced;
 
   
-  dgInfo.addDefine("p_Nq_reduced",Vq_reduced.rows()); // for update step quadrature
+  NqReduced = Vq_reduced.rows();
+  addKernelDefine("p_Nq_reduced",NqReduced); // for update step quadrature
 
   // not used in WADG subelem - just to compile other kernels
-  dgInfo.addDefine("p_NfqNfaces",mesh->Nfq * p_Nfaces); // surf quadrature
-  dgInfo.addDefine("p_Nq",mesh->Nq); // vol quadrature
-  dgInfo.addDefine("p_Nfq",mesh->Nfq); // surf quadrature for one face
+  addKernelDefine("p_NfqNfaces",mesh->Nfq * p_Nfaces); // surf quadrature
+  addKernelDefine("p_Nq",mesh->Nq); // vol quadrature
+  addKernelDefine("p_Nfq",mesh->Nfq); // surf quadrature for one face
 
   setOccaArray(rhoq,c_rhoq);
   setOccaArray(lambdaq,c_lambdaq);
@@ -298,30 +310,42 @@ void InitWADG_subelem(Mesh *mesh,double(*c2_ptr)(double,double,double)){
   setOccaArray(mesh->E, c_E);
   setOccaIntArray(mesh->ENMT_index, c_ENMT_index);
   
+  useHostKernels = GetIntSetting("host_kernels", 0);
+  if (useHostKernels && device.mode()!="Serial" && device.mode()!="OpenMP"){
+    printf("host_kernels needs occa_mode = Serial or OpenMP, ignoring\n");
+    useHostKernels = 0;
+  }
+  if (useHostKernels && (DeviceFloatSize()!=sizeof(dfloat) || DevicePrecision()==PRECISION_MIXED)){
+    printf("host_kernels store and accumulate in dfloat, ignoring with precision = mixed or double\n");
+    useHostKernels = 0;
+  }
+  if (useHostKernels && FieldLayout()!=LAYOUT_ELEMENT){
+    printf("host_kernels use the element field layout, ignoring with field_layout = field or aosoa\n");
+    useHostKernels = 0;
+  }
+  if (useHostKernels){
+    HostKernelsInit(mesh);
+  }
+
+  // time candidate block sizes on this mesh and store the winners
+  if (GetIntSetting("autotune", 0)){
+    WaveAutotune(mesh);
+  }
+
   // ======== build kernels
 
   std::string src = "okl/ElasKernelsWADG.okl";
   printf("Building heterogeneous wave propagation WADG kernel from %s\n",src.c_str());
-  rk_update_elas  = device.buildKernelFromSource(src.c_str(), "rk_update_const_elas", dgInfo);
-  rk_volume_elas  = device.buildKernelFromSource(src.c_str(), "rk_volume_elas", dgInfo);
-  rk_surface_elas = device.buildKernelFromSource(src.c_str(), "rk_surface_elas", dgInfo);
+  rk_update_elas  = buildKernel(src, "rk_update_const_elas");
+  rk_volume_elas  = buildKernel(src, "rk_volume_elas");
+  rk_surface_elas = buildKernel(src, "rk_surface_elas");
 
-  rk_volume_bern_elas  = device.buildKernelFromSource(src.c_str(),"rk_volume_bern_elas", dgInfo);
-  rk_surface_bern_elas = device.buildKernelFromSource(src.c_str(),"rk_surface_bern_elas", dgInfo);
-  rk_update_bern_elas  = device.buildKernelFromSource(src.c_str(),"rk_update_bern_const_elas", dgInfo);
+  rk_volume_bern_elas  = buildKernel(src, "rk_volume_bern_elas");
+  rk_surface_bern_elas = buildKernel(src, "rk_surface_bern_elas");
+  rk_update_bern_elas  = buildKernel(src, "rk_update_bern_const_elas");
 }
 
 
-// set occa array:: cast to dfloat.
-void setOccaArray(MatrixXd A, occa::memory &c_A){
-  int r = A.rows();
-  int c = A.cols();
-  dfloat *f_A = (dfloat*)malloc(r*c*sizeof(dfloat));
-  Map<MatrixXdf >(f_A,r,c) = A.cast<dfloat>();
-  c_A = device.malloc(r*c*sizeof(dfloat),f_A);
-  free(f_A);
-}
-
 // set occa array:: cast to dfloat
 void setOccaIntArray(MatrixXi A, occa::memory &c_A){
   int r = A.rows();
@@ -333,23 +357,120 @@ void setOccaIntArray(MatrixXi A, occa::memory &c_A){
 }
 
 
+// read setting "scheme": bbwadg, fqwadg or compare (default)
+int GetSchemeSetting(){
+  string scheme = GetSetting("scheme", "compare");
+  if (scheme=="bbwadg" || scheme=="BBWADG"){
+    return SCHEME_BBWADG;
+  }else if (scheme=="fqwadg" || scheme=="FQWADG"){
+    return SCHEME_FQWADG;
+  }else if (scheme!="compare"){
+    printf("unknown scheme %s, running BBWADG/FQWADG comparison\n", scheme.c_str());
+  }
+  return SCHEME_COMPARE;
+}
+
+// wait for all streams in use
+void WaveFinish(){
+  if (waveScheme==SCHEME_COMPARE){
+    device.setStream(streamP);
+    device.finish();
+    device.setStream(streamQ);
+  }
+  device.finish();
+}
+
+/* OpenMP threads and binding (settings omp_threads, omp_pinning = close,
+   spread, ...), for the host loops and the OCCA OpenMP kernels, which
+   share the runtime of the executable. Call before the first parallel
+   region. The runtime reads OMP_PROC_BIND/OMP_PLACES only at process
+   start, so a binding is either set with them at launch or applied by
+   re-executing the program once with them set. */
+void SetupOpenMP(char **argv){
+
+  int threads = GetIntSetting("omp_threads", 0);
+  if (threads > 0){
+    omp_set_num_threads(threads);
+  }
+
+  string pinning = GetSetting("omp_pinning", "");
+  const char *bind = getenv("OMP_PROC_BIND");
+  if (pinning.size() && (!bind || pinning!=bind)){
+    if (!getenv("BBWADG_OMP_REEXEC")){
+      setenv("OMP_PROC_BIND", pinning.c_str(), 1);
+      setenv("OMP_PLACES", "cores", 0);
+      setenv("BBWADG_OMP_REEXEC", "1", 1);
+      fflush(stdout);
+      execvp(argv[0], argv);
+    }
+    printf("omp_pinning = %s not applied, set OMP_PROC_BIND=%s at launch\n",
+	   pinning.c_str(), pinning.c_str());
+  }
+
+  const char *bindNames[5] = {"false", "true", "master", "close", "spread"};
+  const int b = (int) omp_get_proc_bind();
+  printf("OpenMP threads = %d, binding = %s\n", omp_get_max_threads(),
+	 b >= 0 && b < 5 ? bindNames[b] : "unknown");
+}
+
+// pick the OCCA backend at runtime from the setup file/environment:
+//   occa_mode = Serial | OpenMP | OpenCL | CUDA  (default CUDA)
+//   occa_platform, occa_device                  (OpenCL/CUDA ids)
+//   occa_flags                                  (kernel compiler flags)
+// omp_threads and omp_pinning are applied by SetupOpenMP
+void SetupOccaDevice(){
+
+  string mode = GetSetting("occa_mode", "CUDA");
+  int platformID = GetIntSetting("occa_platform", 0);
+  int deviceID = GetIntSetting("occa_device", 0);
+
+  char setupStr[BUFSIZ];
+  if (mode=="OpenCL" || mode=="CUDA"){
+    sprintf(setupStr, "mode = %s, platformID = %d, deviceID = %d",
+	    mode.c_str(), platformID, deviceID);
+  }else{
+    sprintf(setupStr, "mode = %s", mode.c_str());
+  }
+
+  // keep OCCA's compiled binaries next to the expanded kernel sources.
+  // OCCA reads its environment once, so this precedes any OCCA call
+  string cacheDir = getKernelCacheDir();
+  if (cacheDir!="none"){
+    setenv("OCCA_CACHE_DIR", (cacheDir + "/occa").c_str(), 0);
+  }
+
+  occa::printAvailableDevices();
+
+  printf("OCCA device: %s\n", setupStr);
+  device.setup(setupStr);
+
+  string defaultFlags = "";
+  if (mode=="OpenMP"){
+    defaultFlags = "-O3 -march=native -fopenmp";
+  }else if (mode=="Serial"){
+    defaultFlags = "-O3 -march=native";
+  }
+  string flags = GetSetting("occa_flags", defaultFlags.c_str());
+  if (flags.size()){
+    printf("OCCA kernel compiler flags: %s\n", flags.c_str());
+    device.setCompilerFlags(flags);
+  }
+}
+
 dfloat WaveInitOCCA3d(Mesh *mesh, int KblkVin, int KblkSin,
 		      int KblkUin, int KblkQin, int KblkQfin){
 
-  KblkV = KblkVin;
-  KblkS = KblkSin;
-  KblkU = KblkUin;
   KblkQ = KblkQin;
   KblkQf = KblkQfin;
 
-  occa::printAvailableDevices();
-
-  //device.setup("mode = OpenCL, platformID = 0, deviceID = 0");
-  //device.setup("mode = OpenMP, platformID = 0, deviceID = 0");
-  //device.setup("mode = Serial");
-  device.setup("mode = CUDA, platformID = 0, deviceID = 0");
+  SetupOccaDevice();
+  FieldLayoutInit(mesh);
 
-  //device.setCompiler("nvcc"); device.setCompilerFlags("--use_fast_math"); device.setCompilerFlags("--fmad=true");
+  // block sizes: command line if given (> 0), else tuning database, else defaults
+  KblkV = KblkVin > 0 ? KblkVin : getTunedKblk("rk_volume_bern_elas", 1);
+  KblkS = KblkSin > 0 ? KblkSin : getTunedKblk("rk_surface_bern_elas", 1);
+  KblkU = KblkUin > 0 ? KblkUin : getTunedKblk(GetSchemeSetting()==SCHEME_FQWADG ?
+					       "rk_update_const_elas" : "rk_update_bern_const_elas", 1);
 
   printf("KblkV = %d, KblkS = %d, KblkU = %d, KblkQ (skew only) = %d\n",
 	 KblkV,KblkS,KblkU,KblkQ);
@@ -360,22 +481,10 @@ dfloat WaveInitOCCA3d(Mesh *mesh, int KblkVin, int KblkSin,
   int sz;
 
   // nodal operators
-  sz = p_Np*p_Np*sizeof(dfloat);
-  dfloat *f_Dr = (dfloat*)malloc(p_Np*p_Np*sizeof(dfloat));
-  dfloat *f_Ds = (dfloat*)malloc(p_Np*p_Np*sizeof(dfloat));
-  dfloat *f_Dt = (dfloat*)malloc(p_Np*p_Np*sizeof(dfloat));
-  dfloat *f_LIFT = (dfloat*)malloc(p_Np*p_Nfp*p_Nfaces*sizeof(dfloat));
-
-  // alternative way to cast matrices to dfloat
-  Map<MatrixXdf >(f_Dr,p_Np,p_Np) = mesh->Dr.cast<dfloat>();
-  Map<MatrixXdf >(f_Ds,p_Np,p_Np) = mesh->Ds.cast<dfloat>();
-  Map<MatrixXdf >(f_Dt,p_Np,p_Np) = mesh->Dt.cast<dfloat>();
-  Map<MatrixXdf >(f_LIFT,p_Np,p_Nfp*p_Nfaces) = mesh->LIFT.cast<dfloat>();
-
-  c_Dr = device.malloc(sz,f_Dr);
-  c_Ds = device.malloc(sz,f_Ds);
-  c_Dt = device.malloc(sz,f_Dt);
-  c_LIFT = device.malloc(p_Np*p_Nfp*p_Nfaces*sizeof(dfloat),f_LIFT);
+  setOccaArray(mesh->Dr,c_Dr);
+  setOccaArray(mesh->Ds,c_Ds);
+  setOccaArray(mesh->Dt,c_Dt);
+  setOccaArray(mesh->LIFT,c_LIFT);
 
   c_Fmask = device.malloc(p_Nfp*p_Nfaces*sizeof(int),mesh->FmaskC[0]);
 
@@ -383,7 +492,7 @@ dfloat WaveInitOCCA3d(Mesh *mesh, int KblkVin, int KblkSin,
 
   // bernstein Dmatrices (4 entries per row)
   sz = 4*p_Np*sizeof(int);
-  c_Dvals4 = device.malloc(4*p_Np*sizeof(dfloat), mesh->D_vals[0]);
+  setOccaArray(mesh->D_vals.transpose(), c_Dvals4); // [n][j], 4 per row
 
   // barycentric deriv indices organized for ILP
   int *D_ids1 = (int*) malloc(p_Np*4*sizeof(int));
@@ -417,27 +526,23 @@ dfloat WaveInitOCCA3d(Mesh *mesh, int KblkVin, int KblkSin,
   c_D_ids4 = device.malloc(sz,D_ids4);
 
 
-  dfloat *h_EEL_vals = (dfloat*) malloc(p_Np*mesh->EEL_nnz*sizeof(dfloat));
   int *h_EEL_ids = (int*) malloc(p_Np*mesh->EEL_nnz*sizeof(int));
   for (int i = 0; i < p_Np; ++i){
     for (int j = 0; j < mesh->EEL_nnz; ++j){
-      h_EEL_vals[i + j*p_Np] = mesh->EEL_vals[i][j];
       h_EEL_ids[i + j*p_Np] = mesh->EEL_ids[i][j];
     }
   }
 
   int L0_nnz = min(p_Nfp,7);
   mesh->L0_nnz = L0_nnz;
-  dfloat *h_L0_vals = (dfloat*) malloc(p_Nfp*L0_nnz*sizeof(dfloat));
   int *h_L0_ids = (int*) malloc(p_Nfp*L0_nnz*sizeof(int));
   for (int i = 0; i < p_Nfp; ++i){
     for (int j = 0; j < L0_nnz; ++j){
-      h_L0_vals[i + j*p_Nfp] = mesh->L0_vals[i][j];
       h_L0_ids[i + j*p_Nfp] = mesh->L0_ids[i][j];
     }
   }
 
-  c_L0_vals = device.malloc(p_Nfp*L0_nnz*sizeof(dfloat),h_L0_vals);
+  setOccaArray(mesh->L0_vals, c_L0_vals); // i + j*p_Nfp, like h_L0_ids
   c_L0_ids = device.malloc(p_Nfp*L0_nnz*sizeof(int),h_L0_ids);
 
 #if (USE_SLICE_LIFT)  // should use for N > 5 (faster)
@@ -445,7 +550,7 @@ dfloat WaveInitOCCA3d(Mesh *mesh, int KblkVin, int KblkSin,
   setOccaIntArray(mesh->EEL_id_vec,c_EEL_ids);
   setOccaArray(mesh->EEL_val_vec,c_EEL_vals);
 #else
-  c_EEL_vals = device.malloc(p_Np*mesh->EEL_nnz*sizeof(dfloat),h_EEL_vals);
+  setOccaArray(mesh->EEL_vals, c_EEL_vals); // i + j*p_Np, like h_EEL_ids
   c_EEL_ids = device.malloc(p_Np*mesh->EEL_nnz*sizeof(int),h_EEL_ids);
 #endif
 
@@ -466,166 +571,217 @@ dfloat WaveInitOCCA3d(Mesh *mesh, int KblkVin, int KblkSin,
 
   // =====================  geofacs ==================================
 
-  double drdx, dsdx, dtdx;
-  double drdy, dsdy, dtdy;
-  double drdz, dsdz, dtdz, J;
-
   int sk = 0;
   int skP = -1;
-  double *nxk = (double*) calloc(mesh->Nfaces,sizeof(double));//BuildVector(mesh->Nfaces);
-  double *nyk = (double*) calloc(mesh->Nfaces,sizeof(double));//BuildVector(mesh->Nfaces);
-  double *nzk = (double*) calloc(mesh->Nfaces,sizeof(double));//BuildVector(mesh->Nfaces);
-  double *sJk = (double*) calloc(mesh->Nfaces,sizeof(double));//BuildVector(mesh->Nfaces);
 
   // [JC] packed geo + surface
   nvgeo = 9; // rst/xyz
   nfgeo = 4; // Fscale, (3)nxyz,
   ngeo = nfgeo*p_Nfaces + nvgeo; // nxyz + tau + Fscale (faces), G'*G (volume)
   dfloat *geo = (dfloat*) malloc(mesh->K*ngeo*sizeof(dfloat));
-  dfloat *vgeo = (dfloat*) malloc(K*nvgeo*sizeof(dfloat));
-  dfloat *fgeo = (dfloat*) malloc(K*nfgeo*p_Nfaces*sizeof(dfloat));
-
-  dfloat FscaleMax = 0.f;
-  for(int k=0;k<mesh->K;++k){
+  // kept in double and converted once on upload (precision = double uses them as is)
+  double *vgeo = (double*) MeshCacheMap("vgeo", K*nvgeo*sizeof(double));
+  double *fgeo = (double*) MeshCacheMap("fgeo", K*nfgeo*p_Nfaces*sizeof(double));
+
+  // packed geofacs (or use them in place from the mesh cache)
+  const int cachedGeo = vgeo && fgeo;
+  if (!cachedGeo){
+    vgeo = (double*) malloc(K*nvgeo*sizeof(double));
+    fgeo = (double*) malloc(K*nfgeo*p_Nfaces*sizeof(double));
+  }
 
-    GeometricFactors3d(mesh, k,
-		       &drdx, &dsdx, &dtdx,
-		       &drdy, &dsdy, &dtdy,
-		       &drdz, &dsdz, &dtdz, &J);
+  // elements are independent: one pass over all of them, in parallel
+  if (!cachedGeo){
+#pragma omp parallel for
+    for(int k=0;k<K;++k){
 
-    Normals3d(mesh, k, nxk, nyk, nzk, sJk);
+      double drdx, dsdx, dtdx;
+      double drdy, dsdy, dtdy;
+      double drdz, dsdz, dtdz, J;
+      double nxk[p_Nfaces], nyk[p_Nfaces], nzk[p_Nfaces], sJk[p_Nfaces];
 
-    vgeo[k*nvgeo + 0] = drdx;    vgeo[k*nvgeo + 1] = drdy;    vgeo[k*nvgeo + 2] = drdz;
-    vgeo[k*nvgeo + 3] = dsdx;    vgeo[k*nvgeo + 4] = dsdy;    vgeo[k*nvgeo + 5] = dsdz;
-    vgeo[k*nvgeo + 6] = dtdx;    vgeo[k*nvgeo + 7] = dtdy;    vgeo[k*nvgeo + 8] = dtdz;
+      GeometricFactors3d(mesh, k,
+			 &drdx, &dsdx, &dtdx,
+			 &drdy, &dsdy, &dtdy,
+			 &drdz, &dsdz, &dtdz, &J);
 
-#if 0
-    if (k==0){
-      printf("rxyz = %f, %f, %f\n",drdx,drdy,drdz);
-      printf("sxyz = %f, %f, %f\n",dsdx,dsdy,dsdz);
-      printf("txyz = %f, %f, %f\n",dtdx,dtdy,dtdz);
-      printf("J = %f\n\n",J);
-    }
-#endif
+      Normals3d(mesh, k, nxk, nyk, nzk, sJk);
 
-    for(int f=0;f<mesh->Nfaces;++f){
+      vgeo[k*nvgeo + 0] = drdx;    vgeo[k*nvgeo + 1] = drdy;    vgeo[k*nvgeo + 2] = drdz;
+      vgeo[k*nvgeo + 3] = dsdx;    vgeo[k*nvgeo + 4] = dsdy;    vgeo[k*nvgeo + 5] = dsdz;
+      vgeo[k*nvgeo + 6] = dtdx;    vgeo[k*nvgeo + 7] = dtdy;    vgeo[k*nvgeo + 8] = dtdz;
 
-      dfloat Fscale = sJk[f]/J; //sJk[f]/(2.*J);
-      dfloat nx = nxk[f];
-      dfloat ny = nyk[f];
-      dfloat nz = nzk[f];
+      for(int f=0;f<mesh->Nfaces;++f){
 
-      // for dt
-      FscaleMax = max(FscaleMax,Fscale);
+        double Fscale = sJk[f]/J; //sJk[f]/(2.*J);
+        double nx = nxk[f];
+        double ny = nyk[f];
+        double nz = nzk[f];
 
-      fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 0] = Fscale; // Fscale
-      fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 1] = nx;
-      fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 2] = ny;
-      fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 3] = nz;
+        fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 0] = Fscale; // Fscale
+        fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 1] = nx;
+        fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 2] = ny;
+        fgeo[k*nfgeo*p_Nfaces + f*nfgeo + 3] = nz;
+      }
     }
   }
-  int *h_vmapP = (int*) malloc(mesh->K*p_Nfp*p_Nfaces*sizeof(int));
+
+  // for dt
+  double FscaleMax = 0.0;
+  for (int i = 0; i < K*p_Nfaces; ++i){
+    FscaleMax = max(FscaleMax,fgeo[i*nfgeo]); // Fscale
+  }
+  if (!cachedGeo){
+    MeshCacheAdd("vgeo", vgeo, K*nvgeo*sizeof(double));
+    MeshCacheAdd("fgeo", fgeo, K*nfgeo*p_Nfaces*sizeof(double));
+  }
+  dlong *h_vmapP = (dlong*) malloc((size_t) mesh->K*p_Nfp*p_Nfaces*sizeof(dlong));
   for (int e = 0; e < mesh->K; ++e){
     for (int i = 0; i < p_Nfp*p_Nfaces; ++i){
       int f = i/p_Nfp;
-      int idP = mesh->vmapP[i + p_Nfp*p_Nfaces*e];
 
-      // correct vmapP for Nfields > 1
+      // correct vmapP for Nfields > 1 and the device field layout
       int eNbr = mesh->EToE[e][f];
-      idP -= p_Np*eNbr; // decrement
-      idP += p_Np*p_Nfields*eNbr; // re-increment
+      int nP = (int) (mesh->vmapP[i + (dlong) p_Nfp*p_Nfaces*e] - (dlong) p_Np*eNbr);
 
-      h_vmapP[i+p_Nfp*p_Nfaces*e] = idP;
+      h_vmapP[i + (dlong) p_Nfp*p_Nfaces*e] = FieldIndex(eNbr, 0, nP);
     }
   }
 
-  // storage for solution variables
-  dfloat *f_Q    = (dfloat*) calloc(mesh->K*p_Nfields*p_Np, sizeof(dfloat));
-  dfloat *f_resQ = (dfloat*) calloc(mesh->K*p_Nfields*p_Np, sizeof(dfloat));
-  dfloat *f_rhsQ = (dfloat*) calloc(mesh->K*p_Nfields*p_Np, sizeof(dfloat));
-
-  c_Q    = device.malloc(sizeof(dfloat)*mesh->K*p_Np*p_Nfields, f_Q);
-  c_resQ = device.malloc(sizeof(dfloat)*mesh->K*p_Np*p_Nfields, f_resQ);
-  c_rhsQ = device.malloc(sizeof(dfloat)*mesh->K*p_Np*p_Nfields, f_rhsQ);
+  waveScheme = GetSchemeSetting();
+  const char *schemeNames[3] = {"BBWADG", "FQWADG", "BBWADG vs FQWADG comparison"};
+  printf("scheme = %s\n", schemeNames[waveScheme]);
 
-  dfloat *f_P    = (dfloat*) calloc(mesh->K*p_Nfields*p_Np, sizeof(dfloat));
-  dfloat *f_resP = (dfloat*) calloc(mesh->K*p_Nfields*p_Np, sizeof(dfloat));
-  dfloat *f_rhsP = (dfloat*) calloc(mesh->K*p_Nfields*p_Np, sizeof(dfloat));
+  // storage for solution variables
+  double *f_Q = (double*) calloc(FieldStorageSize(), sizeof(double));
 
-  c_P    = device.malloc(sizeof(dfloat)*mesh->K*p_Np*p_Nfields, f_P);
-  c_resP = device.malloc(sizeof(dfloat)*mesh->K*p_Np*p_Nfields, f_resP);
-  c_rhsP = device.malloc(sizeof(dfloat)*mesh->K*p_Np*p_Nfields, f_rhsP);
+  c_Q    = DeviceFloatMalloc(FieldStorageSize(), f_Q);
+  c_resQ = DeviceFloatMalloc(FieldStorageSize(), f_Q);
+  c_rhsQ = DeviceFloatMalloc(FieldStorageSize(), f_Q);
 
+  // second copy of the solution only needed when comparing schemes
+  if (waveScheme==SCHEME_COMPARE){
+    c_P    = DeviceFloatMalloc(FieldStorageSize(), f_Q);
+    c_resP = DeviceFloatMalloc(FieldStorageSize(), f_Q);
+    c_rhsP = DeviceFloatMalloc(FieldStorageSize(), f_Q);
 
+    streamQ = device.getStream();
+    streamP = device.createStream();
+    device.setStream(streamQ);
+  }
+  free(f_Q);
+  
+  c_vgeo = DeviceFloatMalloc(mesh->K*nvgeo, vgeo);
+  c_fgeo = DeviceFloatMalloc(mesh->K*nfgeo*p_Nfaces, fgeo);
+
+  // compact connectivity: neighbor/orientation codes plus per-N face node permutations
+  int useCompactConn = GetIntSetting("compact_connectivity", 0);
+  if (useCompactConn && GetIntSetting("host_kernels", 0)){
+    printf("compact_connectivity is not used by the host kernels, ignoring\n");
+    useCompactConn = 0;
+  }
+  if (useCompactConn){
+    const int Nperm = p_Nfaces*p_Nfaces*6;
+    dlong *conn = BuildCompactConnectivity(mesh);
 
-  c_vgeo = device.malloc(mesh->K*nvgeo*sizeof(dfloat), vgeo);
-  c_fgeo = device.malloc(mesh->K*nfgeo*p_Nfaces*sizeof(dfloat), fgeo);
-  c_vmapP  = device.malloc(p_Nfp*p_Nfaces*mesh->K*sizeof(int),h_vmapP);
+    // check the reconstructed neighbor nodes against the full vmapP
+    int mismatch = 0;
+    for (int e = 0; e < mesh->K; ++e){
+      for (int n = 0; n < p_Nfp*p_Nfaces; ++n){
+	dlong code = conn[Nperm*p_Nfp + (dlong) e*p_Nfaces + n/p_Nfp];
+	int perm = code % Nperm;
+	int fP = (perm/6) % p_Nfaces;
+	dlong idP = FieldIndex(code/Nperm, 0, mesh->Fmask(conn[perm*p_Nfp + n%p_Nfp], fP));
+	mismatch += (idP != h_vmapP[n + (dlong) e*p_Nfp*p_Nfaces]);
+      }
+    }
+    if (mismatch){
+      printf("compact_connectivity: %d mismatched face nodes, using full vmapP\n", mismatch);
+      useCompactConn = 0;
+    }else{
+      size_t bytes = (Nperm*p_Nfp + (size_t) mesh->K*p_Nfaces)*sizeof(dlong);
+      printf("compact_connectivity: %lu bytes instead of %lu\n",
+	     (unsigned long) bytes, (unsigned long) ((size_t) p_Nfp*p_Nfaces*mesh->K*sizeof(dlong)));
+      c_vmapP = device.malloc(bytes, conn);
+    }
+    free(conn);
+  }
+  if (!useCompactConn){
+    c_vmapP  = device.malloc((size_t) p_Nfp*p_Nfaces*mesh->K*sizeof(dlong),h_vmapP);
+  }
+  addKernelDefine("p_COMPACT_CONN", useCompactConn);
 
   // build kernels
-  if (sizeof(dfloat)==8){
-    dgInfo.addDefine("USE_DOUBLE", 1);
-  }else{
-    dgInfo.addDefine("USE_DOUBLE", 0);
-  }
+  addKernelDefine("USE_DOUBLE", DevicePrecision()==PRECISION_DOUBLE);
+  addKernelDefine("USE_DOUBLE_ACCUM", DevicePrecision()!=PRECISION_SINGLE);
+  addKernelDefine("USE_DLONG", sizeof(dlong)==8);
 
-  dgInfo.addDefine("p_EEL_size",mesh->EEL_val_vec.rows());
-  dgInfo.addDefine("p_EEL_nnz",mesh->EEL_nnz);
-  dgInfo.addDefine("p_L0_nnz",min(p_Nfp,7)); // max 7 nnz with L0 matrix
+  addKernelDefine("p_EEL_size",mesh->EEL_val_vec.rows());
+  addKernelDefine("p_EEL_nnz",mesh->EEL_nnz);
+  addKernelDefine("p_L0_nnz",min(p_Nfp,7)); // max 7 nnz with L0 matrix
 
   printf("p_Nfields = %d\n",p_Nfields);
-  dgInfo.addDefine("p_Nfields",      p_Nfields); // wave equation
-
-  dgInfo.addDefine("p_N",      p_N);
-  dgInfo.addDefine("p_KblkV",  KblkV);
-  dgInfo.addDefine("p_KblkS",  KblkS);
-  dgInfo.addDefine("p_KblkU",  KblkU);
-  dgInfo.addDefine("p_KblkQ",  KblkQ);
-  dgInfo.addDefine("p_KblkQf",  KblkQf);
-
-  dgInfo.addDefine("p_Np",      p_Np);
-  dgInfo.addDefine("p_Nfp",     p_Nfp);
-  dgInfo.addDefine("p_Nfaces",  p_Nfaces);
-  dgInfo.addDefine("p_NfpNfaces",     p_Nfp*p_Nfaces);
-
-  dgInfo.addDefine("p_NMp", p_NMp);
-  dgInfo.addDefine("p_1p",4);
+  addKernelDefine("p_Nfields",      p_Nfields); // wave equation
+  addKernelDefine("p_LAYOUT", FieldLayout());
+  addKernelDefine("p_Lanes",  FieldLanes());
+  addKernelDefine("p_Kpad",   FieldLayoutK());
+
+  addKernelDefine("p_N",      p_N);
+  addKernelDefine("p_KblkV",  KblkV);
+  addKernelDefine("p_KblkS",  KblkS);
+  addKernelDefine("p_KblkU",  KblkU);
+  addKernelDefine("p_KblkQ",  KblkQ);
+  addKernelDefine("p_KblkQf",  KblkQf);
+
+  addKernelDefine("p_Np",      p_Np);
+  addKernelDefine("p_Nfp",     p_Nfp);
+  addKernelDefine("p_Nfaces",  p_Nfaces);
+  addKernelDefine("p_NfpNfaces",     p_Nfp*p_Nfaces);
+
+  addKernelDefine("p_NMp", p_NMp);
+  addKernelDefine("p_1p",4);
   
   int p_max = max(p_Np , 6);
-  dgInfo.addDefine("p_max", p_max);
+  addKernelDefine("p_max", p_max);
   // [JC] max threads
-  dgInfo.addDefine("p_ceilNq",min(512,mesh->Nq));
+  addKernelDefine("p_ceilNq",min(512,mesh->Nq));
   int T = max(p_Np,p_Nfp*p_Nfaces);
-  dgInfo.addDefine("p_T",T);
+  addKernelDefine("p_T",T);
   int Tq = max(p_Np,mesh->Nfq*p_Nfaces);
-  dgInfo.addDefine("p_Tq",Tq);
+  addKernelDefine("p_Tq",Tq);
 
-  dgInfo.addDefine("p_Nvgeo",nvgeo);
-  dgInfo.addDefine("p_Nfgeo",nfgeo);
+  addKernelDefine("p_Nvgeo",nvgeo);
+  addKernelDefine("p_Nfgeo",nfgeo);
 
 
+  // acoustic (non-WADG) kernels used only by RK_step; not shipped with the
+  // elastic code, so only built if a copy of WaveKernels.okl is available
   std::string src = "okl/WaveKernels.okl";
-  std::cout << "using src = " << src.c_str() << std::endl;
+  if (haveKernelSource(src)){
+    std::cout << "using src = " << src.c_str() << std::endl;
 
 #if USE_BERN
-  printf("Building Bernstein kernels from %s\n",src.c_str());
-  // bernstein kernels
-  rk_volume_bern  = device.buildKernelFromSource(src.c_str(), "rk_volume_bern", dgInfo);
+    printf("Building Bernstein kernels from %s\n",src.c_str());
+    // bernstein kernels
+    rk_volume_bern  = buildKernel(src, "rk_volume_bern");
 
-  printf("building rk_surface_bern from %s\n",src.c_str());
+    printf("building rk_surface_bern from %s\n",src.c_str());
 
 #if USE_SLICE_LIFT
-  rk_surface_bern = device.buildKernelFromSource(src.c_str(), "rk_surface_bern_slice", dgInfo);
-  printf("using slice-by-slice bern surface kernel; more efficient for N > 6\n");
+    rk_surface_bern = buildKernel(src, "rk_surface_bern_slice");
+    printf("using slice-by-slice bern surface kernel; more efficient for N > 6\n");
 #else
-  printf("using non-optimal bern surface kernel; more efficient for N < 6\n");
-  rk_surface_bern = device.buildKernelFromSource(src.c_str(), "rk_surface_bern", dgInfo);
+    printf("using non-optimal bern surface kernel; more efficient for N < 6\n");
+    rk_surface_bern = buildKernel(src, "rk_surface_bern");
 #endif
 #endif
-  // nodal kernels
-  rk_volume  = device.buildKernelFromSource(src.c_str(), "rk_volume", dgInfo);
-  rk_surface = device.buildKernelFromSource(src.c_str(), "rk_surface", dgInfo);
-  rk_update  = device.buildKernelFromSource(src.c_str(), "rk_update", dgInfo);
+    // nodal kernels
+    rk_volume  = buildKernel(src, "rk_volume");
+    rk_surface = buildKernel(src, "rk_surface");
+    rk_update  = buildKernel(src, "rk_update");
+  }else{
+    printf("%s not found, skipping non-WADG kernels\n", src.c_str());
+  }
 
   // estimate dt. may wish to replace with trace inequality constant
   dfloat CN = (p_N+1)*(p_N+3)/3.0;
@@ -635,7 +791,7 @@ dfloat WaveInitOCCA3d(Mesh *mesh, int KblkVin, int KblkSin,
 }
 
 // compute quadrature nodes + error
-void compute_error(Mesh *mesh, double time, dfloat *Q,
+void compute_error(Mesh *mesh, double time, double *Q,
 		   double(*uexptr)(double,double,double,double),
 		   double &L2err, double &relL2err){
 
@@ -663,7 +819,7 @@ void compute_error(Mesh *mesh, double time, dfloat *Q,
         x += Vq*mesh->x(j,k);
         y += Vq*mesh->y(j,k);
         z += Vq*mesh->z(j,k);
-        uq += Vq*Q[j+p_Np*p_Nfields*k]; // get field value for pressure
+        uq += Vq*Q[j+(dlong) p_Np*p_Nfields*k]; // get field value for pressure
       }
 
       double uex = (*uexptr)(x,y,z,(double)time);
@@ -680,12 +836,169 @@ void compute_error(Mesh *mesh, double time, dfloat *Q,
 
 }
 
+// wall clock time in seconds
+static double wallTime(){
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+// run one of the tuned kernels on the current mesh data
+static void runTuningKernel(Mesh *mesh, int which, occa::kernel &kernel){
+  dfloat fdt = 1.f, rka = 1.f, rkb = 1.f, ftime = 1.f;
+  if (which==0){
+    kernel(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_Q, c_rhsQ);
+  }else if (which==1){
+    kernel(mesh->K, c_fgeo, c_Fmask, c_vmapP, c_slice_ids, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL, c_Q, c_rhsQ);
+  }else if (waveScheme==SCHEME_FQWADG){
+    kernel(mesh->K, c_Vq_BB, c_Pq_BB, c_rhoq, c_lambdaq, c_muq, c_c11, c_c12, DeviceFloatArg(ftime), c_fsrc, DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt), c_rhsQ, c_resQ, c_Q);
+  }else{
+    kernel(mesh->K, c_col_id, c_col_val, c_L_id, c_rho_BB, c_lambda_BB, c_mu_BB, c_ENMT_val, c_ENMT_id, c_ENM_val, c_ENM_id, c_E, c_co, c_ENMT_index, DeviceFloatArg(ftime), c_fsrc_BB, DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt), c_rhsQ, c_resQ, c_Q);
+  }
+}
+
+// Sweep KblkV/KblkS/KblkU for the Bernstein volume and surface kernels and
+// the update kernel of the selected scheme, keep the fastest and save it to
+// the tuning database. RK_step_WADG_subelem launches these kernels in
+// nodal and Bernstein builds alike; the volume block size is left alone
+// with host_kernels. Called from InitWADG_subelem once the kernel defines
+// and WADG arrays are set; uses c_Q/c_rhsQ/c_resQ as scratch.
+void WaveAutotune(Mesh *mesh){
+
+  std::string src = "okl/ElasKernelsWADG.okl";
+  const char *updateName = "rk_update_bern_const_elas";
+  int updateThreads = p_NMp;
+  int updateShared = 12*p_NMp;
+  if (waveScheme==SCHEME_FQWADG){
+    updateName = "rk_update_const_elas";
+    updateThreads = NqReduced;
+    updateShared = 6*NqReduced;
+  }
+  const char *names[3]   = {useHostKernels ? "" : "rk_volume_bern_elas", "rk_surface_bern_elas", updateName};
+  const char *defines[3] = {"p_KblkV", "p_KblkS", "p_KblkU"};
+  int *Kblk[3]           = {&KblkV, &KblkS, &KblkU};
+  int threads[3]         = {p_Np, max(p_Np,p_Nfp*p_Nfaces), updateThreads};
+  int sharedPerElem[3]   = {p_Nfields*p_Np + nvgeo, p_Nfields*p_Nfp*p_Nfaces, updateShared}; // in dfloats
+
+  int maxKblk = GetIntSetting("autotune_max", p_N <= 5 ? 10 : 6);
+  int maxThreads = GetIntSetting("autotune_max_threads", 1024);
+  size_t maxShared = GetIntSetting("autotune_max_shared", 48*1024); // bytes
+  int nstep = GetIntSetting("autotune_steps", 10);
+
+  printf("autotuning block sizes on %s for N = %d, %d elements\n",
+	 getDeviceKey().c_str(), p_N, mesh->K);
+
+  for (int i = 0; i < 3; ++i){
+
+    if (!names[i][0]){
+      printf("  %s: no OCCA kernel launched with it, keeping %d\n", defines[i], *Kblk[i]);
+      continue;
+    }
+
+    int bestKblk = *Kblk[i];
+    double bestTime = 1e30;
+
+    for (int c = 1; c <= min(maxKblk, mesh->K); ++c){
+
+      if (c*threads[i] > maxThreads || c*sharedPerElem[i]*DeviceFloatSize() > maxShared){
+	break;
+      }
+
+      addKernelDefine(defines[i], c);
+      occa::kernel kernel = buildKernel(src, names[i]);
+
+      runTuningKernel(mesh, i, kernel); // warm up
+      device.finish();
+      double tstart = wallTime();
+      for (int step = 0; step < nstep; ++step){
+	runTuningKernel(mesh, i, kernel);
+      }
+      device.finish();
+      double elapsed = (wallTime() - tstart)/nstep;
+      kernel.free();
+
+      printf("  %s: %s = %d, time per call = %g\n", names[i], defines[i], c, elapsed);
+      if (elapsed < bestTime){
+	bestTime = elapsed;
+	bestKblk = c;
+      }
+    }
+
+    *Kblk[i] = bestKblk;
+    addKernelDefine(defines[i], bestKblk);
+    setTunedKblk(names[i], bestKblk, bestTime);
+    printf("  %s: best %s = %d\n", names[i], defines[i], bestKblk);
+  }
+
+  // the tuned kernels overwrite the solution storage
+  device.finish();
+  dfloat *zeros = (dfloat*) calloc(FieldStorageSize(), sizeof(dfloat));
+  DeviceFloatCopyFrom(c_Q, zeros);
+  DeviceFloatCopyFrom(c_resQ, zeros);
+  DeviceFloatCopyFrom(c_rhsQ, zeros);
+  free(zeros);
+
+  printf("tuned KblkV = %d, KblkS = %d, KblkU = %d saved to %s\n",
+	 KblkV, KblkS, KblkU, getTuningFile().c_str());
+}
+
+/* host_kernels against the OCCA Bernstein volume kernel of the same backend
+   (Serial or OpenMP): time per call, elements per second per thread, and
+   the largest difference in rhsQ after one evaluation */
+void time_host_kernels(Mesh *mesh){
+
+  const int nstep = GetIntSetting("benchmark_steps", 20);
+  const int threads[2] = {device.mode()=="OpenMP" ? omp_get_max_threads() : 1, omp_get_max_threads()};
+  const dlong Ntotal = FieldStorageSize();
+  dfloat *rhs[2];
+  double elapsed[2] = {0.0, 0.0};
+
+  for (int host = 0; host < 2; ++host){
+    rhs[host] = (dfloat*) malloc(Ntotal*sizeof(dfloat));
+    for (int step = -1; step < nstep; ++step){ // step -1 warms up and is compared
+      device.finish();
+      double tstart = wallTime();
+      if (host){
+	host_rk_volume_bern_elas(mesh->K, (dfloat*) c_vgeo.getMemoryHandle(),
+				 (dfloat*) c_Q.getMemoryHandle(), (dfloat*) c_rhsQ.getMemoryHandle());
+      }else{
+	rk_volume_bern_elas(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_Q, c_rhsQ);
+      }
+      device.finish();
+      if (step >= 0){
+	elapsed[host] += (wallTime() - tstart)/nstep;
+      }else{
+	DeviceFloatCopyTo(c_rhsQ, rhs[host]);
+      }
+    }
+  }
+
+  double diff = 0.0, scale = 0.0;
+  for (dlong n = 0; n < Ntotal; ++n){
+    diff = max(diff, (double) fabs(rhs[1][n] - rhs[0][n]));
+    scale = max(scale, (double) fabs(rhs[0][n]));
+  }
+  const double perThread[2] = {mesh->K/(elapsed[0]*threads[0]), mesh->K/(elapsed[1]*threads[1])};
+  printf("host_kernels rk_volume_bern_elas: OCCA %s %g s (%d threads), host %g s (%d threads) per call; "
+	 "%.4g vs %.4g elements/s per thread (%.2fx)\n",
+	 device.mode().c_str(), elapsed[0], threads[0], elapsed[1], threads[1],
+	 perThread[0], perThread[1], perThread[1]/perThread[0]);
+  printf("host_kernels: max difference in rhsQ %g (max |rhsQ| %g)\n", diff, scale);
+
+  free(rhs[0]);
+  free(rhs[1]);
+}
+
 // times main_sublem kernels
 void time_kernels_elas(Mesh *mesh){
 
+  if (useHostKernels){
+    time_host_kernels(mesh);
+  }
+
   double gflops = 0.0;
   double bw = 0.0;
-  double denom = (double) (100 * mesh->K * p_Np * p_Nfields);
+  double denom = 100.0 * mesh->K * p_Np * p_Nfields;
   FILE *timingFile = fopen ("blockTimings.txt","a");
 
   occa::initTimer(device);
@@ -701,17 +1014,17 @@ void time_kernels_elas(Mesh *mesh){
     occa::tic("volume_elas (bern)");
     rk_volume_bern_elas(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_Q, c_rhsQ);
     device.finish();
-    dfloat elapsedV = occa::toc("volume_elas (bern)",rk_volume_bern_elas, gflops, bw * sizeof(dfloat));
+    dfloat elapsedV = occa::toc("volume_elas (bern)",rk_volume_bern_elas, gflops, bw * DeviceFloatSize());
 
     occa::tic("surface_elas (bern))");
     rk_surface_bern_elas(mesh->K, c_fgeo, c_Fmask, c_vmapP, c_slice_ids, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL, c_Q, c_rhsQ);
     device.finish();
-    dfloat elapsedS = occa::toc("surface_elas (bern)",rk_surface_bern_elas, gflops, bw * sizeof(dfloat));
+    dfloat elapsedS = occa::toc("surface_elas (bern)",rk_surface_bern_elas, gflops, bw * DeviceFloatSize());
 
     occa::tic("update_elas_full (bern)");
-    rk_update_elas(mesh->K, c_Vq_BB, c_Pq_BB, c_rhoq, c_lambdaq, c_muq, c_c11, c_c12,ftime, c_fsrc,rka, rkb, fdt,c_rhsQ, c_resQ, c_Q);
+    rk_update_elas(mesh->K, c_Vq_BB, c_Pq_BB, c_rhoq, c_lambdaq, c_muq, c_c11, c_c12,DeviceFloatArg(ftime), c_fsrc,DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt),c_rhsQ, c_resQ, c_Q);
     device.finish();
-    dfloat elapsedU = occa::toc("update_elas_full (nodal)",rk_update_elas, gflops, bw * sizeof(dfloat));
+    dfloat elapsedU = occa::toc("update_elas_full (nodal)",rk_update_elas, gflops, bw * DeviceFloatSize());
 
     timeV+=elapsedV;
     timeS+=elapsedS;
@@ -737,17 +1050,17 @@ void time_kernels_elas(Mesh *mesh){
     occa::tic("volume_elas (bern)");
     rk_volume_bern_elas(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_Q, c_rhsQ);
     device.finish();
-    dfloat elapsedV = occa::toc("volume_elas (bern)",rk_volume_bern_elas, gflops, bw * sizeof(dfloat));
+    dfloat elapsedV = occa::toc("volume_elas (bern)",rk_volume_bern_elas, gflops, bw * DeviceFloatSize());
 
     occa::tic("surface_elas (bern)");
     rk_surface_bern_elas(mesh->K, c_fgeo, c_Fmask, c_vmapP, c_slice_ids, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL, c_Q, c_rhsQ);
     device.finish();
-    dfloat elapsedS = occa::toc("surface_elas (bern)",rk_surface_bern_elas, gflops, bw * sizeof(dfloat));
+    dfloat elapsedS = occa::toc("surface_elas (bern)",rk_surface_bern_elas, gflops, bw * DeviceFloatSize());
 
     occa::tic("update_elas (bern)");
-    rk_update_bern_elas(mesh->K, c_col_id, c_col_val, c_L_id, c_rho_BB, c_lambda_BB, c_mu_BB, c_ENMT_val, c_ENMT_id, c_ENM_val, c_ENM_id, c_E, c_co, c_ENMT_index, ftime, c_fsrc_BB, rka, rkb, fdt, c_rhsP, c_resP, c_P);
+    rk_update_bern_elas(mesh->K, c_col_id, c_col_val, c_L_id, c_rho_BB, c_lambda_BB, c_mu_BB, c_ENMT_val, c_ENMT_id, c_ENM_val, c_ENM_id, c_E, c_co, c_ENMT_index, DeviceFloatArg(ftime), c_fsrc_BB, DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt), c_rhsQ, c_resQ, c_Q);
     device.finish();
-    dfloat elapsedU = occa::toc("update_elas (bern)",rk_update_bern_elas, gflops, bw * sizeof(dfloat));
+    dfloat elapsedU = occa::toc("update_elas (bern)",rk_update_bern_elas, gflops, bw * DeviceFloatSize());
 
     
     timeV+=elapsedV;
@@ -802,9 +1115,9 @@ void Wave_RK(Mesh *mesh, dfloat FinalTime, dfloat dt, int useWADG){
     for (INTRK=1; INTRK<=5; ++INTRK) {
       
       // compute DG rhs
-      const dfloat fdt = dt;
-      const dfloat fa = (float)mesh->rk4a[INTRK-1];
-      const dfloat fb = (float)mesh->rk4b[INTRK-1];
+      const double fdt = dt;
+      const double fa = mesh->rk4a[INTRK-1];
+      const double fb = mesh->rk4b[INTRK-1];
       
       RK_step_WADG_subelem(mesh, fa, fb, fdt, time);
     }
@@ -817,28 +1130,43 @@ void Wave_RK(Mesh *mesh, dfloat FinalTime, dfloat dt, int useWADG){
 }
 
 // defaults to nodal!!
-void RK_step_WADG_subelem(Mesh *mesh, dfloat rka, dfloat rkb, dfloat fdt, dfloat time){
-
-  dfloat f0 = 10.0;
-  dfloat tR = 1.0 / f0;
-  dfloat at = M_PI*f0*(time-tR);
-  dfloat ftime = 1e4*(1.0 - 2.0*at*at)*exp(-at*at); // ricker pulse
-  // kernels for Bernstein
-  rk_volume_bern_elas(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_Q, c_rhsQ);
+void RK_step_WADG_subelem(Mesh *mesh, double rka, double rkb, double fdt, double time){
+
+  double f0 = 10.0;
+  double tR = 1.0 / f0;
+  double at = M_PI*f0*(time-tR);
+  double ftime = 1e4*(1.0 - 2.0*at*at)*exp(-at*at); // ricker pulse
+  // c_Q: BBWADG (or FQWADG if that is the only scheme being run)
+  if (useHostKernels){
+    host_rk_volume_bern_elas(mesh->K, (dfloat*) c_vgeo.getMemoryHandle(),
+			     (dfloat*) c_Q.getMemoryHandle(), (dfloat*) c_rhsQ.getMemoryHandle());
+  }else{
+    rk_volume_bern_elas(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_Q, c_rhsQ);
+  }
   rk_surface_bern_elas(mesh->K, c_fgeo, c_Fmask, c_vmapP, c_slice_ids, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL, c_Q, c_rhsQ);
-  rk_update_bern_elas(mesh->K, c_col_id, c_col_val, c_L_id, c_rho_BB, c_lambda_BB, c_mu_BB, c_ENMT_val, c_ENMT_id, c_ENM_val, c_ENM_id, c_E, c_co, c_ENMT_index, ftime, c_fsrc_BB, rka, rkb, fdt, c_rhsQ, c_resQ, c_Q);
+  if (waveScheme==SCHEME_FQWADG){
+    rk_update_elas(mesh->K, c_Vq_BB, c_Pq_BB, c_rhoq, c_lambdaq, c_muq, c_c11, c_c12,DeviceFloatArg(ftime), c_fsrc,DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt),c_rhsQ, c_resQ, c_Q);
+  }else{
+    rk_update_bern_elas(mesh->K, c_col_id, c_col_val, c_L_id, c_rho_BB, c_lambda_BB, c_mu_BB, c_ENMT_val, c_ENMT_id, c_ENM_val, c_ENM_id, c_E, c_co, c_ENMT_index, DeviceFloatArg(ftime), c_fsrc_BB, DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt), c_rhsQ, c_resQ, c_Q);
+  }
   
-  // kernels for Nodal
-  rk_volume_bern_elas(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_P, c_rhsP);
-  rk_surface_bern_elas(mesh->K, c_fgeo, c_Fmask, c_vmapP, c_slice_ids, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL, c_P, c_rhsP);
-  //rk_update_bern_elas(mesh->K, c_col_id, c_col_val, c_L_id, c_rho_BB, c_lambda_BB, c_mu_BB, c_ENMT_val, c_ENMT_id, c_ENM_val, c_ENM_id, c_E, c_co, c_ENMT_index, ftime, c_fsrc_BB, rka, rkb, fdt, c_rhsP, c_resP, c_P);
-  rk_update_elas(mesh->K, c_Vq_BB, c_Pq_BB, c_rhoq, c_lambdaq, c_muq, c_c11, c_c12,ftime, c_fsrc,rka, rkb, fdt,c_rhsP, c_resP, c_P);
-
-  device.finish();
+  // c_P: full-quadrature WADG on a second stream for comparison
+  if (waveScheme==SCHEME_COMPARE){
+    device.setStream(streamP);
+    if (useHostKernels){
+      host_rk_volume_bern_elas(mesh->K, (dfloat*) c_vgeo.getMemoryHandle(),
+			       (dfloat*) c_P.getMemoryHandle(), (dfloat*) c_rhsP.getMemoryHandle());
+    }else{
+      rk_volume_bern_elas(mesh->K, c_vgeo, c_D_ids1, c_D_ids2, c_D_ids3, c_D_ids4, c_Dvals4, c_P, c_rhsP);
+    }
+    rk_surface_bern_elas(mesh->K, c_fgeo, c_Fmask, c_vmapP, c_slice_ids, c_EEL_ids, c_EEL_vals, c_L0_ids, c_L0_vals, c_cEL, c_P, c_rhsP);
+    rk_update_elas(mesh->K, c_Vq_BB, c_Pq_BB, c_rhoq, c_lambdaq, c_muq, c_c11, c_c12,DeviceFloatArg(ftime), c_fsrc,DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt),c_rhsP, c_resP, c_P);
+    device.setStream(streamQ);
+  }
 
 }
 
-void RK_step(Mesh *mesh, dfloat rka, dfloat rkb, dfloat fdt){
+void RK_step(Mesh *mesh, double rka, double rkb, double fdt){
 
   double gflops = 0.0;
   double bw = 0.0;
@@ -864,13 +1192,13 @@ void RK_step(Mesh *mesh, dfloat rka, dfloat rkb, dfloat fdt){
 
 #endif
 
-  rk_update(mesh->K, rka, rkb, fdt, c_rhsQ, c_resQ, c_Q);
+  rk_update(mesh->K, DeviceFloatArg(rka), DeviceFloatArg(rkb), DeviceFloatArg(fdt), c_rhsQ, c_resQ, c_Q);
   //int Ntotal = p_Nfields*p_Np*mesh->K;
   //rk_update(Ntotal, rka, rkb, fdt, c_rhsQ, c_resQ, c_Q);
 
 #if 1
-  dfloat *f_Q = (dfloat*) calloc(p_Nfields*mesh->K*p_Np, sizeof(dfloat));
-  c_Q.copyTo(f_Q);
+  dfloat *f_Q = (dfloat*) calloc((dlong) p_Nfields*mesh->K*p_Np, sizeof(dfloat));
+  DeviceFloatCopyTo(c_Q, f_Q);
   for(int fld = 0; fld < p_Nfields; ++fld){
     printf("Field solution %d: \n",fld);
     for(int i = 0; i < p_Np; ++i){
@@ -890,14 +1218,14 @@ void RK_step(Mesh *mesh, dfloat rka, dfloat rkb, dfloat fdt){
 
 
 // set initial condition
-void WaveSetU0(Mesh *mesh, dfloat *Q, dfloat time, int field,
+void WaveSetU0(Mesh *mesh, double *Q, double time, int field,
 	       double(*uexptr)(double,double,double,double)){
 
   // write out field = fields 2-4 = 0 (velocity)
   for(int k = 0; k < mesh->K; ++k){
 
     // store local interpolant
-    dfloat *Qloc = BuildVector(p_Np);
+    double *Qloc = (double*) calloc(p_Np, sizeof(double));
     for(int i = 0; i < p_Np; ++i){
       double x = mesh->x(i,k);
       double y = mesh->y(i,k);
@@ -907,7 +1235,7 @@ void WaveSetU0(Mesh *mesh, dfloat *Q, dfloat time, int field,
 
 #if 0 // convert nodal values to bernstein coefficients
 
-    dfloat *Qtmp = BuildVector(p_Np);
+    double *Qtmp = (double*) calloc(p_Np, sizeof(double));
     for (int i = 0; i < p_Np; ++i){
       Qtmp[i] = 0.f;
       for (int j = 0; j < p_Np; ++j){
@@ -921,7 +1249,7 @@ void WaveSetU0(Mesh *mesh, dfloat *Q, dfloat time, int field,
 #endif
 
     for (int i = 0; i < p_Np; ++i){
-      int id = k*p_Np*p_Nfields + i + p_Np*field;
+      dlong id = (dlong) k*p_Np*p_Nfields + i + p_Np*field;
       Q[id] = Qloc[i];
     }
   }
@@ -929,15 +1257,15 @@ void WaveSetU0(Mesh *mesh, dfloat *Q, dfloat time, int field,
 
 
 // set initial condition
-void WaveSetU0P0(Mesh *mesh, dfloat *Q, dfloat *P, dfloat time, int field,
+void WaveSetU0P0(Mesh *mesh, double *Q, double *P, double time, int field,
 		 double(*uexptr)(double,double,double,double)){
 
   // write out field = fields 2-4 = 0 (velocity)
   for(int k = 0; k < mesh->K; ++k){
 
     // store local interpolant
-    dfloat *Qloc = BuildVector(p_Np);
-    dfloat *Ploc = BuildVector(p_Np);
+    double *Qloc = (double*) calloc(p_Np, sizeof(double));
+    double *Ploc = (double*) calloc(p_Np, sizeof(double));
     for(int i = 0; i < p_Np; ++i){
       double x = mesh->x(i,k);
       double y = mesh->y(i,k);
@@ -948,7 +1276,7 @@ void WaveSetU0P0(Mesh *mesh, dfloat *Q, dfloat *P, dfloat time, int field,
 
     // convert nodal values to bernstein coefficients
     
-    dfloat *Qtmp = BuildVector(p_Np);
+    double *Qtmp = (double*) calloc(p_Np, sizeof(double));
     
     for (int i = 0; i < p_Np; ++i){
       Qtmp[i] = 0.f;
@@ -964,7 +1292,7 @@ void WaveSetU0P0(Mesh *mesh, dfloat *Q, dfloat *P, dfloat time, int field,
     
     // Convert both P and Q to bernstein coefficients
     for (int i = 0; i < p_Np; ++i){
-      int id = k*p_Np*p_Nfields + i + p_Np*field;
+      dlong id = (dlong) k*p_Np*p_Nfields + i + p_Np*field;
       Q[id] = Qloc[i];
       P[id] = Qloc[i];
     }
@@ -973,31 +1301,34 @@ void WaveSetU0P0(Mesh *mesh, dfloat *Q, dfloat *P, dfloat time, int field,
 
 
 // set initial condition
-void WaveProjectU0(Mesh *mesh, dfloat *Q, dfloat time,int field,
+void WaveProjectU0(Mesh *mesh, double *Q, double time,int field,
 		   double(*uexptr)(double,double,double,double)){
 
   int Nq = mesh->Nq;
   VectorXd wq = mesh->wq;
   MatrixXd Vq = mesh->Vq;
-  printf("Nq = %d, size of xq = %d\n",Nq,mesh->xq.rows());
+  printf("Nq = %d, size of xq = %d\n",Nq,(int) mesh->xq.rows());
   printf("size of Vq = %d, %d\n",Vq.rows(),Vq.cols());
 
   MatrixXd Qloc(p_Np,1);
+  VectorXd xq(Nq), yq(Nq), zq(Nq), Jq(Nq);
 
   // write out field = fields 2-4 = 0 (velocity)
   for(int k = 0; k < mesh->K; ++k){
 
     // compute mass matrix explicitly w/quadrature
-    VectorXd Jq = mesh->Jq.col(k);
+    if (mesh->Jq.rows()>0){
+      Jq = mesh->Jq.col(k);
+    }else{
+      Jq.fill(mesh->J(0,k)); // lean_mesh: affine elements
+    }
     MatrixXd Mloc = Vq.transpose() * wq.asDiagonal() * Jq.asDiagonal() * Vq;
 
     // compute fxn at quad nodes
+    QuadratureNodes(mesh, k, xq, yq, zq);
     MatrixXd uq(Nq,1);
     for (int i = 0; i < Nq; ++i){
-      double xq = mesh->xq(i,k);
-      double yq = mesh->yq(i,k);
-      double zq = mesh->zq(i,k);
-      double uqi = (*uexptr)(xq,yq,zq,0.0);
+      double uqi = (*uexptr)(xq(i),yq(i),zq(i),0.0);
       //printf("uq[%d] = %g\n",i,uqi);
       uq(i,0) = uqi*wq(i)*Jq(i);
     }
@@ -1012,7 +1343,7 @@ void WaveProjectU0(Mesh *mesh, dfloat *Q, dfloat time,int field,
 
     // set pressure
     for (int i = 0; i < p_Np; ++i){
-      int id = k*p_Np*p_Nfields + i + field*p_Np;
+      dlong id = (dlong) k*p_Np*p_Nfields + i + field*p_Np;
       Q[id] = Qloc(i,0);
     }
 
@@ -1031,32 +1362,60 @@ void WaveProjectU0(Mesh *mesh, dfloat *Q, dfloat time,int field,
 }
 
 
-void WaveSetData3d(dfloat *Q, dfloat *P){
-  c_Q.copyFrom(Q);
-  c_P.copyFrom(P);
+void WaveSetData3d(double *Q, double *P){
+  if (FieldLayout()==LAYOUT_ELEMENT){
+    DeviceFloatCopyFrom(c_Q, Q);
+    if (waveScheme==SCHEME_COMPARE){
+      DeviceFloatCopyFrom(c_P, P);
+    }
+    return;
+  }
+  // reorder into the device field layout
+  double *Qdev = (double*) malloc(FieldStorageSize()*sizeof(double));
+  FieldsToDevice(Q, Qdev);
+  DeviceFloatCopyFrom(c_Q, Qdev);
+  if (waveScheme==SCHEME_COMPARE){
+    FieldsToDevice(P, Qdev);
+    DeviceFloatCopyFrom(c_P, Qdev);
+  }
+  free(Qdev);
 }
 
 
-void WaveGetData3d(Mesh *mesh, dfloat *Q, dfloat *P){
-  c_Q.copyTo(Q);
-  c_P.copyTo(P);
+void WaveGetData3d(Mesh *mesh, double *Q, double *P){
+  WaveFinish();
+  if (FieldLayout()==LAYOUT_ELEMENT){
+    DeviceFloatCopyTo(c_Q, Q);
+    if (waveScheme==SCHEME_COMPARE){
+      DeviceFloatCopyTo(c_P, P);
+    }
+  }else{
+    double *Qdev = (double*) malloc(FieldStorageSize()*sizeof(double));
+    DeviceFloatCopyTo(c_Q, Qdev);
+    FieldsFromDevice(Qdev, Q);
+    if (waveScheme==SCHEME_COMPARE){
+      DeviceFloatCopyTo(c_P, Qdev);
+      FieldsFromDevice(Qdev, P);
+    }
+    free(Qdev);
+  }
 
  
-  dfloat *Qtmp = BuildVector(p_Np);
-  dfloat *Ptmp = BuildVector(p_Np);
+  double *Qtmp = (double*) calloc(p_Np, sizeof(double));
+  double *Ptmp = (double*) calloc(p_Np, sizeof(double));
   for (int fld = 0; fld < p_Nfields; fld++){
     for (int e = 0; e < mesh->K; ++e){
       for (int i = 0; i < p_Np; ++i){
 	Qtmp[i] = 0.f;
 	Ptmp[i] = 0.f;
 	for (int j = 0; j < p_Np; ++j){
-	  int id = j + fld*p_Np + e*p_Nfields*p_Np;
+	  dlong id = j + fld*p_Np + (dlong) e*p_Nfields*p_Np;
 	  Qtmp[i] += mesh->VB(i,j)*Q[id];
 	  Ptmp[i] += mesh->VB(i,j)*P[id];
 	}
       }
       for (int i = 0; i < p_Np; ++i){
-	int id = i + fld*p_Np + e*p_Nfields*p_Np;
+	dlong id = i + fld*p_Np + (dlong) e*p_Nfields*p_Np;
 	Q[id] = Qtmp[i];
 	P[id] = Ptmp[i];
       }
@@ -1064,7 +1423,7 @@ void WaveGetData3d(Mesh *mesh, dfloat *Q, dfloat *P){
   }
 }
 
-void writeVisToGMSH(string fileName, Mesh *mesh,dfloat *Q, int iField, int Nfields){
+void writeVisToGMSH(string fileName, Mesh *mesh,double *Q, int iField, int Nfields){
 
   int timeStep = 0;
   double time = 0.0;
@@ -1138,7 +1497,7 @@ void writeVisToGMSH(string fileName, Mesh *mesh,dfloat *Q, int iField, int Nfiel
   for(int k=0; k<K; k++){
     *posFile << mesh->EToGmshE(k) << " " << p_Np;
     for(int i=0; i<p_Np; i++)
-      *posFile << " " << Q[i + iField*p_Np + k*p_Np*Nfields];
+      *posFile << " " << Q[i + iField*p_Np + (dlong) k*p_Np*Nfields];
     *posFile << endl;
   }
   *posFile << "$EndElementNodeData" << endl;
@@ -1150,7 +1509,7 @@ void writeVisToGMSH(string fileName, Mesh *mesh,dfloat *Q, int iField, int Nfiel
 
 
 
-void compute_error_adaptive(Mesh *mesh, dfloat *Q, dfloat *P, double &L2error, double &reL2error){
+void compute_error_adaptive(Mesh *mesh, double *Q, double *P, double &L2error, double &reL2error){
 
   //compute error                                                                                           
   L2error = 0.0;
@@ -1164,8 +1523,8 @@ void compute_error_adaptive(Mesh *mesh, dfloat *Q, dfloat *P, double &L2error, d
       
       for(int j=0; j<p_Np;++j){
         double Vq = mesh->Vq(i,j);
-        uq += Vq * Q[j+p_Np*p_Nfields*k];
-        up += Vq * P[j+p_Np*p_Nfields*k];
+        uq += Vq * Q[j+(dlong) p_Np*p_Nfields*k];
+        up += Vq * P[j+(dlong) p_Np*p_Nfields*k];
       }
       
       double err = uq - up;